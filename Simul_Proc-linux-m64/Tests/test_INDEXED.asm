@@ -0,0 +1,34 @@
+//-----------------
+// Instructions
+//-----------------
+        TEXT 7
+
+        // Programme principal : ajoute 1 à chaque mot de table,
+        // du dernier au premier. R01 reste dans [1, 4] : les deux
+        // adresses indexées sont prouvées au chargement, et le
+        // programme s'arrête sur HALT, avec ou sans -G.
+main    EQU *
+        LOAD R01, #4
+loop    LOAD R00, base[R01]
+        ADD R00, #1
+        STORE R00, base[R01]
+        SUB R01, #1
+        BRANCH GT, @loop
+        HALT
+
+        END
+        
+//-----------------
+// Données et pile
+//-----------------
+        DATA 24
+        
+        WORD 0
+result  WORD 0
+base    WORD 0          // table[i] est base[i + 1]
+table   WORD 10
+        WORD 20
+        WORD 30
+        WORD 40
+        
+        END
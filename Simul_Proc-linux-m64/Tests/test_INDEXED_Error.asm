@@ -0,0 +1,32 @@
+//-----------------
+// Instructions
+//-----------------
+        TEXT 6
+
+        // Programme principal : l'index vient du segment de
+        // données, le vérificateur ne peut pas le borner. La
+        // lecture de table[15] est dans le segment ; celle de
+        // table[30] en sort : erreur de segment de données sur
+        // l'instruction 0x0003 (message à 0x0004), avec ou sans -G.
+main    EQU *
+        LOAD R01, @n
+        LOAD R00, table[R01]
+        ADD R01, @n
+        LOAD R02, table[R01]
+        STORE R02, @result
+        HALT
+
+        END
+        
+//-----------------
+// Données et pile
+//-----------------
+        DATA 24
+        
+        WORD 0
+result  WORD 0
+n       WORD 15
+table   WORD 10
+        WORD 20
+        
+        END
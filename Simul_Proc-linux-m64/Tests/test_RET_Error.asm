@@ -0,0 +1,42 @@
+//-----------------
+// Instructions
+//-----------------
+        TEXT 5
+
+        // Programme principal : chaque retour de next avance
+        // l'index de 5. Le vérificateur suit RET jusqu'à
+        // l'adresse de retour, sans pouvoir borner R01 : le
+        // troisième STORE sort des données statiques, erreur de
+        // segment de données sur l'instruction 0x0001 (message à
+        // 0x0002), avec ou sans -G.
+main    EQU *
+loop    CALL NC, @next
+        STORE R01, table[R01]
+        BRANCH NC, @loop
+
+        // Sous-programme
+next    ADD R01, #5
+        RET
+
+        END
+        
+//-----------------
+// Données et pile
+//-----------------
+        DATA 24
+        
+        WORD 0
+result  WORD 0
+table   WORD 0
+        WORD 0
+        WORD 0
+        WORD 0
+        WORD 0
+        WORD 0
+        WORD 0
+        WORD 0
+        WORD 0
+        WORD 0
+        WORD 0
+        
+        END
@@ -0,0 +1,226 @@
+/*!
+ * \file async.c
+ * \brief Écriture asynchrone des traces et des messages du simulateur
+ *
+ * Le tampon circulaire est indexé par deux compteurs de 64 bits qui ne
+ * reviennent jamais à zéro : \c head (prochain dépôt, écrit par le
+ * producteur) et \c tail (prochaine lecture, écrit par l'écrivain). Chacun
+ * est seul sur sa ligne de cache ; la publication d'un enregistrement est
+ * une écriture avec sémantique \e release de \c head.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "async.h"
+#include "exec.h"
+
+//! Taille d'une ligne de cache
+#define CACHE_LINE 64
+
+//! Nature d'un enregistrement
+typedef enum
+{
+	RECORD_TRACE,
+	RECORD_WARNING,
+	RECORD_ERROR,
+} Record_Kind;
+
+//! Enregistrement déposé dans le tampon
+typedef struct
+{
+	const char *_msg;	//!< Message de trace
+	uint32_t _addr;		//!< Adresse de l'instruction, de l'avertissement ou de l'erreur
+	uint32_t _value;	//!< Instruction brute, ou code d'avertissement ou d'erreur
+	uint32_t _kind;		//!< Nature (\link Record_Kind \endlink)
+} Record;
+
+//! Tampon circulaire
+static Record *ring = NULL;
+
+//! Nombre d'enregistrements du tampon, moins 1
+static uint64_t mask;
+
+//! Comportement quand le tampon est plein
+static Async_Policy policy;
+
+//! Écriture asynchrone active ?
+static bool active = false;
+
+//! Processus léger d'écriture
+static pthread_t writer_thread;
+
+//! Prochain dépôt (producteur)
+static uint64_t head __attribute__((aligned(CACHE_LINE)));
+
+//! Dernière valeur de \c tail lue par le producteur
+static uint64_t cached_tail;
+
+//! Nombre d'enregistrements perdus (producteur)
+static uint64_t dropped;
+
+//! Prochaine lecture (écrivain)
+static uint64_t tail __attribute__((aligned(CACHE_LINE)));
+
+//! Demande d'arrêt de l'écrivain
+static bool stopping __attribute__((aligned(CACHE_LINE)));
+
+//! Mise en forme et écriture d'un enregistrement
+static void write_record(const Record *rec)
+{
+	switch (rec->_kind) {
+		case RECORD_TRACE:
+			print_trace(rec->_msg, (Instruction) {._raw = rec->_value}, rec->_addr);
+			break;
+		case RECORD_WARNING:
+			print_warning(rec->_value, rec->_addr);
+			break;
+		default:
+			print_error(rec->_value, rec->_addr);
+			break;
+	}
+}
+
+//! Processus léger d'écriture
+/*!
+ * Écrit les enregistrements déposés par paquets ; quand le tampon est vide,
+ * vide la sortie standard et se met en sommeil un court instant.
+ */
+static void *writer(void *arg)
+{
+	static const struct timespec pause = {0, 50000};
+	uint64_t next = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+
+	for (;;) {
+		uint64_t last = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+
+		if (next == last) {
+			if (__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)
+			    && __atomic_load_n(&head, __ATOMIC_ACQUIRE) == next)
+				break;
+			fflush(stdout);
+			nanosleep(&pause, NULL);
+			continue;
+		}
+		while (next != last) {
+			write_record(&ring[next & mask]);
+			++next;
+			// Libération de la place par paquets, pour un producteur bloqué
+			if ((next & 0xff) == 0)
+				__atomic_store_n(&tail, next, __ATOMIC_RELEASE);
+		}
+		__atomic_store_n(&tail, next, __ATOMIC_RELEASE);
+	}
+	fflush(stdout);
+	return arg;
+}
+
+//! Dépôt d'un enregistrement
+/*!
+ * \param rec l'enregistrement
+ * \param force vrai s'il ne doit pas être perdu, quelle que soit la politique
+ */
+static void push(const Record *rec, bool force)
+{
+	uint64_t next = head;
+
+	if (next - cached_tail > mask) {
+		cached_tail = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+		while (next - cached_tail > mask) {
+			if (policy == ASYNC_DROP && !force) {
+				++dropped;
+				return;
+			}
+			sched_yield();
+			cached_tail = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+		}
+	}
+	ring[next & mask] = *rec;
+	__atomic_store_n(&head, next + 1, __ATOMIC_RELEASE);
+}
+
+//! Arrêt de l'écriture asynchrone à la sortie du programme
+static void stop_at_exit(void)
+{
+	uint64_t lost = async_stop();
+
+	if (lost > 0)
+		fprintf(stderr, "%llu trace records dropped\n", (unsigned long long) lost);
+}
+
+//! Démarrage de l'écriture asynchrone
+bool async_start(Async_Policy pol, unsigned capacity)
+{
+	static bool registered = false;
+	uint64_t size = 1;
+
+	if (active)
+		return true;
+	while (size < capacity)
+		size <<= 1;
+	if (posix_memalign((void **) &ring, CACHE_LINE, size * sizeof(Record)) != 0)
+		return false;
+
+	mask = size - 1;
+	policy = pol;
+	head = tail = cached_tail = dropped = 0;
+	stopping = false;
+	fflush(stdout);
+	if (pthread_create(&writer_thread, NULL, writer, NULL) != 0) {
+		free(ring);
+		ring = NULL;
+		return false;
+	}
+	active = true;
+
+	if (!registered) {
+		atexit(stop_at_exit);
+		registered = true;
+	}
+	return true;
+}
+
+//! Arrêt de l'écriture asynchrone
+uint64_t async_stop(void)
+{
+	if (!active)
+		return 0;
+	__atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+	pthread_join(writer_thread, NULL);
+	active = false;
+	free(ring);
+	ring = NULL;
+	return dropped;
+}
+
+//! Écriture asynchrone active ?
+bool async_active(void)
+{
+	return active;
+}
+
+//! Dépôt d'une ligne de trace
+void async_trace(const char *msg, Instruction instr, unsigned addr)
+{
+	Record rec = {msg, addr, instr._raw, RECORD_TRACE};
+	push(&rec, false);
+}
+
+//! Dépôt d'un avertissement
+void async_warning(Warning warn, unsigned addr)
+{
+	Record rec = {NULL, addr, warn, RECORD_WARNING};
+	push(&rec, true);
+}
+
+//! Dépôt d'une erreur
+void async_error(Error err, unsigned addr)
+{
+	Record rec = {NULL, addr, err, RECORD_ERROR};
+	push(&rec, true);
+}
@@ -0,0 +1,84 @@
+#ifndef _ASYNC_H_
+#define _ASYNC_H_
+
+/*!
+ * \file async.h
+ * \brief Écriture asynchrone des traces et des messages du simulateur
+ *
+ * Pendant l'écriture asynchrone, trace(), warning() et error() ne font plus
+ * d'entrée-sortie : ils déposent un enregistrement de taille fixe dans un
+ * tampon circulaire à un producteur et un consommateur, sans verrou. Un
+ * processus léger d'écriture met en forme les enregistrements et les écrit
+ * sur la sortie standard, dans l'ordre de leur dépôt.
+ *
+ * Le simulateur (le producteur) est le seul processus léger qui appelle ces
+ * fonctions tant que l'écriture asynchrone est active.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "instruction.h"
+#include "error.h"
+
+//! Comportement quand le tampon est plein
+typedef enum
+{
+    ASYNC_BLOCK,	//!< Le simulateur attend que l'écrivain libère de la place
+    ASYNC_DROP,		//!< L'enregistrement est perdu (et compté)
+} Async_Policy;
+
+//! Nombre d'enregistrements du tampon par défaut
+#define ASYNC_CAPACITY (1 << 16)
+
+//! Démarrage de l'écriture asynchrone
+/*!
+ * Si le programme se termine pendant l'écriture asynchrone (par error()),
+ * les enregistrements en attente sont écrits avant la sortie.
+ *
+ * \param policy le comportement quand le tampon est plein
+ * \param capacity le nombre d'enregistrements du tampon (arrondi à une
+ * puissance de 2)
+ * \return faux si le processus léger ne peut être créé ; l'écriture reste
+ * alors synchrone
+ */
+bool async_start(Async_Policy policy, unsigned capacity);
+
+//! Arrêt de l'écriture asynchrone
+/*!
+ * Attend l'écriture de tous les enregistrements déposés.
+ *
+ * \return le nombre d'enregistrements perdus (politique \c ASYNC_DROP)
+ */
+uint64_t async_stop(void);
+
+//! Écriture asynchrone active ?
+bool async_active(void);
+
+//! Dépôt d'une ligne de trace (voir trace())
+/*!
+ * \param msg le message de trace (chaîne constante)
+ * \param instr l'instruction
+ * \param addr son adresse
+ */
+void async_trace(const char *msg, Instruction instr, unsigned addr);
+
+//! Dépôt d'un avertissement (voir warning())
+/*!
+ * L'avertissement est toujours déposé, même avec la politique \c ASYNC_DROP.
+ *
+ * \param warn code de l'avertissement
+ * \param addr adresse de l'avertissement
+ */
+void async_warning(Warning warn, unsigned addr);
+
+//! Dépôt d'une erreur (voir error())
+/*!
+ * L'erreur est toujours déposée, même avec la politique \c ASYNC_DROP.
+ *
+ * \param err code de l'erreur
+ * \param addr adresse de l'erreur
+ */
+void async_error(Error err, unsigned addr);
+
+#endif
@@ -0,0 +1,550 @@
+/*!
+ * \file batch.c
+ * \brief Exécution d'un lot de programmes binaires en parallèle
+ *
+ * Les programmes du lot sont répartis en blocs contigus, un par processus
+ * léger. Chaque bloc est un intervalle [début, fin) d'indices codé dans un
+ * seul mot de 64 bits : son propriétaire prend les programmes par le début,
+ * un processus léger inoccupé en vole par la fin, chacun par une
+ * comparaison-échange, sans verrou. Aucun programme n'étant ajouté en cours
+ * de route, un processus léger s'arrête dès que tous les blocs sont vides.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "machine.h"
+#include "clone.h"
+#include "sample.h"
+#include "metrics.h"
+#include "error.h"
+
+//! Taille d'une ligne de cache
+#define CACHE_LINE 64
+
+//! Nombre d'adresses des histogrammes d'échantillonnage d'un programme
+#define SAMPLE_TOP 10
+
+//! Modification d'un mot de données d'un clone (balayage)
+typedef struct
+{
+	unsigned _adress;	//!< Adresse dans le segment de données
+	Word _value;		//!< Valeur initiale
+} Patch;
+
+//! Un programme du lot
+typedef struct
+{
+	char *_path;		//!< Nom du fichier binaire
+	int _status;		//!< Code de sortie (celui de test_simul)
+	uint64_t _icount;	//!< Nombre d'instructions exécutées
+	char *_report;		//!< Messages et état final du processeur
+	size_t _len;		//!< Longueur du compte rendu
+	bool _loaded;		//!< Programme déjà lu (lot lu dans un flot)
+	Load_Status _load;	//!< Résultat de la lecture du programme
+	Machine _mach;		//!< Machine du programme
+	Metrics _metrics;	//!< Compteurs de l'exécution (aucun programme compté s'il n'a pu être lu)
+	const Machine *_template;	//!< Machine modèle (balayage), ou NULL
+	const Clone_Source *_source;	//!< Image du modèle (balayage)
+	Patch *_patches;	//!< Mots de données modifiés dans le clone
+	unsigned _npatches;	//!< Nombre de mots modifiés
+} Job;
+
+//! Bloc de programmes d'un processus léger, seul sur sa ligne de cache
+typedef struct
+{
+	uint64_t _range;	//!< Début (32 bits de poids fort) et fin de l'intervalle
+} __attribute__((aligned(CACHE_LINE))) Deque;
+
+//! Début d'un intervalle
+#define FRONT(range) ((uint32_t) ((range) >> 32))
+
+//! Fin d'un intervalle
+#define BACK(range) ((uint32_t) (range))
+
+//! Construction d'un intervalle
+#define RANGE(front, back) ((uint64_t) (front) << 32 | (uint32_t) (back))
+
+//! Ensemble de processus légers
+typedef struct
+{
+	Job *_jobs;		//!< Programmes du lot
+	Deque *_deques;		//!< Un bloc par processus léger
+	unsigned _nworkers;	//!< Nombre de processus légers
+	unsigned _sample_hz;	//!< Fréquence d'échantillonnage (sample.h), ou 0
+} Pool;
+
+//! Paramètre d'un processus léger
+typedef struct
+{
+	Pool *_pool;
+	unsigned _id;		//!< Indice de son bloc
+} Worker;
+
+//! Prise d'un programme au début de son propre bloc
+/*!
+ * \param deque le bloc
+ * \param job l'indice du programme pris
+ * \return faux si le bloc est vide
+ */
+static bool take(Deque *deque, unsigned *job)
+{
+	uint64_t range = __atomic_load_n(&deque->_range, __ATOMIC_ACQUIRE);
+
+	while (FRONT(range) < BACK(range)) {
+		if (__atomic_compare_exchange_n(&deque->_range, &range,
+						RANGE(FRONT(range) + 1, BACK(range)), false,
+						__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			*job = FRONT(range);
+			return true;
+		}
+	}
+	return false;
+}
+
+//! Vol d'un programme à la fin du bloc d'un autre processus léger
+/*!
+ * \param deque le bloc
+ * \param job l'indice du programme volé
+ * \return faux si le bloc est vide
+ */
+static bool steal(Deque *deque, unsigned *job)
+{
+	uint64_t range = __atomic_load_n(&deque->_range, __ATOMIC_ACQUIRE);
+
+	while (FRONT(range) < BACK(range)) {
+		if (__atomic_compare_exchange_n(&deque->_range, &range,
+						RANGE(FRONT(range), BACK(range) - 1), false,
+						__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			*job = BACK(range) - 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+//! Affichage des données statiques d'un clone qui diffèrent du modèle
+static void print_changes(const Machine *mach, const Machine *template)
+{
+	fprintf(sim_output(), "\n*** DATA CHANGES ***\n");
+	for (unsigned i = 0; i < mach->_dataend; ++i)
+		if (mach->_data[i] != template->_data[i])
+			fprintf(sim_output(), "0x%.4x: 0x%.8x %d\n", i, mach->_data[i], mach->_data[i]);
+}
+
+//! Exécution d'un programme du lot
+/*!
+ * Les messages et l'état final du processeur sont écrits dans le compte
+ * rendu du programme (voir set_sim_output()). Le clone d'un balayage
+ * reçoit ses modifications avant l'exécution ; son compte rendu donne aussi
+ * les données statiques qui diffèrent du modèle. Avec l'échantillonnage,
+ * il se termine par les histogrammes de print_samples().
+ *
+ * \param job le programme
+ * \param hz la fréquence d'échantillonnage, ou 0
+ */
+static void run_job(Job *job, unsigned hz)
+{
+	Machine *mach = &job->_mach;
+	FILE *out = open_memstream(&job->_report, &job->_len);
+
+	if (out == NULL) {
+		job->_status = 1;
+		return;
+	}
+	set_sim_output(out);
+
+	if (job->_source != NULL) {
+		job->_load = clone_machine(job->_source, mach) ? LOAD_OK : LOAD_MEMORY;
+		for (unsigned i = 0; job->_load == LOAD_OK && i < job->_npatches; ++i)
+			mach->_data[job->_patches[i]._adress] = job->_patches[i]._value;
+	} else if (!job->_loaded)
+		job->_load = try_read_program(mach, job->_path);
+
+	if (job->_load != LOAD_OK) {
+		fprintf(out, "%s\n", load_message(job->_load));
+		job->_status = 1;
+	} else {
+		Sampler *sampler = hz > 0 ? sampler_create(mach, hz) : NULL;
+		if (sampler != NULL && !sampler_start(sampler)) {
+			sampler_free(sampler);
+			sampler = NULL;
+		}
+
+		struct timespec start, stop;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		Run_Status run = simul_run(mach, TRACE_OFF);
+
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+		if (sampler != NULL)
+			sampler_stop(sampler);
+		metrics_finish(mach, (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) * 1e-9);
+		job->_metrics = *mach->_metrics;
+		job->_metrics._from = job->_metrics._to = NULL;	// libérés avec la machine
+
+		job->_status = 0;
+		if (run._state == RUN_ERROR) {
+			print_error(run._err, run._pc);
+			job->_status = run._err == ERR_NOERROR ? 0 : 1;
+		}
+		job->_icount = mach->_icount;
+		print_cpu(mach);
+		if (sampler != NULL) {
+			print_samples(mach, sampler, SAMPLE_TOP);
+			sampler_free(sampler);
+		}
+		if (job->_source != NULL) {
+			print_changes(mach, job->_template);
+			free_clone(mach);
+		} else
+			free_program(mach);
+	}
+
+	set_sim_output(NULL);
+	fclose(out);
+}
+
+//! Processus léger : son bloc d'abord, puis les blocs des autres
+static void *work(void *arg)
+{
+	Worker *worker = arg;
+	Pool *pool = worker->_pool;
+	unsigned job;
+
+	for (;;) {
+		bool found = take(&pool->_deques[worker->_id], &job);
+
+		for (unsigned i = 1; !found && i < pool->_nworkers; ++i)
+			found = steal(&pool->_deques[(worker->_id + i) % pool->_nworkers], &job);
+		if (!found)
+			return NULL;
+		run_job(&pool->_jobs[job], pool->_sample_hz);
+	}
+}
+
+//! Ajout d'un programme au lot
+/*!
+ * \return faux si la mémoire manque
+ */
+static bool add_job(Job **jobs, unsigned *njobs, unsigned *capacity, char *path)
+{
+	if (path == NULL)
+		return false;
+	if (*njobs == *capacity) {
+		unsigned size = *capacity ? 2 * *capacity : 64;
+		Job *grown = realloc(*jobs, size * sizeof(Job));
+		if (grown == NULL) {
+			free(path);
+			return false;
+		}
+		*jobs = grown;
+		*capacity = size;
+	}
+	(*jobs)[(*njobs)++] = (Job) {._path = path};
+	return true;
+}
+
+//! Comparaison de deux programmes par nom de fichier
+static int compare_jobs(const void *a, const void *b)
+{
+	return strcmp(((const Job *) a)->_path, ((const Job *) b)->_path);
+}
+
+//! Lecture des fichiers \c .bin d'un répertoire
+/*!
+ * \return faux si le répertoire ne peut être lu
+ */
+static bool list_directory(const char *dirname, Job **jobs, unsigned *njobs)
+{
+	unsigned capacity = 0;
+	DIR *dir = opendir(dirname);
+	struct dirent *entry;
+	bool ok = true;
+
+	if (dir == NULL)
+		return false;
+	while (ok && (entry = readdir(dir)) != NULL) {
+		size_t len = strlen(entry->d_name);
+		if (len <= 4 || strcmp(entry->d_name + len - 4, ".bin") != 0)
+			continue;
+
+		char *path = malloc(strlen(dirname) + len + 2);
+		if (path != NULL)
+			sprintf(path, "%s/%s", dirname, entry->d_name);
+		ok = add_job(jobs, njobs, &capacity, path);
+	}
+	closedir(dir);
+	if (*njobs > 0)
+		qsort(*jobs, *njobs, sizeof(Job), compare_jobs);
+	return ok;
+}
+
+//! Lecture d'un manifeste
+/*!
+ * \return faux si le manifeste ne peut être lu
+ */
+static bool read_manifest(const char *manifest, Job **jobs, unsigned *njobs)
+{
+	unsigned capacity = 0;
+	FILE *fp = fopen(manifest, "r");
+	char *line = NULL;
+	size_t size = 0;
+	bool ok = true;
+
+	if (fp == NULL)
+		return false;
+	while (ok && getline(&line, &size, fp) != -1) {
+		size_t len = strcspn(line, "\r\n");
+		line[len] = '\0';
+		if (len == 0 || line[0] == '#')
+			continue;
+		ok = add_job(jobs, njobs, &capacity, strdup(line));
+	}
+	free(line);
+	fclose(fp);
+	return ok;
+}
+
+//! Lecture de tous les programmes d'un flot
+/*!
+ * Les programmes sont lus un par un (stream_program()) avant l'exécution ;
+ * le programme de rang \e n est nommé \e source#n. La lecture s'arrête à
+ * la fin du flot ou au premier programme invalide, qui devient le dernier
+ * programme du lot (et y est signalé).
+ *
+ * \return faux si la mémoire manque
+ */
+static bool read_stream(const char *source, int fd, Job **jobs, unsigned *njobs)
+{
+	unsigned capacity = 0;
+
+	for (;;) {
+		Machine mach;
+		Load_Status status = stream_program(&mach, fd);
+
+		if (status == LOAD_END)
+			return true;
+
+		char *path = malloc(strlen(source) + 12);
+		if (path != NULL)
+			sprintf(path, "%s#%u", source, *njobs + 1);
+		if (!add_job(jobs, njobs, &capacity, path)) {
+			if (status == LOAD_OK)
+				free_program(&mach);
+			return false;
+		}
+
+		Job *job = &(*jobs)[*njobs - 1];
+		job->_loaded = true;
+		job->_load = status;
+		job->_mach = mach;
+		if (status != LOAD_OK)
+			return true;
+	}
+}
+
+//! Lecture d'un fichier de balayage
+/*!
+ * Chaque ligne (hors lignes vides et commentaires \c #) donne un clone du
+ * modèle, nommé \e fichier:ligne, et ses modifications.
+ *
+ * \return faux si le fichier ne peut être lu, si une ligne est invalide ou
+ * si la mémoire manque
+ */
+static bool read_sweep(const char *sweep, const Machine *template, const Clone_Source *src,
+		       Job **jobs, unsigned *njobs)
+{
+	unsigned capacity = 0;
+	FILE *fp = fopen(sweep, "r");
+	char *line = NULL;
+	size_t size = 0;
+	unsigned lineno = 0;
+	bool ok = true;
+
+	if (fp == NULL)
+		return false;
+	while (ok && getline(&line, &size, fp) != -1) {
+		++lineno;
+		line[strcspn(line, "#\r\n")] = '\0';
+		if (line[strspn(line, " \t")] == '\0')
+			continue;
+
+		char *path = malloc(strlen(sweep) + 12);
+		if (path != NULL)
+			sprintf(path, "%s:%u", sweep, lineno);
+		if (!(ok = add_job(jobs, njobs, &capacity, path)))
+			break;
+
+		Job *job = &(*jobs)[*njobs - 1];
+		job->_template = template;
+		job->_source = src;
+		for (char *tok = strtok(line, " \t"); ok && tok != NULL; tok = strtok(NULL, " \t")) {
+			char *end;
+			unsigned long adress = strtoul(tok, &end, 0);
+			Word value = 0;
+
+			ok = end != tok && *end == '=' && adress < template->_datasize;
+			if (ok) {
+				char *digits = end + 1;
+				value = strtol(digits, &end, 0);
+				ok = end != digits && *end == '\0';
+			}
+			if (!ok) {
+				fprintf(stderr, "%s:%u: modification invalide : %s\n", sweep, lineno, tok);
+				break;
+			}
+
+			Patch *grown = realloc(job->_patches, (job->_npatches + 1) * sizeof(Patch));
+			if (!(ok = grown != NULL))
+				break;
+			job->_patches = grown;
+			job->_patches[job->_npatches++] = (Patch) {adress, value};
+		}
+	}
+	free(line);
+	fclose(fp);
+	return ok;
+}
+
+//! Exécution des programmes d'un lot et compte rendu
+/*!
+ * Les programmes et le lot sont libérés au retour.
+ *
+ * \return 0 si tous les programmes se sont terminés avec le code 0 ; 1 sinon
+ */
+static int run_jobs(Job *jobs, unsigned njobs, unsigned nthreads, unsigned hz, FILE *metrics, FILE *out)
+{
+	if (nthreads == 0) {
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = cores > 0 ? cores : 1;
+	}
+	if (nthreads > njobs)
+		nthreads = njobs > 0 ? njobs : 1;
+
+	Pool pool = {jobs, NULL, nthreads, hz};
+	Worker *workers = malloc(nthreads * sizeof(Worker));
+	pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+	if (workers == NULL || threads == NULL
+	    || posix_memalign((void **) &pool._deques, CACHE_LINE, nthreads * sizeof(Deque)) != 0) {
+		fprintf(stderr, "Mémoire insuffisante.\n");
+		return 1;
+	}
+	for (unsigned i = 0; i < nthreads; ++i) {
+		pool._deques[i]._range = RANGE((uint64_t) njobs * i / nthreads,
+					       (uint64_t) njobs * (i + 1) / nthreads);
+		workers[i] = (Worker) {&pool, i};
+	}
+
+	struct timespec start, stop;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	// Le processus léger appelant est le premier de l'ensemble ; si un
+	// processus léger ne peut être créé, son bloc sera volé par les autres
+	unsigned started = 1;
+	for (unsigned i = 1; i < nthreads; ++i)
+		if (pthread_create(&threads[i], NULL, work, &workers[i]) == 0)
+			threads[started++] = threads[i];
+	work(&workers[0]);
+	for (unsigned i = 1; i < started; ++i)
+		pthread_join(threads[i], NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	unsigned failed = 0;
+	uint64_t icount = 0;
+	Metrics total = {0};
+	for (unsigned i = 0; i < njobs; ++i) {
+		if (metrics != NULL && jobs[i]._metrics._programs > 0) {
+			metrics_json(metrics, jobs[i]._path, &jobs[i]._metrics);
+			metrics_add(&total, &jobs[i]._metrics);
+		}
+		fprintf(out, "\n=== %s: exit %d, %llu instructions ===\n", jobs[i]._path,
+			jobs[i]._status, (unsigned long long) jobs[i]._icount);
+		if (jobs[i]._report != NULL)
+			fwrite(jobs[i]._report, 1, jobs[i]._len, out);
+		failed += jobs[i]._status != 0;
+		icount += jobs[i]._icount;
+		free(jobs[i]._report);
+		free(jobs[i]._path);
+		free(jobs[i]._patches);
+	}
+
+	double seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) * 1e-9;
+	fprintf(out, "\n*** %u programs, %u failed, %llu instructions in %.6f s on %u threads ***\n",
+		njobs, failed, (unsigned long long) icount, seconds, started);
+	if (metrics != NULL)
+		metrics_json(metrics, NULL, &total);
+
+	free(jobs);
+	free(pool._deques);
+	free(workers);
+	free(threads);
+	return failed > 0;
+}
+
+//! Exécution d'un lot de programmes
+int run_batch(const char *source, unsigned nthreads, unsigned hz, FILE *metrics, FILE *out)
+{
+	struct stat st;
+	Job *jobs = NULL;
+	unsigned njobs = 0;
+	bool ok;
+
+	if (strcmp(source, "-") == 0) {
+		ok = read_stream(source, STDIN_FILENO, &jobs, &njobs);
+	} else if (stat(source, &st) == 0 && S_ISDIR(st.st_mode)) {
+		ok = list_directory(source, &jobs, &njobs);
+	} else if (stat(source, &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISCHR(st.st_mode))) {
+		int fd = open(source, O_RDONLY);
+		ok = fd >= 0 && read_stream(source, fd, &jobs, &njobs);
+		if (fd >= 0)
+			close(fd);
+	} else {
+		ok = read_manifest(source, &jobs, &njobs);
+	}
+	if (!ok) {
+		fprintf(stderr, "Lecture du lot impossible : %s\n", source);
+		return 1;
+	}
+	return run_jobs(jobs, njobs, nthreads, hz, metrics, out);
+}
+
+//! Exécution d'un balayage de paramètres
+int run_sweep(const Machine *pmach, const char *sweep, unsigned nthreads, unsigned hz,
+	      FILE *metrics, FILE *out)
+{
+	Clone_Source *src = clone_source_create(pmach);
+	Job *jobs = NULL;
+	unsigned njobs = 0;
+
+	if (src == NULL) {
+		fprintf(stderr, "Image du programme impossible.\n");
+		return 1;
+	}
+	if (!read_sweep(sweep, pmach, src, &jobs, &njobs)) {
+		fprintf(stderr, "Lecture du balayage impossible : %s\n", sweep);
+		for (unsigned i = 0; i < njobs; ++i) {
+			free(jobs[i]._path);
+			free(jobs[i]._patches);
+		}
+		free(jobs);
+		clone_source_free(src);
+		return 1;
+	}
+
+	int status = run_jobs(jobs, njobs, nthreads, hz, metrics, out);
+	clone_source_free(src);
+	return status;
+}
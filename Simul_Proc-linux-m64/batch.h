@@ -0,0 +1,72 @@
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+/*!
+ * \file batch.h
+ * \brief Exécution d'un lot de programmes binaires en parallèle
+ */
+
+#include <stdio.h>
+
+#include "machine.h"
+
+//! Exécution d'un lot de programmes
+/*!
+ * Le lot est soit un répertoire (tous ses fichiers \c .bin, par ordre
+ * alphabétique), soit un manifeste : un nom de fichier binaire par ligne,
+ * les lignes vides et celles qui commencent par \c # étant ignorées ; soit
+ * enfin un flot de programmes concaténés (voir stream_program()) : l'entrée
+ * standard (\c -), un tube nommé ou un périphérique caractère, lu en entier
+ * avant l'exécution.
+ *
+ * Chaque programme est lu et exécuté sur sa propre machine, sans trace, par
+ * un ensemble de processus léger (un par cœur de l'hôte) qui se répartissent
+ * les programmes par vol de travail. Une erreur du programme simulé termine
+ * seulement ce programme (voir simul_run()).
+ *
+ * Le compte rendu est écrit à la fin, dans l'ordre du lot : pour chaque
+ * programme, son code de sortie (celui de test_simul), le nombre
+ * d'instructions exécutées, le message d'arrêt ou d'erreur et l'état final
+ * du processeur (print_cpu()) ; puis un bilan du lot.
+ *
+ * Avec \p hz non nul, l'exécution de chaque programme est échantillonnée
+ * (voir sample.h) et son compte rendu se termine par les histogrammes.
+ *
+ * Avec \p metrics, les compteurs d'exécution de chaque programme lu sont
+ * écrits en JSON dans ce flot, un objet par ligne dans l'ordre du lot, puis
+ * leur cumul pour tout le lot (voir metrics_json()).
+ *
+ * \param source le répertoire ou le manifeste
+ * \param nthreads le nombre de processus légers, ou 0 pour un par cœur
+ * \param hz la fréquence d'échantillonnage, ou 0 sans échantillonnage
+ * \param metrics le flot des compteurs en JSON, ou NULL
+ * \param out le flot du compte rendu
+ * \return 0 si tous les programmes se sont terminés avec le code 0 ; 1 sinon
+ */
+int run_batch(const char *source, unsigned nthreads, unsigned hz, FILE *metrics, FILE *out);
+
+//! Exécution d'un balayage de paramètres
+/*!
+ * Le programme chargé dans \p pmach est exécuté une fois par ligne du
+ * fichier de balayage, chaque fois sur un clone (voir clone.h) dont
+ * quelques mots de données sont modifiés avant l'exécution. Une ligne est
+ * une suite de modifications \e adresse=\e valeur séparées par des blancs
+ * (entiers en notation C : \c 0x2a, \c -1...) ; les lignes vides et ce
+ * qui suit un \c # sont ignorés.
+ *
+ * Les clones sont exécutés comme les programmes de run_batch(), dont le
+ * compte rendu est repris ; celui de chaque clone se termine par les mots
+ * de données statiques qui diffèrent du modèle à la fin de l'exécution.
+ *
+ * \param pmach la machine modèle, chargée et non exécutée
+ * \param sweep le fichier de balayage
+ * \param nthreads le nombre de processus légers, ou 0 pour un par cœur
+ * \param hz la fréquence d'échantillonnage, ou 0 sans échantillonnage
+ * \param metrics le flot des compteurs en JSON, ou NULL
+ * \param out le flot du compte rendu
+ * \return 0 si tous les clones se sont terminés avec le code 0 ; 1 sinon
+ */
+int run_sweep(const Machine *pmach, const char *sweep, unsigned nthreads, unsigned hz,
+              FILE *metrics, FILE *out);
+
+#endif
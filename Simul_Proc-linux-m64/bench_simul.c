@@ -0,0 +1,616 @@
+/*!
+ * \file bench_simul.c
+ * \brief Mesure du débit du simulateur sur des programmes synthétiques
+ *
+ * Les exemples et les tests s'arrêtent après quelques dizaines
+ * d'instructions : on ne peut pas y mesurer la vitesse du simulateur. Les
+ * programmes de mesure sont des boucles dont le nombre d'itérations est lu
+ * dans le mot 0 de leur segment de données ; chacun est exécuté plusieurs
+ * fois par chaque moteur d'exécution, et l'on affiche le débit moyen, le
+ * temps par instruction et sa dispersion d'une exécution à l'autre.
+ *
+ * Le coût de chaque variante est mesuré par des noyaux : une boucle dont
+ * le corps répète KERNEL_UNROLL fois la variante. On en retire le coût de
+ * la même boucle à corps vide, pour ne garder que celui de la variante
+ * (aiguillage compris).
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "machine.h"
+#include "exec.h"
+#include "jit.h"
+#include "error.h"
+#include "paging.h"
+
+//! Nombre d'exécutions mesurées par défaut
+#define DEFAULT_RUNS 5
+
+//! Adresse du tableau des programmes qui en parcourent un
+#define ARRAY_BASE 16
+
+//! Taille du tableau parcouru par le programme \c array (1 Mio)
+#define ARRAY_WORDS (1 << 18)
+
+//! Taille du tableau parcouru par le programme \c branch
+#define BRANCH_WORDS (1 << 16)
+
+//! Profondeur de récursion du programme \c call
+#define CALL_DEPTH 256
+
+//! Nombre de répétitions du corps d'un noyau
+#define KERNEL_UNROLL 16
+
+//! Nombre maximal d'instructions d'un corps de noyau
+#define KERNEL_BODY 2
+
+//! Taille du segment de texte d'un noyau
+#define KERNEL_TEXT (3 + KERNEL_UNROLL * KERNEL_BODY + 3)
+
+//! Taille du segment de données d'un noyau (la pile au-dessus de \c KERNEL_DATAEND)
+#define KERNEL_DATA 64
+
+//! Fin des données statiques d'un noyau
+#define KERNEL_DATAEND 8
+
+//! Boucle arithmétique : registres et adressage immédiat ou absolu
+static Instruction arith_text[] = {
+//   type		 cop	imm	ind	regcond	operand
+//-------------------------------------------------------------
+    {.instr_absolute =  {LOAD, 	 false, false, 	1, 	0	}},  // 0: itérations
+    {.instr_immediate = {ADD, 	 true, 	false, 	2, 	3	}},  // 1
+    {.instr_absolute =  {ADD, 	 false, false, 	3, 	1	}},  // 2
+    {.instr_immediate = {SUB, 	 true, 	false, 	4, 	1	}},  // 3
+    {.instr_absolute =  {SUB, 	 false, false, 	5, 	2	}},  // 4
+    {.instr_immediate = {SUB, 	 true, 	false, 	1, 	1	}},  // 5
+    {.instr_absolute =  {BRANCH, false, false, 	GT, 	1	}},  // 6
+    {.instr_generic =   {HALT,					}},  // 7
+};
+
+//! Récursion profonde : CALL conditionnel et RET
+static Instruction call_text[] = {
+//   type		 cop	imm	ind	regcond	operand
+//-------------------------------------------------------------
+    {.instr_absolute =  {LOAD, 	 false, false, 	2, 	0	}},  // 0: itérations
+    {.instr_absolute =  {LOAD, 	 false, false, 	1, 	1	}},  // 1: profondeur
+    {.instr_absolute =  {CALL, 	 false, false, 	NC, 	6	}},  // 2
+    {.instr_immediate = {SUB, 	 true, 	false, 	2, 	1	}},  // 3
+    {.instr_absolute =  {BRANCH, false, false, 	GT, 	1	}},  // 4
+    {.instr_generic =   {HALT,					}},  // 5
+    {.instr_immediate = {SUB, 	 true, 	false, 	1, 	1	}},  // 6: sous-programme
+    {.instr_absolute =  {CALL, 	 false, false, 	GT, 	6	}},  // 7
+    {.instr_generic =   {RET,					}},  // 8
+};
+
+//! Pile : PUSH et POP dans tous les modes d'adressage
+static Instruction stack_text[] = {
+//   type		 cop	imm	ind	regcond	rindex	offset
+//-------------------------------------------------------------
+    {.instr_absolute =  {LOAD, 	 false, false, 	1, 	0	}},  // 0: itérations
+    {.instr_immediate = {PUSH, 	 true, 	false, 	0, 	7	}},  // 1
+    {.instr_absolute =  {PUSH, 	 false, false, 	0, 	1	}},  // 2
+    {.instr_indexed =   {PUSH, 	 false, true, 	0, 	0, 	2}},  // 3
+    {.instr_absolute =  {POP, 	 false, false, 	0, 	3	}},  // 4
+    {.instr_indexed =   {POP, 	 false, true, 	0, 	0, 	4}},  // 5
+    {.instr_absolute =  {POP, 	 false, false, 	0, 	5	}},  // 6
+    {.instr_immediate = {SUB, 	 true, 	false, 	1, 	1	}},  // 7
+    {.instr_absolute =  {BRANCH, false, false, 	GT, 	1	}},  // 8
+    {.instr_generic =   {HALT,					}},  // 9
+};
+
+//! Sommes préfixes sur un grand tableau : adressage indexé
+static Instruction array_text[] = {
+//   type		 cop	imm	ind	regcond	rindex	offset
+//-------------------------------------------------------------
+    {.instr_absolute =  {LOAD, 	 false, false, 	5, 	0	}},  // 0: passes
+    {.instr_immediate = {LOAD, 	 true, 	false, 	2, 	0	}},  // 1: indice
+    {.instr_absolute =  {LOAD, 	 false, false, 	1, 	1	}},  // 2: taille
+    {.instr_immediate = {LOAD, 	 true, 	false, 	4, 	0	}},  // 3: somme
+    {.instr_indexed =   {ADD, 	 false, true, 	4, 	2, 	ARRAY_BASE}},  // 4
+    {.instr_indexed =   {STORE,  false, true, 	4, 	2, 	ARRAY_BASE}},  // 5
+    {.instr_immediate = {ADD, 	 true, 	false, 	2, 	1	}},  // 6
+    {.instr_immediate = {SUB, 	 true, 	false, 	1, 	1	}},  // 7
+    {.instr_absolute =  {BRANCH, false, false, 	GT, 	4	}},  // 8
+    {.instr_immediate = {SUB, 	 true, 	false, 	5, 	1	}},  // 9
+    {.instr_absolute =  {BRANCH, false, false, 	GT, 	1	}},  // 10
+    {.instr_generic =   {HALT,					}},  // 11
+};
+
+//! Branchements imprévisibles : valeurs pseudo-aléatoires nulles ou non
+static Instruction branch_text[] = {
+//   type		 cop	imm	ind	regcond	rindex	offset
+//-------------------------------------------------------------
+    {.instr_absolute =  {LOAD, 	 false, false, 	5, 	0	}},  // 0: passes
+    {.instr_immediate = {LOAD, 	 true, 	false, 	2, 	0	}},  // 1: indice
+    {.instr_absolute =  {LOAD, 	 false, false, 	1, 	1	}},  // 2: taille
+    {.instr_indexed =   {LOAD, 	 false, true, 	3, 	2, 	ARRAY_BASE}},  // 3
+    {.instr_absolute =  {BRANCH, false, false, 	EQ, 	7	}},  // 4
+    {.instr_immediate = {ADD, 	 true, 	false, 	4, 	1	}},  // 5
+    {.instr_absolute =  {BRANCH, false, false, 	NC, 	8	}},  // 6
+    {.instr_immediate = {SUB, 	 true, 	false, 	4, 	1	}},  // 7
+    {.instr_immediate = {ADD, 	 true, 	false, 	2, 	1	}},  // 8
+    {.instr_immediate = {SUB, 	 true, 	false, 	1, 	1	}},  // 9
+    {.instr_absolute =  {BRANCH, false, false, 	GT, 	3	}},  // 10
+    {.instr_immediate = {SUB, 	 true, 	false, 	5, 	1	}},  // 11
+    {.instr_absolute =  {BRANCH, false, false, 	GT, 	1	}},  // 12
+    {.instr_generic =   {HALT,					}},  // 13
+};
+
+//! Programme de mesure
+typedef struct
+{
+	const char *_name;		//!< Nom (option -w)
+	Instruction *_text;		//!< Segment de texte
+	unsigned _textsize;		//!< Taille du segment de texte
+	unsigned _datasize;		//!< Taille du segment de données
+	unsigned _dataend;		//!< Fin des données statiques
+	Word _iterations;		//!< Itérations par défaut (mot 0 des données)
+	Word _param;		//!< Paramètre du programme (mot 1 des données)
+	void (*_fill)(Word *data);	//!< Remplissage du tableau, ou NULL
+} Workload;
+
+//! Tableau du programme \c array : petites valeurs
+static void fill_array(Word *data)
+{
+	for (unsigned i = 0; i < ARRAY_WORDS; ++i)
+		data[ARRAY_BASE + i] = i & 0xff;
+}
+
+//! Tableau du programme \c branch : zéros et uns pseudo-aléatoires
+/*!
+ * Le code condition ne distingue que zéro des autres valeurs (set_cc()
+ * reçoit un mot non signé) : les branchements portent sur la nullité.
+ */
+static void fill_branch(Word *data)
+{
+	uint32_t x = 2463534242u;
+
+	for (unsigned i = 0; i < BRANCH_WORDS; ++i) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		data[ARRAY_BASE + i] = x >> 31;
+	}
+}
+
+//! Nombre d'éléments d'un tableau statique
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+//! Programmes de mesure (environ 50 millions d'instructions chacun)
+static const Workload workloads[] = {
+	{"arith", arith_text, COUNT(arith_text), 64, 8, 8333333, 1, NULL},
+	{"call", call_text, COUNT(call_text), CALL_DEPTH + 64, 8, 65536, CALL_DEPTH, NULL},
+	{"stack", stack_text, COUNT(stack_text), 64, 8, 6250000, 1, NULL},
+	{"array", array_text, COUNT(array_text), ARRAY_BASE + ARRAY_WORDS + 64, ARRAY_BASE + ARRAY_WORDS,
+	 40, ARRAY_WORDS, fill_array},
+	{"branch", branch_text, COUNT(branch_text), ARRAY_BASE + BRANCH_WORDS + 64, ARRAY_BASE + BRANCH_WORDS,
+	 100, BRANCH_WORDS, fill_branch},
+};
+
+//! Noyau de mesure du coût d'une variante
+/*!
+ * Le corps est répété KERNEL_UNROLL fois entre le prologue et la fin de
+ * boucle :
+ *
+ *     0: LOAD R1, @0          itérations
+ *     1: BRANCH NC, @3
+ *     2: RET                  cible des CALL du corps
+ *     3: corps...
+ *        SUB R1, #1
+ *        BRANCH GT, @3
+ *        HALT
+ */
+typedef struct
+{
+	const char *_name;		//!< Nom de la variante mesurée
+	unsigned _length;		//!< Nombre d'instructions du corps
+	Instruction _body[KERNEL_BODY];	//!< Corps de la boucle
+	bool _next;			//!< L'opérande de la première instruction est l'adresse de la suivante
+} Kernel;
+
+//! Noyaux, le premier à corps vide
+static const Kernel kernels[] = {
+	{"(empty loop)", 0, {{0}}, false},
+	{"nop", 1, {{.instr_generic = {NOP}}}, false},
+	{"load_imm", 1, {{.instr_immediate = {LOAD, true, false, 2, 5}}}, false},
+	{"load_abs", 1, {{.instr_absolute = {LOAD, false, false, 2, 1}}}, false},
+	{"load_idx", 1, {{.instr_indexed = {LOAD, false, true, 2, 0, 1}}}, false},
+	{"store_abs", 1, {{.instr_absolute = {STORE, false, false, 2, 2}}}, false},
+	{"store_idx", 1, {{.instr_indexed = {STORE, false, true, 2, 0, 2}}}, false},
+	{"add_imm", 1, {{.instr_immediate = {ADD, true, false, 2, 1}}}, false},
+	{"add_abs", 1, {{.instr_absolute = {ADD, false, false, 2, 1}}}, false},
+	{"add_idx", 1, {{.instr_indexed = {ADD, false, true, 2, 0, 1}}}, false},
+	{"sub_imm", 1, {{.instr_immediate = {SUB, true, false, 2, 1}}}, false},
+	{"sub_abs", 1, {{.instr_absolute = {SUB, false, false, 2, 1}}}, false},
+	{"sub_idx", 1, {{.instr_indexed = {SUB, false, true, 2, 0, 1}}}, false},
+	{"branch_abs (not taken)", 1, {{.instr_absolute = {BRANCH, false, false, EQ, 0}}}, false},
+	{"branch_abs (taken)", 1, {{.instr_absolute = {BRANCH, false, false, NC, 0}}}, true},
+	{"call_abs + ret", 1, {{.instr_absolute = {CALL, false, false, NC, 2}}}, false},
+	{"push_imm + pop_abs", 2, {{.instr_immediate = {PUSH, true, false, 0, 1}},
+							   {.instr_absolute = {POP, false, false, 0, 2}}}, false},
+	{"push_abs + pop_idx", 2, {{.instr_absolute = {PUSH, false, false, 0, 1}},
+							   {.instr_indexed = {POP, false, true, 0, 0, 2}}}, false},
+};
+
+//! Itérations d'un noyau
+#define KERNEL_ITERATIONS 1000000
+
+//! Construction du segment de texte d'un noyau
+/*!
+ * \param k le noyau
+ * \param text le segment, de taille KERNEL_TEXT au moins
+ * \return la taille du segment
+ */
+static unsigned build_kernel(const Kernel *k, Instruction *text)
+{
+	unsigned n = 0;
+
+	text[n++] = (Instruction) {.instr_absolute = {LOAD, false, false, 1, 0}};
+	text[n++] = (Instruction) {.instr_absolute = {BRANCH, false, false, NC, 3}};
+	text[n++] = (Instruction) {.instr_generic = {RET}};
+	for (unsigned i = 0; i < KERNEL_UNROLL; ++i) {
+		for (unsigned j = 0; j < k->_length; ++j)
+			text[n + j] = k->_body[j];
+		if (k->_next)
+			text[n].instr_absolute._address = n + 1;
+		n += k->_length;
+	}
+	text[n++] = (Instruction) {.instr_immediate = {SUB, true, false, 1, 1}};
+	text[n++] = (Instruction) {.instr_absolute = {BRANCH, false, false, GT, 3}};
+	text[n++] = (Instruction) {.instr_generic = {HALT}};
+	return n;
+}
+
+//! Moteur d'exécution
+typedef struct
+{
+	const char *_name;		//!< Nom (option -e)
+	void (*_run)(Machine *pmach);	//!< Exécution jusqu'à HALT
+} Engine;
+
+//! Exécution sans pré-décodage : decode_execute() à chaque instruction
+static void run_decode(Machine *pmach)
+{
+	do {
+		if (pmach->_pc >= pmach->_textsize)
+			error(ERR_SEGTEXT, pmach->_pc);
+		pmach->_icount += 1;
+	} while (decode_execute(pmach, pmach->_text[pmach->_pc++]));
+}
+
+//! Boucle de simulation sans trace
+static void run_step(Machine *pmach)
+{
+	simul_trace(pmach, false, TRACE_OFF);
+}
+
+//! Code threadé
+static void run_threaded(Machine *pmach)
+{
+	simul_threaded(pmach);
+}
+
+//! Moteurs d'exécution, dans l'ordre de l'affichage
+static const Engine engines[] = {
+	{"decode", run_decode},
+	{"step", run_step},
+	{"threaded", run_threaded},
+	{"jit", simul_jit},
+};
+
+//! Mesures d'un programme par un moteur
+typedef struct
+{
+	uint64_t _instructions;	//!< Instructions d'une exécution
+	double _mean;		//!< Durée moyenne d'une exécution (s)
+	double _stddev;		//!< Écart type de la durée (s)
+	double _min;		//!< Durée minimale (s)
+} Measure;
+
+//! Paramètres d'une exécution par catch_error()
+typedef struct
+{
+	const Engine *_engine;
+	Machine *_pmach;
+} Run_Args;
+
+//! Exécution par catch_error()
+static void run_engine(void *arg)
+{
+	Run_Args *args = arg;
+	args->_engine->_run(args->_pmach);
+}
+
+//! État final de référence d'un programme, pour comparer les moteurs
+typedef struct
+{
+	bool _set;			//!< État relevé ?
+	uint64_t _icount;		//!< Nombre d'instructions
+	Word _registers[NREGISTERS];	//!< Registres
+} Reference;
+
+//! Exécution chronométrée d'un programme
+/*!
+ * Le programme est chargé sur des copies de ses segments : chaque
+ * exécution part des mêmes données. Seule l'exécution est chronométrée. Le
+ * simulateur s'arrête sur une erreur d'exécution, ou si l'état final
+ * diffère de celui du premier moteur : un programme de mesure doit faire
+ * le même travail quel que soit le moteur.
+ *
+ * \param engine le moteur
+ * \param text le segment de texte
+ * \param textsize sa taille
+ * \param data le segment de données initial
+ * \param datasize sa taille
+ * \param dataend la fin des données statiques
+ * \param ref l'état de référence, relevé à la première exécution
+ * \param instructions le nombre d'instructions exécutées, au retour
+ * \return la durée de l'exécution (s)
+ */
+static double timed_run(const Engine *engine, const Instruction *text, unsigned textsize,
+						const Word *data, unsigned datasize, unsigned dataend,
+						Reference *ref, uint64_t *instructions)
+{
+	Instruction *t = malloc(textsize * sizeof(Instruction));
+	Word *d = data_alloc(datasize);
+	Machine mach;
+
+	if (t == NULL || d == NULL) {
+		fprintf(stderr, "Mémoire insuffisante.\n");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(t, text, textsize * sizeof(Instruction));
+	data_load(d, data, datasize);
+	if (!load_program(&mach, textsize, t, datasize, d, dataend)) {
+		fprintf(stderr, "Mémoire insuffisante.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	Run_Args args = {engine, &mach};
+	Error err;
+	unsigned addr;
+	struct timespec start, stop;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	bool ok = catch_error(run_engine, &args, &err, &addr);
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	if (!ok) {
+		fprintf(stderr, "%s: ", engine->_name);
+		print_error(err, addr);
+		exit(EXIT_FAILURE);
+	}
+	if (!ref->_set) {
+		ref->_set = true;
+		ref->_icount = mach._icount;
+		memcpy(ref->_registers, mach._registers, sizeof(ref->_registers));
+	} else if (ref->_icount != mach._icount
+			   || memcmp(ref->_registers, mach._registers, sizeof(ref->_registers)) != 0) {
+		fprintf(stderr, "%s: état final différent de celui du premier moteur\n", engine->_name);
+		exit(EXIT_FAILURE);
+	}
+
+	*instructions = mach._icount;
+	free_program(&mach);
+	return (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+//! Mesure d'un programme par un moteur
+/*!
+ * Une première exécution, non comptée, met les caches en place ; suivent
+ * \p runs exécutions mesurées.
+ */
+static Measure measure(const Engine *engine, const Instruction *text, unsigned textsize,
+					   const Word *data, unsigned datasize, unsigned dataend,
+					   Reference *ref, unsigned runs)
+{
+	Measure m = {0, 0.0, 0.0, INFINITY};
+	double sum = 0.0, sum2 = 0.0;
+
+	timed_run(engine, text, textsize, data, datasize, dataend, ref, &m._instructions);
+	for (unsigned i = 0; i < runs; ++i) {
+		double t = timed_run(engine, text, textsize, data, datasize, dataend, ref, &m._instructions);
+		sum += t;
+		sum2 += t * t;
+		if (t < m._min)
+			m._min = t;
+	}
+	m._mean = sum / runs;
+	if (runs > 1) {
+		double var = (sum2 - sum * sum / runs) / (runs - 1);
+		m._stddev = var > 0 ? sqrt(var) : 0.0;
+	}
+	return m;
+}
+
+//! Le nom figure-t-il dans une liste séparée par des virgules (NULL : tous) ?
+static bool selected(const char *list, const char *name)
+{
+	size_t n = strlen(name);
+
+	if (list == NULL)
+		return true;
+	for (const char *p = list; p != NULL; p = strchr(p, ',')) {
+		if (*p == ',')
+			++p;
+		if (strncmp(p, name, n) == 0 && (p[n] == ',' || p[n] == '\0'))
+			return true;
+	}
+	return false;
+}
+
+//! Mesure des programmes de mesure
+static void bench_workloads(const char *wanted, const bool *enabled, unsigned runs, double scale)
+{
+	bool header = false;
+
+	for (unsigned w = 0; w < COUNT(workloads); ++w) {
+		const Workload *wl = &workloads[w];
+		if (!selected(wanted, wl->_name))
+			continue;
+		if (!header) {
+			printf("*** Workloads (%u runs; time per instruction: mean, relative standard deviation, minimum) ***\n\n", runs);
+			printf("%-8s %-9s %14s %10s %10s %7s %10s\n",
+				   "workload", "engine", "instructions", "Minstr/s", "ns/instr", "+-", "min");
+			header = true;
+		}
+
+		Word *data = calloc(wl->_datasize, sizeof(Word));
+		if (data == NULL) {
+			fprintf(stderr, "Mémoire insuffisante.\n");
+			exit(EXIT_FAILURE);
+		}
+		data[0] = wl->_iterations * scale > 1 ? (Word) (wl->_iterations * scale) : 1;
+		data[1] = wl->_param;
+		if (wl->_fill != NULL)
+			wl->_fill(data);
+
+		Reference ref = {false};
+		for (unsigned e = 0; e < COUNT(engines); ++e) {
+			if (!enabled[e])
+				continue;
+			Measure m = measure(&engines[e], wl->_text, wl->_textsize,
+								data, wl->_datasize, wl->_dataend, &ref, runs);
+			double ns = m._mean * 1e9 / m._instructions;
+			printf("%-8s %-9s %14llu %10.1f %10.3f %6.1f%% %10.3f\n",
+				   wl->_name, engines[e]._name, (unsigned long long) m._instructions,
+				   m._instructions / m._mean * 1e-6, ns,
+				   m._mean > 0 ? 100.0 * m._stddev / m._mean : 0.0,
+				   m._min * 1e9 / m._instructions);
+		}
+		free(data);
+	}
+}
+
+//! Mesure du coût de chaque variante
+/*!
+ * Le coût d'une variante est la différence des durées moyennes de son
+ * noyau et du noyau à corps vide, divisée par la différence des nombres
+ * d'instructions exécutées ; sa dispersion combine celles des deux noyaux.
+ */
+static void bench_kernels(const bool *enabled, unsigned runs, double scale)
+{
+	Word data[KERNEL_DATA] = {0};
+	Instruction text[KERNEL_TEXT];
+
+	data[0] = KERNEL_ITERATIONS * scale > 1 ? (Word) (KERNEL_ITERATIONS * scale) : 1;
+	data[1] = 1;
+
+	for (unsigned e = 0; e < COUNT(engines); ++e) {
+		if (!enabled[e])
+			continue;
+		printf("\n*** Dispatch cost per variant: %s (%u runs, loop overhead removed) ***\n\n",
+			   engines[e]._name, runs);
+		printf("%-24s %10s %10s %14s\n", "variant", "ns/instr", "+-", "raw ns/instr");
+
+		Measure empty = {0};
+		for (unsigned k = 0; k < COUNT(kernels); ++k) {
+			unsigned textsize = build_kernel(&kernels[k], text);
+			Reference ref = {false};
+			Measure m = measure(&engines[e], text, textsize, data, KERNEL_DATA, KERNEL_DATAEND, &ref, runs);
+
+			if (k == 0) {
+				empty = m;
+				printf("%-24s %10s %10s %14.3f\n", kernels[k]._name, "", "",
+					   m._mean * 1e9 / m._instructions);
+				continue;
+			}
+			double n = (double) (m._instructions - empty._instructions);
+			printf("%-24s %10.3f %10.3f %14.3f\n", kernels[k]._name,
+				   (m._mean - empty._mean) * 1e9 / n,
+				   sqrt(m._stddev * m._stddev + empty._stddev * empty._stddev) * 1e9 / n,
+				   m._mean * 1e9 / m._instructions);
+		}
+	}
+}
+
+//! Message d'aide
+static void usage(void)
+{
+	printf("Usage: bench_simul [-n runs] [-e engines] [-w workloads] [-s scale]\n"
+		   "Run synthetic guest programs on each execution engine and print\n"
+		   "the instruction rate, the time per instruction and its spread\n"
+		   "over the runs, then the cost of each instruction variant.\n"
+		   "\t-n runs\t\tmeasured runs per program (default: %u), after one\n"
+		   "\t\t\twarm-up run\n"
+		   "\t-e engines\tcomma-separated list among decode, step, threaded\n"
+		   "\t\t\tand jit (default: all available)\n"
+		   "\t-w workloads\tcomma-separated list among arith, call, stack,\n"
+		   "\t\t\tarray, branch and opcodes (default: all)\n"
+		   "\t-s scale\tmultiply the iteration counts (default: 1)\n",
+		   DEFAULT_RUNS);
+}
+
+//! Banc de mesure du simulateur
+/*!
+ * Options de la ligne de commande :
+ *
+ * <dl>
+ *   <dt>-n</dt><dd>nombre d'exécutions mesurées de chaque programme, après
+ *   une exécution de mise en route.</dd>
+ *
+ *   <dt>-e</dt><dd>moteurs d'exécution, séparés par des virgules :
+ *   \c decode (decode_execute() à chaque instruction), \c step (boucle de
+ *   simulation sans trace), \c threaded (simul_threaded()) et \c jit
+ *   (simul_jit(), si disponible).</dd>
+ *
+ *   <dt>-w</dt><dd>programmes de mesure, séparés par des virgules :
+ *   \c arith, \c call, \c stack, \c array, \c branch, et \c opcodes pour
+ *   les noyaux de mesure du coût de chaque variante.</dd>
+ *
+ *   <dt>-s</dt><dd>facteur appliqué aux nombres d'itérations.</dd>
+ *
+ *   <dt>-h</dt><dd>affichage de l'aide</dd>
+ * </dl>
+ */
+int main(int argc, char *argv[])
+{
+	unsigned runs = DEFAULT_RUNS;
+	const char *wanted_engines = NULL;
+	const char *wanted = NULL;
+	double scale = 1.0;
+
+	for (int iarg = 1; iarg < argc; ++iarg) {
+		if (strcmp(argv[iarg], "-n") == 0 && iarg + 1 < argc) {
+			runs = strtoul(argv[++iarg], NULL, 0);
+		} else if (strcmp(argv[iarg], "-e") == 0 && iarg + 1 < argc) {
+			wanted_engines = argv[++iarg];
+		} else if (strcmp(argv[iarg], "-w") == 0 && iarg + 1 < argc) {
+			wanted = argv[++iarg];
+		} else if (strcmp(argv[iarg], "-s") == 0 && iarg + 1 < argc) {
+			scale = strtod(argv[++iarg], NULL);
+		} else if (strcmp(argv[iarg], "-h") == 0) {
+			usage();
+			exit(EXIT_SUCCESS);
+		} else {
+			fprintf(stderr, "Unknown option: %s\n", argv[iarg]);
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (runs == 0 || !(scale > 0)) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	// Les avertissements de HALT ne doivent pas se mêler au rapport
+	FILE *devnull = fopen("/dev/null", "w");
+	if (devnull != NULL)
+		set_sim_output(devnull);
+
+	bool enabled[COUNT(engines)];
+	for (unsigned e = 0; e < COUNT(engines); ++e)
+		enabled[e] = selected(wanted_engines, engines[e]._name)
+					 && (engines[e]._run != simul_jit || jit_available());
+
+	bench_workloads(wanted, enabled, runs, scale);
+	if (selected(wanted, "opcodes"))
+		bench_kernels(enabled, runs, scale);
+	if (devnull != NULL)
+		fclose(devnull);
+	return 0;
+}
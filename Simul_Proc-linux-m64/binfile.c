@@ -0,0 +1,430 @@
+/*!
+ * \file binfile.c
+ * \brief Format binaire versionné des programmes (version 2)
+ *
+ * Le CRC est le CRC-32 usuel (polynôme 0xEDB88320, celui de zlib), calculé
+ * par quartets avec une table de 16 entrées. La compression est un LZ77
+ * glouton : les positions des séquences de 4 octets sont retenues dans une
+ * table de hachage, et une copie n'est émise que si la séquence est retrouvée
+ * à moins de 64 Kio en arrière.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "binfile.h"
+#include "metrics.h"
+#include "verify.h"
+#include "paging.h"
+
+//! Longueur minimale d'une copie
+#define LZ_MIN_MATCH 4
+
+//! Distance maximale d'une copie
+#define LZ_MAX_OFFSET 65535
+
+//! Nombre de bits de la table de hachage du compresseur
+#define LZ_HASH_BITS 12
+
+//! Table du CRC-32 par quartets
+static const uint32_t crc_nibble[16] = {
+	0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+	0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+	0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+	0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+};
+
+//! CRC-32 d'une suite d'octets
+uint32_t bin_crc32(const void *data, size_t n)
+{
+	const unsigned char *p = data;
+	uint32_t crc = 0xffffffff;
+
+	while (n-- > 0) {
+		crc ^= *p++;
+		crc = (crc >> 4) ^ crc_nibble[crc & 0xf];
+		crc = (crc >> 4) ^ crc_nibble[crc & 0xf];
+	}
+	return ~crc;
+}
+
+//! Lecture d'un entier de 16 bits petit-boutiste
+static uint16_t get16(const unsigned char *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+//! Lecture d'un entier de 32 bits petit-boutiste
+static uint32_t get32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+//! Écriture d'un entier de 16 bits petit-boutiste
+static void put16(unsigned char *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+//! Écriture d'un entier de 32 bits petit-boutiste
+static void put32(unsigned char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+//! L'hôte est-il petit-boutiste ?
+static bool little_endian(void)
+{
+	const uint16_t one = 1;
+	return *(const unsigned char *) &one == 1;
+}
+
+//! Écriture d'une longueur étendue (au-delà de 15)
+static void lz_put_length(unsigned char *out, size_t *o, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		out[(*o)++] = 255;
+	out[(*o)++] = len;
+}
+
+//! Écriture d'une séquence : littéraux, puis copie (absente si \p match est nul)
+/*!
+ * \return faux si la séquence ne tient pas dans les \p cap octets de \p out
+ */
+static bool lz_sequence(unsigned char *out, size_t *o, size_t cap,
+			const unsigned char *lit, size_t nlit, size_t match, size_t offset)
+{
+	size_t need = 1 + nlit + (nlit >= 15 ? (nlit - 15) / 255 + 1 : 0);
+
+	if (match > 0)
+		need += 2 + (match - LZ_MIN_MATCH >= 15 ? (match - LZ_MIN_MATCH - 15) / 255 + 1 : 0);
+	if (*o + need > cap)
+		return false;
+
+	size_t mfield = match > 0 ? match - LZ_MIN_MATCH : 0;
+	out[(*o)++] = (nlit < 15 ? nlit : 15) << 4 | (mfield < 15 ? mfield : 15);
+	if (nlit >= 15)
+		lz_put_length(out, o, nlit - 15);
+	memcpy(out + *o, lit, nlit);
+	*o += nlit;
+	if (match > 0) {
+		put16(out + *o, offset);
+		*o += 2;
+		if (mfield >= 15)
+			lz_put_length(out, o, mfield - 15);
+	}
+	return true;
+}
+
+//! Compression d'une suite d'octets
+/*!
+ * \param in les octets à compresser
+ * \param n leur nombre
+ * \param out le résultat
+ * \param cap la taille de \p out
+ * \return la taille compressée, ou 0 si elle dépasse \p cap
+ */
+static size_t lz_compress(const unsigned char *in, size_t n, unsigned char *out, size_t cap)
+{
+	uint32_t *table = calloc(1 << LZ_HASH_BITS, sizeof(uint32_t));
+	size_t anchor = 0, i = 0, o = 0;
+
+	if (table == NULL)
+		return 0;
+	while (i + LZ_MIN_MATCH <= n) {
+		uint32_t seq = get32(in + i);
+		uint32_t h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+		size_t cand = table[h];
+
+		// Les positions sont mémorisées plus 1 : 0 est une entrée vide
+		table[h] = i + 1;
+		if (cand == 0 || i - (cand - 1) > LZ_MAX_OFFSET || get32(in + cand - 1) != seq) {
+			++i;
+			continue;
+		}
+		size_t from = cand - 1, len = LZ_MIN_MATCH;
+		while (i + len < n && in[from + len] == in[i + len])
+			++len;
+		if (!lz_sequence(out, &o, cap, in + anchor, i - anchor, len, i - from)) {
+			free(table);
+			return 0;
+		}
+		i += len;
+		anchor = i;
+	}
+	free(table);
+	if (!lz_sequence(out, &o, cap, in + anchor, n - anchor, 0, 0))
+		return 0;
+	return o;
+}
+
+//! Lecture d'une longueur étendue
+static bool lz_get_length(const unsigned char *in, size_t n, size_t *i, size_t *len)
+{
+	unsigned char b;
+
+	do {
+		if (*i >= n)
+			return false;
+		b = in[(*i)++];
+		*len += b;
+	} while (b == 255);
+	return true;
+}
+
+//! Décompression d'une suite d'octets
+/*!
+ * \param in les octets compressés
+ * \param n leur nombre
+ * \param out le résultat
+ * \param len la taille attendue du résultat
+ * \return faux si les données sont invalides ou n'ont pas la taille attendue
+ */
+static bool lz_decompress(const unsigned char *in, size_t n, unsigned char *out, size_t len)
+{
+	size_t i = 0, o = 0;
+
+	while (i < n) {
+		unsigned token = in[i++];
+		size_t nlit = token >> 4;
+
+		if (nlit == 15 && !lz_get_length(in, n, &i, &nlit))
+			return false;
+		if (nlit > n - i || nlit > len - o)
+			return false;
+		memcpy(out + o, in + i, nlit);
+		i += nlit;
+		o += nlit;
+		if (i == n)
+			break;
+
+		if (n - i < 2)
+			return false;
+		size_t offset = get16(in + i);
+		size_t match = token & 0xf;
+		i += 2;
+		if (match == 15 && !lz_get_length(in, n, &i, &match))
+			return false;
+		match += LZ_MIN_MATCH;
+		if (offset == 0 || offset > o || match > len - o)
+			return false;
+		// Octet par octet : la copie peut recouvrir ce qu'elle produit
+		for (; match > 0; --match, ++o)
+			out[o] = out[o - offset];
+	}
+	return o == len;
+}
+
+//! Contenu d'une section, décompressé et remis dans l'ordre de l'hôte
+static bool read_section(const unsigned char *image, const unsigned char *sec, Word *words)
+{
+	uint32_t offset = get32(sec + 4);
+	uint32_t stored = get32(sec + 8);
+	uint32_t length = get32(sec + 12);
+
+	if (get16(sec + 2) & SECTION_LZ) {
+		if (!lz_decompress(image + offset, stored, (unsigned char *) words, length))
+			return false;
+	} else {
+		memcpy(words, image + offset, length);
+	}
+	if (!little_endian())
+		for (uint32_t i = 0; i < length / sizeof(Word); ++i)
+			words[i] = get32((const unsigned char *) &words[i]);
+	return true;
+}
+
+//! Le fichier projeté est-il au format version 2 ?
+bool is_bin_v2(const void *image, size_t size)
+{
+	return size >= 4 && get32(image) == BIN_MAGIC;
+}
+
+//! Taille d'un programme au format version 2
+size_t bin_v2_size(const void *image, size_t size)
+{
+	const unsigned char *p = image;
+
+	if (size < BIN_HEADER_SIZE)
+		return BIN_HEADER_SIZE;
+
+	size_t end = BIN_HEADER_SIZE + (size_t) get16(p + 6) * BIN_SECTION_SIZE;
+	if (size < end)
+		return end;
+	for (unsigned i = 0; i < get16(p + 6); ++i) {
+		const unsigned char *sec = p + BIN_HEADER_SIZE + i * BIN_SECTION_SIZE;
+		size_t last = ((size_t) get32(sec + 4) + get32(sec + 8) + 3) & ~(size_t) 3;
+		if (last > end)
+			end = last;
+	}
+	return end;
+}
+
+//! Chargement d'un programme au format version 2
+Load_Status load_bin_v2(Machine *mach, const void *image, size_t size, bool *text_in_image)
+{
+	const unsigned char *p = image;
+	const unsigned char *text_sec = NULL, *data_sec = NULL;
+
+	if (size < BIN_HEADER_SIZE || get16(p + 4) != BIN_VERSION)
+		return LOAD_FORMAT;
+
+	unsigned nsections = get16(p + 6);
+	uint32_t entry = get32(p + 8);
+	uint32_t datasize = get32(p + 12);
+	size_t length = bin_v2_size(image, size);
+	if (length > size)
+		return LOAD_FORMAT;
+	if (bin_crc32(p + BIN_HEADER_SIZE, length - BIN_HEADER_SIZE) != get32(p + 20))
+		return LOAD_CHECKSUM;
+
+	// Validation de la table des sections
+	for (unsigned i = 0; i < nsections; ++i) {
+		const unsigned char *sec = p + BIN_HEADER_SIZE + i * BIN_SECTION_SIZE;
+		unsigned type = get16(sec);
+		unsigned flags = get16(sec + 2);
+		uint64_t offset = get32(sec + 4);
+		uint32_t stored = get32(sec + 8);
+		uint32_t length = get32(sec + 12);
+
+		if (offset + stored > size)
+			return LOAD_FORMAT;
+		if (type != SECTION_TEXT && type != SECTION_DATA)
+			continue;
+		if ((flags & ~SECTION_LZ) != 0 || length % sizeof(Word) != 0
+		    || (!(flags & SECTION_LZ) && stored != length))
+			return LOAD_FORMAT;
+		const unsigned char **slot = type == SECTION_TEXT ? &text_sec : &data_sec;
+		if (*slot != NULL)
+			return LOAD_FORMAT;
+		*slot = sec;
+	}
+
+	unsigned textsize = text_sec != NULL ? get32(text_sec + 12) / sizeof(Word) : 0;
+	unsigned dataend = data_sec != NULL ? get32(data_sec + 12) / sizeof(Word) : 0;
+	if (dataend > datasize || (entry != 0 && entry >= textsize))
+		return LOAD_FORMAT;
+
+	// La pile (au-delà de dataend) n'est pas dans le fichier : elle part de 0
+	Word *data = data_alloc(datasize);
+	if (data == NULL)
+		return LOAD_MEMORY;
+	if (data_sec != NULL && !read_section(p, data_sec, data)) {
+		data_free(data, datasize);
+		return LOAD_FORMAT;
+	}
+
+	// Le segment de texte est pris sur place s'il peut l'être
+	Instruction *text;
+	*text_in_image = text_sec == NULL
+		|| (!(get16(text_sec + 2) & SECTION_LZ) && little_endian()
+		    && get32(text_sec + 4) % sizeof(Word) == 0);
+	if (*text_in_image) {
+		text = text_sec != NULL ? (Instruction *) (p + get32(text_sec + 4)) : NULL;
+	} else {
+		text = malloc(textsize * sizeof(Instruction));
+		if (text == NULL && textsize > 0) {
+			data_free(data, datasize);
+			return LOAD_MEMORY;
+		}
+		if (!read_section(p, text_sec, (Word *) text)) {
+			free(text);
+			data_free(data, datasize);
+			return LOAD_FORMAT;
+		}
+	}
+
+	if (!load_program(mach, textsize, text, datasize, data, dataend)) {
+		if (!*text_in_image)
+			free(text);
+		data_free(data, datasize);
+		return LOAD_MEMORY;
+	}
+	mach->_pc = entry;
+	verify_program(mach);
+	metrics_reset(mach);
+	return LOAD_OK;
+}
+
+//! Écriture d'une section : table et contenu
+/*!
+ * \param image le fichier en construction
+ * \param sec l'entrée de la table des sections
+ * \param pos la position du contenu, alignée sur 4 octets au retour
+ * \param type le type de la section
+ * \param words le contenu
+ * \param n le nombre de mots
+ * \param compress vrai pour tenter la compression
+ * \return faux si la mémoire manque
+ */
+static bool write_section(unsigned char *image, unsigned char *sec, size_t *pos,
+			  Section_Type type, const Word *words, size_t n, bool compress)
+{
+	size_t length = n * sizeof(Word);
+	unsigned char *raw = malloc(length > 0 ? length : 1);
+	size_t stored = 0;
+
+	if (raw == NULL)
+		return false;
+	for (size_t i = 0; i < n; ++i)
+		put32(raw + i * sizeof(Word), words[i]);
+	if (compress && length > 0)
+		stored = lz_compress(raw, length, image + *pos, length - 1);
+	if (stored == 0) {
+		memcpy(image + *pos, raw, length);
+		stored = length;
+	}
+	free(raw);
+
+	put16(sec, type);
+	put16(sec + 2, stored < length ? SECTION_LZ : 0);
+	put32(sec + 4, *pos);
+	put32(sec + 8, stored);
+	put32(sec + 12, length);
+	*pos = (*pos + stored + 3) & ~(size_t) 3;
+	return true;
+}
+
+//! Écriture d'un programme dans un fichier binaire
+bool write_program(Machine *pmach, FILE *fp, Bin_Format format)
+{
+	if (format == BIN_LEGACY) {
+		fwrite(&pmach->_textsize, sizeof(unsigned), 1, fp);
+		fwrite(&pmach->_datasize, sizeof(unsigned), 1, fp);
+		fwrite(&pmach->_dataend, sizeof(unsigned), 1, fp);
+		fwrite(pmach->_text, sizeof(Instruction), pmach->_textsize, fp);
+		fwrite(pmach->_data, sizeof(Word), pmach->_datasize, fp);
+		return !ferror(fp);
+	}
+
+	size_t start = BIN_HEADER_SIZE + 2 * BIN_SECTION_SIZE;
+	size_t size = start + (pmach->_textsize + pmach->_dataend) * sizeof(Word) + 8;
+	unsigned char *image = calloc(size, 1);
+	size_t pos = start;
+	bool compress = format == BIN_V2_LZ;
+
+	if (image == NULL
+	    || !write_section(image, image + BIN_HEADER_SIZE, &pos, SECTION_TEXT,
+			      (const Word *) pmach->_text, pmach->_textsize, compress)
+	    || !write_section(image, image + BIN_HEADER_SIZE + BIN_SECTION_SIZE, &pos, SECTION_DATA,
+			      pmach->_data, pmach->_dataend, compress)) {
+		free(image);
+		return false;
+	}
+
+	put32(image, BIN_MAGIC);
+	put16(image + 4, BIN_VERSION);
+	put16(image + 6, 2);
+	put32(image + 8, pmach->_pc);
+	put32(image + 12, pmach->_datasize);
+	put32(image + 16, 0);
+	put32(image + 20, bin_crc32(image + BIN_HEADER_SIZE, pos - BIN_HEADER_SIZE));
+
+	bool ok = fwrite(image, 1, pos, fp) == pos;
+	free(image);
+	return ok;
+}
@@ -0,0 +1,128 @@
+#ifndef _BINFILE_H_
+#define _BINFILE_H_
+
+/*!
+ * \file binfile.h
+ * \brief Format binaire versionné des programmes (version 2)
+ *
+ * Tous les entiers sont en petit-boutiste, de largeur fixe :
+ *
+ *   - en-tête de 24 octets : \c BIN_MAGIC (32 bits), \c BIN_VERSION (16
+ *     bits), nombre de sections (16 bits), point d'entrée, \c datasize,
+ *     un mot réservé (nul) et le CRC-32 de tout ce qui suit l'en-tête
+ *     (32 bits chacun) ;
+ *   - table des sections, 16 octets par section : type
+ *     (\link Section_Type \endlink, 16 bits), indicateurs (16 bits),
+ *     position du contenu depuis le début du fichier, taille stockée et
+ *     taille décompressée en octets (32 bits chacun) ;
+ *   - contenu des sections.
+ *
+ * Le segment de texte est une suite de mots de 32 bits (les instructions) ;
+ * le segment de données contient les \c dataend premiers mots, le reste
+ * jusqu'à \c datasize (la pile) part de 0. Une section de texte ou de
+ * données peut être compressée (\c SECTION_LZ) : une suite de séquences,
+ * chacune formée d'un octet de longueurs (littéraux dans les 4 bits de
+ * poids fort, copie moins 4 dans les 4 bits de poids faible, 15 annonçant
+ * des octets supplémentaires ajoutés jusqu'au premier inférieur à 255), des
+ * littéraux, puis de la distance de la copie (16 bits) ; la dernière
+ * séquence n'a que des littéraux.
+ *
+ * Le programme se termine à la fin, alignée sur 4 octets, de sa dernière
+ * section (voir bin_v2_size()) : des programmes peuvent ainsi se suivre
+ * dans un flot.
+ *
+ * Les sections inconnues sont ignorées par le chargeur (mais couvertes par
+ * le CRC), ce qui permet d'ajouter des sections sans changer de version.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "machine.h"
+
+//! Signature d'un fichier binaire version 2 ("SPRG")
+#define BIN_MAGIC 0x47525053
+
+//! Version du format binaire
+#define BIN_VERSION 2
+
+//! Taille de l'en-tête
+#define BIN_HEADER_SIZE 24
+
+//! Taille d'une entrée de la table des sections
+#define BIN_SECTION_SIZE 16
+
+//! Types de section
+typedef enum
+{
+    SECTION_TEXT = 1,	//!< Segment de texte
+    SECTION_DATA,	//!< Contenu initial du segment de données
+    SECTION_SYMBOLS,	//!< Symboles : adresse (32 bits), segment (8 bits, 0 pour le texte), longueur du nom (8 bits), nom
+    SECTION_LINES,	//!< Correspondance adresse de texte (32 bits), ligne du source (32 bits)
+} Section_Type;
+
+//! Indicateurs d'une section
+typedef enum
+{
+    SECTION_LZ = 0x0001,	//!< Contenu compressé
+} Section_Flag;
+
+//! CRC-32 d'une suite d'octets (polynôme 0xEDB88320, celui de zlib)
+/*!
+ * \param data les octets
+ * \param n leur nombre
+ * \return le CRC
+ */
+uint32_t bin_crc32(const void *data, size_t n);
+
+//! Le fichier projeté est-il au format version 2 ?
+/*!
+ * \param image le contenu du fichier
+ * \param size sa taille
+ * \return vrai si le fichier commence par \c BIN_MAGIC
+ */
+bool is_bin_v2(const void *image, size_t size);
+
+//! Taille d'un programme au format version 2
+/*!
+ * La taille n'est connue qu'avec l'en-tête et la table des sections ; avec
+ * moins d'octets, on rend le nombre d'octets à lire pour la connaître.
+ *
+ * \param image le début du programme
+ * \param size le nombre d'octets disponibles
+ * \return la taille du programme ; si l'en-tête ou la table des sections
+ * dépasse les \p size octets, la taille de l'en-tête (et de la table)
+ */
+size_t bin_v2_size(const void *image, size_t size);
+
+//! Chargement d'un programme au format version 2
+/*!
+ * L'en-tête, la table des sections et le CRC sont validés avant tout
+ * chargement ; les octets au-delà de bin_v2_size() sont ignorés. Si le
+ * segment de texte n'est pas compressé (et l'hôte petit-boutiste), il
+ * pointe dans \p image, qui doit alors rester en place jusqu'à
+ * free_program() ; sinon il est alloué.
+ *
+ * \param mach la machine à initialiser
+ * \param image le contenu du fichier
+ * \param size sa taille
+ * \param text_in_image indique au retour si le segment de texte pointe dans \p image
+ * \return \c LOAD_OK, ou la cause de l'échec
+ */
+Load_Status load_bin_v2(Machine *mach, const void *image, size_t size, bool *text_in_image);
+
+//! Écriture d'un programme dans un fichier binaire
+/*!
+ * Le point d'entrée d'un fichier version 2 est le compteur ordinal courant ;
+ * avec \c BIN_V2_LZ, chaque section n'est compressée que si cela la réduit.
+ *
+ * \param pmach la machine dont on écrit le programme
+ * \param fp le fichier
+ * \param format le format du fichier
+ * \return faux si l'écriture a échoué
+ */
+bool write_program(Machine *pmach, FILE *fp, Bin_Format format);
+
+#endif
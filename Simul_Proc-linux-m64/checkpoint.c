@@ -0,0 +1,416 @@
+/*!
+ * \file checkpoint.c
+ * \brief Points de reprise de la machine
+ *
+ * Les pages modifiées sont marquées par write_data() dans \c _dirty, un
+ * octet par page de \c DATA_PAGE_WORDS mots : le coût d'un point de reprise
+ * incrémental suit le nombre de pages écrites, et non la taille du segment
+ * de données.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "binfile.h"
+#include "metrics.h"
+#include "verify.h"
+#include "paging.h"
+
+//! Taille de l'en-tête d'un enregistrement
+#define RECORD_HEADER_SIZE (sizeof(uint32_t) + 2 * sizeof(uint16_t) + sizeof(uint64_t))
+
+//! Taille de l'état de l'unité centrale dans un enregistrement
+#define CPU_SIZE (2 * sizeof(uint32_t) + NREGISTERS * sizeof(Word) + sizeof(uint64_t))
+
+//! Fichier de points de reprise en cours d'écriture
+struct Checkpoint
+{
+	char *_path;		//!< Nom du fichier
+	FILE *_fp;		//!< Fichier, ouvert au premier point de reprise complet
+};
+
+//! Ajout d'octets au contenu d'un enregistrement
+static unsigned char *put(unsigned char *p, const void *src, size_t n)
+{
+	if (n > 0)
+		memcpy(p, src, n);
+	return p + n;
+}
+
+//! Ajout de l'état de l'unité centrale au contenu d'un enregistrement
+static unsigned char *put_cpu(unsigned char *p, const Machine *pmach)
+{
+	uint32_t pc = pmach->_pc;
+	uint32_t cc = pmach->_cc;
+
+	p = put(p, &pc, sizeof(pc));
+	p = put(p, &cc, sizeof(cc));
+	p = put(p, pmach->_registers, sizeof(pmach->_registers));
+	return put(p, &pmach->_icount, sizeof(pmach->_icount));
+}
+
+//! Nombre de pages du segment de données
+static unsigned count_pages(const Machine *pmach)
+{
+	return (pmach->_datasize + DATA_PAGE_WORDS - 1) / DATA_PAGE_WORDS;
+}
+
+//! Nombre de mots d'une page du segment de données (la dernière peut être incomplète)
+static unsigned page_words(unsigned datasize, unsigned page)
+{
+	unsigned rest = datasize - page * DATA_PAGE_WORDS;
+	return rest < DATA_PAGE_WORDS ? rest : DATA_PAGE_WORDS;
+}
+
+//! Écriture d'un enregistrement, puis mise sur disque
+static bool write_record(FILE *fp, Checkpoint_Kind kind, const unsigned char *payload, uint64_t length)
+{
+	uint32_t magic = CKPT_MAGIC;
+	uint16_t version = CKPT_VERSION;
+	uint16_t k = kind;
+	uint32_t crc = bin_crc32(payload, length);
+
+	fwrite(&magic, sizeof(magic), 1, fp);
+	fwrite(&version, sizeof(version), 1, fp);
+	fwrite(&k, sizeof(k), 1, fp);
+	fwrite(&length, sizeof(length), 1, fp);
+	fwrite(payload, 1, length, fp);
+	fwrite(&crc, sizeof(crc), 1, fp);
+	return fflush(fp) == 0 && !ferror(fp) && fsync(fileno(fp)) == 0;
+}
+
+//! Point de reprise complet, dans un nouveau fichier
+static bool write_full(Checkpoint *ck, Machine *pmach)
+{
+	uint64_t length = CPU_SIZE + 3 * sizeof(unsigned)
+		+ ((uint64_t) pmach->_textsize + pmach->_datasize) * sizeof(Word);
+	unsigned char *payload = malloc(length);
+	char *tmp = malloc(strlen(ck->_path) + 5);
+	FILE *fp = NULL;
+	bool ok = false;
+
+	if (payload != NULL && tmp != NULL) {
+		unsigned char *p = put_cpu(payload, pmach);
+		p = put(p, &pmach->_textsize, sizeof(unsigned));
+		p = put(p, &pmach->_datasize, sizeof(unsigned));
+		p = put(p, &pmach->_dataend, sizeof(unsigned));
+		p = put(p, pmach->_text, pmach->_textsize * sizeof(Instruction));
+		put(p, pmach->_data, pmach->_datasize * sizeof(Word));
+
+		// Le fichier précédent n'est remplacé qu'une fois le nouveau sur disque
+		sprintf(tmp, "%s.tmp", ck->_path);
+		fp = fopen(tmp, "wb");
+		ok = fp != NULL && write_record(fp, CKPT_FULL, payload, length)
+			&& rename(tmp, ck->_path) == 0;
+		if (!ok && fp != NULL) {
+			fclose(fp);
+			remove(tmp);
+		}
+	}
+	free(payload);
+	free(tmp);
+	if (!ok)
+		return false;
+
+	if (ck->_fp != NULL)
+		fclose(ck->_fp);
+	ck->_fp = fp;
+
+	// Suivi des pages modifiées à partir de ce point
+	if (pmach->_dirty == NULL)
+		pmach->_dirty = calloc(count_pages(pmach), 1);
+	else
+		memset(pmach->_dirty, 0, count_pages(pmach));
+	return true;
+}
+
+//! Point de reprise incrémental : les pages modifiées depuis le point précédent
+static bool write_delta(Checkpoint *ck, Machine *pmach)
+{
+	unsigned npages = count_pages(pmach);
+	uint32_t ndirty = 0;
+	uint64_t length = CPU_SIZE + sizeof(uint32_t);
+
+	for (unsigned page = 0; page < npages; ++page) {
+		if (pmach->_dirty[page]) {
+			ndirty += 1;
+			length += sizeof(uint32_t) + page_words(pmach->_datasize, page) * sizeof(Word);
+		}
+	}
+
+	unsigned char *payload = malloc(length);
+	if (payload == NULL)
+		return false;
+	unsigned char *p = put_cpu(payload, pmach);
+	p = put(p, &ndirty, sizeof(ndirty));
+	for (uint32_t page = 0; page < npages; ++page) {
+		if (pmach->_dirty[page]) {
+			p = put(p, &page, sizeof(page));
+			p = put(p, &pmach->_data[page * DATA_PAGE_WORDS],
+				page_words(pmach->_datasize, page) * sizeof(Word));
+		}
+	}
+
+	bool ok = write_record(ck->_fp, CKPT_DELTA, payload, length);
+	free(payload);
+	if (ok) {
+		memset(pmach->_dirty, 0, npages);
+	} else {
+		// Enregistrement peut-être incomplet : on repart d'un point complet
+		fclose(ck->_fp);
+		ck->_fp = NULL;
+	}
+	return ok;
+}
+
+//! Création d'un fichier de points de reprise
+Checkpoint *checkpoint_create(const char *path)
+{
+	Checkpoint *ck = malloc(sizeof(Checkpoint));
+
+	if (ck == NULL)
+		return NULL;
+	ck->_path = malloc(strlen(path) + 1);
+	if (ck->_path == NULL) {
+		free(ck);
+		return NULL;
+	}
+	strcpy(ck->_path, path);
+	ck->_fp = NULL;
+	return ck;
+}
+
+//! Écriture d'un point de reprise
+bool checkpoint_write(Checkpoint *ck, Machine *pmach)
+{
+	if (ck->_fp == NULL || pmach->_dirty == NULL)
+		return write_full(ck, pmach);
+	return write_delta(ck, pmach);
+}
+
+//! Fermeture d'un fichier de points de reprise
+void checkpoint_close(Checkpoint *ck, Machine *pmach)
+{
+	if (ck->_fp != NULL)
+		fclose(ck->_fp);
+	free(pmach->_dirty);
+	pmach->_dirty = NULL;
+	free(ck->_path);
+	free(ck);
+}
+
+//! Lecture d'octets du contenu d'un enregistrement
+static const unsigned char *get(const unsigned char *p, void *dst, size_t n)
+{
+	if (n > 0)
+		memcpy(dst, p, n);
+	return p + n;
+}
+
+//! Validation du contenu d'un point incrémental
+static bool check_delta(const unsigned char *p, uint64_t length, unsigned datasize)
+{
+	const unsigned char *end = p + length;
+	uint32_t ndirty;
+
+	if (length < CPU_SIZE + sizeof(ndirty))
+		return false;
+	p = get(p + CPU_SIZE, &ndirty, sizeof(ndirty));
+	for (uint32_t i = 0; i < ndirty; ++i) {
+		uint32_t page;
+		if ((size_t) (end - p) < sizeof(page))
+			return false;
+		p = get(p, &page, sizeof(page));
+		if ((uint64_t) page * DATA_PAGE_WORDS >= datasize
+		    || (size_t) (end - p) < page_words(datasize, page) * sizeof(Word))
+			return false;
+		p += page_words(datasize, page) * sizeof(Word);
+	}
+	return p == end;
+}
+
+//! Reprise d'une machine depuis un fichier de points de reprise
+bool checkpoint_restore(const char *path, Machine *pmach)
+{
+	FILE *fp = fopen(path, "rb");
+	Instruction *text = NULL;
+	Word *data = NULL;
+	unsigned sizes[3] = {0, 0, 0};
+	unsigned char cpu[CPU_SIZE];
+	bool full = false;
+
+	if (fp == NULL)
+		return false;
+
+	for (;;) {
+		uint32_t magic, crc;
+		uint16_t version, kind;
+		uint64_t length;
+
+		if (fread(&magic, sizeof(magic), 1, fp) != 1
+		    || fread(&version, sizeof(version), 1, fp) != 1
+		    || fread(&kind, sizeof(kind), 1, fp) != 1
+		    || fread(&length, sizeof(length), 1, fp) != 1
+		    || magic != CKPT_MAGIC || version != CKPT_VERSION || length < CPU_SIZE)
+			break;
+
+		unsigned char *payload = malloc(length);
+		if (payload == NULL)
+			break;
+		if (fread(payload, 1, length, fp) != length || fread(&crc, sizeof(crc), 1, fp) != 1
+		    || crc != bin_crc32(payload, length)) {
+			free(payload);
+			break;
+		}
+
+		const unsigned char *p = payload + CPU_SIZE;
+		bool valid = true;
+		if (kind == CKPT_FULL) {
+			unsigned s[3] = {0, 0, 0};
+			valid = length >= CPU_SIZE + sizeof(s);
+			if (valid) {
+				p = get(p, s, sizeof(s));
+				valid = s[2] <= s[1]
+					&& length == CPU_SIZE + sizeof(s) + ((uint64_t) s[0] + s[1]) * sizeof(Word);
+			}
+			Instruction *t = valid ? malloc(s[0] * sizeof(Instruction) + 1) : NULL;
+			Word *d = valid ? data_alloc(s[1]) : NULL;
+			if (t != NULL && d != NULL) {
+				p = get(p, t, s[0] * sizeof(Instruction));
+				data_load(d, p, s[1]);
+				free(text);
+				data_free(data, sizes[1]);
+				text = t;
+				data = d;
+				memcpy(sizes, s, sizeof(s));
+				full = true;
+			} else {
+				free(t);
+				data_free(d, s[1]);
+				valid = false;
+			}
+		} else if (kind == CKPT_DELTA && full && check_delta(payload, length, sizes[1])) {
+			uint32_t ndirty, page;
+			p = get(p, &ndirty, sizeof(ndirty));
+			for (uint32_t i = 0; i < ndirty; ++i) {
+				p = get(p, &page, sizeof(page));
+				p = get(p, &data[page * DATA_PAGE_WORDS], page_words(sizes[1], page) * sizeof(Word));
+			}
+		} else {
+			valid = false;
+		}
+
+		if (valid)
+			memcpy(cpu, payload, CPU_SIZE);
+		free(payload);
+		if (!valid)
+			break;
+	}
+	fclose(fp);
+
+	if (!full)
+		return false;
+
+	uint32_t pc, cc;
+	const unsigned char *p = cpu;
+	if (!load_program(pmach, sizes[0], text, sizes[1], data, sizes[2])) {
+		free(text);
+		data_free(data, sizes[1]);
+		return false;
+	}
+	p = get(p, &pc, sizeof(pc));
+	p = get(p, &cc, sizeof(cc));
+	p = get(p, pmach->_registers, sizeof(pmach->_registers));
+	get(p, &pmach->_icount, sizeof(pmach->_icount));
+	pmach->_pc = pc;
+	pmach->_cc = cc;
+	verify_program(pmach);
+	metrics_reset(pmach);
+	return true;
+}
+
+//! Borne de la simulation abaissée par le gestionnaire de signal
+static uint64_t *volatile signal_limit = NULL;
+
+//! Point de reprise demandé par signal
+static volatile sig_atomic_t signal_requested = 0;
+
+//! Gestionnaire du signal de demande de point de reprise
+static void on_signal(int signo)
+{
+	uint64_t *limit = signal_limit;
+
+	(void) signo;
+	signal_requested = 1;
+	if (limit != NULL)
+		__atomic_store_n(limit, 0, __ATOMIC_RELAXED);
+}
+
+//! Paramètres de la simulation exécutée par catch_error()
+typedef struct
+{
+	Machine *_pmach;
+	Trace_Level _level;
+	Checkpoint *_ck;
+	uint64_t _interval;
+	uint64_t _limit;	//!< Borne courante de simul_until()
+} Checkpoint_Args;
+
+//! Simulation exécutée par catch_error() : un point de reprise à chaque borne
+static void run_checkpointed(void *arg)
+{
+	Checkpoint_Args *args = arg;
+	Machine *pmach = args->_pmach;
+
+	for (;;) {
+		if (!checkpoint_write(args->_ck, pmach))
+			fprintf(stderr, "Écriture du point de reprise impossible.\n");
+
+		// Une demande reçue avant la mise à jour de la borne n'est pas perdue
+		signal_requested = 0;
+		__atomic_store_n(&args->_limit,
+				 args->_interval > 0 ? pmach->_icount + args->_interval : UINT64_MAX,
+				 __ATOMIC_RELAXED);
+		if (signal_requested)
+			__atomic_store_n(&args->_limit, 0, __ATOMIC_RELAXED);
+
+		if (!simul_until(pmach, args->_level, &args->_limit))
+			return;
+	}
+}
+
+//! Simulation avec points de reprise
+Run_Status simul_checkpoint(Machine *pmach, Trace_Level level, Checkpoint *ck,
+			    uint64_t interval, int signo)
+{
+	Checkpoint_Args args = {pmach, level, ck, interval, UINT64_MAX};
+	Run_Status status = {RUN_HALT, ERR_NOERROR, 0};
+	struct sigaction action, previous;
+
+	if (signo != 0) {
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = on_signal;
+		action.sa_flags = SA_RESTART;
+		sigemptyset(&action.sa_mask);
+		signal_limit = &args._limit;
+		sigaction(signo, &action, &previous);
+	}
+
+	if (catch_error(run_checkpointed, &args, &status._err, &status._pc)) {
+		status._pc = pmach->_pc - 1;
+	} else {
+		status._state = RUN_ERROR;
+	}
+
+	if (signo != 0) {
+		sigaction(signo, &previous, NULL);
+		signal_limit = NULL;
+	}
+	return status;
+}
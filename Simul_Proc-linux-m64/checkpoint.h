@@ -0,0 +1,112 @@
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+/*!
+ * \file checkpoint.h
+ * \brief Points de reprise de la machine
+ *
+ * Un fichier de points de reprise est une suite d'enregistrements (entiers
+ * dans l'ordre de l'hôte) : \c CKPT_MAGIC (32 bits), \c CKPT_VERSION et la
+ * nature de l'enregistrement (16 bits chacun), la taille du contenu (64
+ * bits), le contenu, puis le CRC-32 du contenu (bin_crc32()).
+ *
+ * Le contenu commence par l'état de l'unité centrale : \c pc, \c cc, les
+ * registres et le compteur d'instructions (64 bits). Un point de reprise
+ * complet (\c CKPT_FULL) y ajoute \c textsize, \c datasize, \c dataend et
+ * les segments de texte et de données ; un point de reprise incrémental
+ * (\c CKPT_DELTA), le nombre de pages de données modifiées depuis le point
+ * précédent, puis chacune d'elles : son numéro et ses \c DATA_PAGE_WORDS
+ * mots (moins pour la dernière page du segment).
+ *
+ * Le fichier commence toujours par un point de reprise complet, écrit dans
+ * un fichier temporaire renommé ensuite : un arrêt brutal laisse le fichier
+ * précédent intact. Les points incrémentaux sont ajoutés à la suite ; un
+ * enregistrement incomplet ou altéré en fin de fichier est ignoré à la
+ * reprise.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "machine.h"
+
+//! Signature d'un enregistrement ("SPCK")
+#define CKPT_MAGIC 0x4b435053
+
+//! Version du format des points de reprise
+#define CKPT_VERSION 1
+
+//! Nature d'un enregistrement
+typedef enum
+{
+    CKPT_FULL = 1,	//!< Point de reprise complet
+    CKPT_DELTA,		//!< Pages de données modifiées depuis le point précédent
+} Checkpoint_Kind;
+
+//! Fichier de points de reprise en cours d'écriture
+typedef struct Checkpoint Checkpoint;
+
+//! Création d'un fichier de points de reprise
+/*!
+ * Rien n'est écrit avant le premier appel de checkpoint_write().
+ *
+ * \param path le nom du fichier
+ * \return le fichier, ou NULL si la mémoire manque
+ */
+Checkpoint *checkpoint_create(const char *path);
+
+//! Écriture d'un point de reprise
+/*!
+ * Le premier point de reprise est complet ; il met en place le suivi des
+ * pages de données modifiées (\c _dirty, voir write_data()). Les suivants
+ * n'écrivent que les pages modifiées depuis le point précédent. Chaque
+ * point est sur disque (fsync()) au retour.
+ *
+ * \param ck le fichier de points de reprise
+ * \param pmach la machine
+ * \return faux si l'écriture a échoué
+ */
+bool checkpoint_write(Checkpoint *ck, Machine *pmach);
+
+//! Fermeture d'un fichier de points de reprise
+/*!
+ * Le suivi des pages modifiées de la machine est arrêté.
+ *
+ * \param ck le fichier de points de reprise
+ * \param pmach la machine
+ */
+void checkpoint_close(Checkpoint *ck, Machine *pmach);
+
+//! Reprise d'une machine depuis un fichier de points de reprise
+/*!
+ * Le dernier point complet est rechargé et les points incrémentaux qui le
+ * suivent appliqués dans l'ordre. La machine est libérée par
+ * free_program().
+ *
+ * \param path le nom du fichier
+ * \param pmach la machine à initialiser
+ * \return faux si le fichier ne contient aucun point de reprise complet valide
+ */
+bool checkpoint_restore(const char *path, Machine *pmach);
+
+//! Simulation avec points de reprise
+/*!
+ * Comme simul_run(), avec un point de reprise complet au départ, puis un
+ * point incrémental toutes les \p interval instructions et à chaque
+ * réception du signal \p signo. Un point de reprise ne peut être écrit
+ * qu'entre deux instructions : le gestionnaire de signal se contente
+ * d'abaisser la borne de simul_until().
+ *
+ * Un seul processus léger à la fois peut utiliser un signal.
+ *
+ * \param pmach la machine en cours d'exécution
+ * \param level le niveau de trace
+ * \param ck le fichier de points de reprise
+ * \param interval le nombre d'instructions entre deux points, ou 0
+ * \param signo le signal qui demande un point de reprise, ou 0
+ * \return le compte rendu de l'exécution
+ */
+Run_Status simul_checkpoint(Machine *pmach, Trace_Level level, Checkpoint *ck,
+                            uint64_t interval, int signo);
+
+#endif
@@ -0,0 +1,123 @@
+/*!
+ * \file clone.c
+ * \brief Clonage d'une machine par copie sur écriture
+ *
+ * Le segment de données du modèle est écrit dans un fichier anonyme
+ * (memfd_create()) que chaque clone projette avec \c MAP_PRIVATE : la copie
+ * d'une page est faite par le noyau à la première écriture, sans aucun test
+ * dans la boucle de simulation.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "clone.h"
+#include "metrics.h"
+
+//! Image partagée d'une machine modèle
+struct Clone_Source
+{
+	const Machine *_template;	//!< Machine modèle
+	int _fd;			//!< Fichier anonyme du segment de données
+	size_t _mapsize;		//!< Taille d'une projection du segment de données
+};
+
+//! Taille d'une projection du segment de données (au moins une page)
+static size_t map_size(unsigned datasize)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t bytes = (size_t) datasize * sizeof(Word);
+
+	return bytes == 0 ? page : (bytes + page - 1) / page * page;
+}
+
+//! La zone ne contient-elle que des mots nuls ?
+static bool all_zero(const Word *words, unsigned n)
+{
+	for (unsigned i = 0; i < n; ++i)
+		if (words[i] != 0)
+			return false;
+	return true;
+}
+
+//! Création de l'image d'une machine modèle
+Clone_Source *clone_source_create(const Machine *pmach)
+{
+	Clone_Source *src;
+
+	// Les instructions d'un modèle gardé lisent sans vérification (voir guard.h)
+	if (pmach->_guard != NULL)
+		return NULL;
+	src = malloc(sizeof(Clone_Source));
+	if (src == NULL)
+		return NULL;
+	src->_template = pmach;
+	src->_mapsize = map_size(pmach->_datasize);
+	src->_fd = memfd_create("simul-data", MFD_CLOEXEC);
+	if (src->_fd < 0 || ftruncate(src->_fd, src->_mapsize) != 0) {
+		clone_source_free(src);
+		return NULL;
+	}
+
+	// Le fichier est initialement nul : on n'écrit que les pages non nulles
+	for (unsigned page = 0; page < pmach->_datasize; page += DATA_PAGE_WORDS) {
+		unsigned n = pmach->_datasize - page < DATA_PAGE_WORDS ? pmach->_datasize - page : DATA_PAGE_WORDS;
+		size_t bytes = n * sizeof(Word);
+
+		if (!all_zero(&pmach->_data[page], n)
+		    && pwrite(src->_fd, &pmach->_data[page], bytes, page * sizeof(Word)) != (ssize_t) bytes) {
+			clone_source_free(src);
+			return NULL;
+		}
+	}
+	return src;
+}
+
+//! Libération de l'image d'une machine modèle
+void clone_source_free(Clone_Source *src)
+{
+	if (src->_fd >= 0)
+		close(src->_fd);
+	free(src);
+}
+
+//! Création d'un clone
+bool clone_machine(const Clone_Source *src, Machine *clone)
+{
+	void *data = mmap(NULL, src->_mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE, src->_fd, 0);
+
+	if (data == MAP_FAILED)
+		return false;
+
+	*clone = *src->_template;
+	clone->_data = data;
+	clone->_image = NULL;
+	clone->_imagesize = 0;
+	clone->_dirty = NULL;
+	clone->_guard = NULL;
+	clone->_guardsize = 0;
+	clone->_threaded = NULL;
+	clone->_icount = 0;
+	if (!metrics_init(clone)) {
+		munmap(data, src->_mapsize);
+		return false;
+	}
+	return true;
+}
+
+//! Libération d'un clone
+void free_clone(Machine *clone)
+{
+	munmap(clone->_data, map_size(clone->_datasize));
+	metrics_free(clone->_metrics);
+	free(clone->_threaded);
+	clone->_metrics = NULL;
+	clone->_threaded = NULL;
+	clone->_data = NULL;
+	clone->_text = NULL;
+	clone->_decoded = NULL;
+}
@@ -0,0 +1,67 @@
+#ifndef _CLONE_H_
+#define _CLONE_H_
+
+/*!
+ * \file clone.h
+ * \brief Clonage d'une machine par copie sur écriture
+ *
+ * Pour exécuter un même programme avec de nombreuses données initiales
+ * différentes, on charge une fois la machine modèle, puis on en tire des
+ * clones : ils partagent les segments de texte (et pré-décodé) du modèle,
+ * qui ne sont jamais modifiés, et une image de son segment de données,
+ * projetée en privé dans chaque clone. Une page de données n'est copiée
+ * qu'à la première écriture du clone : la mémoire d'une exécution suit les
+ * pages qu'elle écrit, et non \c _datasize.
+ */
+
+#include <stdbool.h>
+
+#include "machine.h"
+
+//! Image partagée d'une machine modèle
+typedef struct Clone_Source Clone_Source;
+
+//! Création de l'image d'une machine modèle
+/*!
+ * Le segment de données du modèle est recopié dans un fichier anonyme
+ * (les pages entièrement nulles n'y occupent pas de mémoire) ; l'état de
+ * l'unité centrale est celui du modèle au moment de l'appel. Le modèle doit
+ * rester chargé tant que l'image et ses clones existent, et ne pas être
+ * gardé (voir guard.h).
+ *
+ * \param pmach la machine modèle, chargée
+ * \return l'image, ou NULL si elle ne peut être créée
+ */
+Clone_Source *clone_source_create(const Machine *pmach);
+
+//! Libération de l'image d'une machine modèle
+/*!
+ * Les clones déjà créés restent utilisables.
+ *
+ * \param src l'image
+ */
+void clone_source_free(Clone_Source *src);
+
+//! Création d'un clone
+/*!
+ * Le clone démarre dans l'état du modèle, avec un compteur d'instructions
+ * et des compteurs d'exécution nuls, et sans suivi des pages modifiées.
+ * Plusieurs processus légers peuvent créer et exécuter des clones de la même
+ * image en même temps.
+ *
+ * \param src l'image du modèle
+ * \param clone la machine à initialiser
+ * \return faux si la projection du segment de données est impossible
+ */
+bool clone_machine(const Clone_Source *src, Machine *clone);
+
+//! Libération d'un clone
+/*!
+ * Seuls le segment de données et les compteurs du clone lui appartiennent ;
+ * un clone ne doit pas être libéré par free_program().
+ *
+ * \param clone le clone
+ */
+void free_clone(Machine *clone);
+
+#endif
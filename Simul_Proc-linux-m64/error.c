@@ -1,52 +1,150 @@
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "error.h"
+#include "async.h"
+
+//! Point de reprise de catch_error()
+typedef struct
+{
+	jmp_buf _env;		//!< Contexte de reprise
+	Error _err;		//!< Code de l'erreur
+	unsigned _addr;		//!< Adresse de l'erreur
+} Recovery;
+
+//! Point de reprise courant du processus léger, ou NULL
+static __thread Recovery *recovery = NULL;
+
+//! Flot de sortie du processus léger, ou NULL pour la sortie standard
+static __thread FILE *output = NULL;
+
 /*
- * !Affichage d'une erreur et fin du simulateur.
- *
- * Toutes les erreurs étant fatales on ne revient jamais de cette fonction.
- * L'attribut noreturn est une extension (non standard) de GNU C qui indique ce fait.
+ * !Flot de sortie du simulateur pour le processus léger courant.
+ */
+FILE *sim_output(void){
+	return output!=NULL ? output : stdout;
+}
+/*
+ * !Choix du flot de sortie du processus léger courant.
+ * \Paramètres
+ *		out: flot de sortie, ou NULL pour la sortie standard
+ */
+void set_sim_output(FILE *out){
+	output=out;
+}
+
+/*
+ * !Affichage du message d'une erreur.
  * \Paramètres
  *		err: code de l'erreur
  *  	addr: adresse de l'erreur 
  */
-void error(Error err, unsigned addr){
+void print_error(Error err, unsigned addr){
 	switch(err){
 		case ERR_NOERROR://!< Pas d'erreur
-			printf("There is no error: %#.4x\n",addr);
-			exit(0);
+			fprintf(sim_output(), "There is no error: %#.4x\n",addr);
+			break;
 		case ERR_UNKNOWN://!< Instruction inconnue
-			printf("ERROR: Instruction inconnue %#.4x\n",addr);
-			exit(1);
+			fprintf(sim_output(), "ERROR: Instruction inconnue %#.4x\n",addr);
+			break;
 		case ERR_ILLEGAL://!< Instruction illégale
-			printf("ERROR: Instruction illégale %#.4x\n",addr);
-			exit(1);
+			fprintf(sim_output(), "ERROR: Instruction illégale %#.4x\n",addr);
+			break;
 		case ERR_CONDITION://!< Condition illégale
-			printf("ERROR: Condition illégale %#.4x\n",addr);
-			exit(1);
+			fprintf(sim_output(), "ERROR: Condition illégale %#.4x\n",addr);
+			break;
 		case ERR_IMMEDIATE://!< Valeur immédiate interdite
-			printf("ERROR: Valeur immédiate interdite %#.4x\n",addr);
-			exit(1);
+			fprintf(sim_output(), "ERROR: Valeur immédiate interdite %#.4x\n",addr);
+			break;
 		case ERR_SEGTEXT://!< Violation de taille du segment de texte
-			printf("ERROR: Violation de taille du segment de texte %#.4x\n",addr);
-			exit(1);
+			fprintf(sim_output(), "ERROR: Violation de taille du segment de texte %#.4x\n",addr);
+			break;
 		case ERR_SEGDATA://!< Violation de taille du segment de données
-			printf("ERROR: Violation de taille du segment de données %#.4x\n",addr);
-			exit(1);
+			fprintf(sim_output(), "ERROR: Violation de taille du segment de données %#.4x\n",addr);
+			break;
 		case ERR_SEGSTACK://!< Violation de taille du segment de pile
-			printf("ERROR: Violation de taille du segment de pile %#.4x\n",addr);
-			exit(1);
+			fprintf(sim_output(), "ERROR: Violation de taille du segment de pile %#.4x\n",addr);
+			break;
+		case ERR_MEMORY://!< Mémoire insuffisante pour le moteur d'exécution
+			fprintf(sim_output(), "ERROR: Mémoire insuffisante %#.4x\n",addr);
+			break;
 		default:
-			exit(1);
+			break;
 	}
 }
+/*
+ * !Affichage d'une erreur et fin du simulateur.
+ *
+ * Toutes les erreurs étant fatales on ne revient jamais de cette fonction.
+ * L'attribut noreturn est une extension (non standard) de GNU C qui indique ce fait.
+ * Pendant l'écriture asynchrone (voir async.h), le message est écrit par le
+ * processus léger d'écriture avant la sortie.
+ * \Paramètres
+ *		err: code de l'erreur
+ *  	addr: adresse de l'erreur 
+ */
+void error(Error err, unsigned addr){
+	if(recovery!=NULL){
+		recovery->_err=err;
+		recovery->_addr=addr;
+		longjmp(recovery->_env,1);
+	}
+	if(async_active())
+		async_error(err,addr);
+	else
+		print_error(err,addr);
+	exit(err==ERR_NOERROR ? 0 : 1);
+}
+/*
+ * !Exécution avec reprise sur erreur.
+ *
+ * Le point de reprise précédent est restauré dans tous les cas, ce qui
+ * permet l'imbrication des appels.
+ * \Paramètres
+ *		fn: fonction à exécuter
+ *		arg: son paramètre
+ *		err: code de l'erreur
+ *		addr: adresse de l'erreur
+ */
+bool catch_error(void (*fn)(void *arg), void *arg, Error *err, unsigned *addr){
+	Recovery here;
+	Recovery *outer=recovery;
+
+	if(setjmp(here._env)!=0){
+		recovery=outer;
+		*err=here._err;
+		*addr=here._addr;
+		return false;
+	}
+	recovery=&here;
+	fn(arg);
+	recovery=outer;
+	return true;
+}
+/*
+ * !Reprise sur erreur active dans le processus léger courant ?
+ */
+bool catch_active(void){
+	return recovery!=NULL;
+}
 /*!Affichage d'un avertissement.
 * \Paramètres
 *     	warn:	code de l'avertissement
 *    	addr:	adresse de l'erreur 
 */
-void warning(Warning warn, unsigned addr){
+void print_warning(Warning warn, unsigned addr){
 	if(warn==WARN_HALT)//!< Fin normale du programme (sur HALT)
-		printf("WARNING: HALT reached at address %#.4x\n",addr);
+		fprintf(sim_output(), "WARNING: HALT reached at address %#.4x\n",addr);
+}
+/*!Affichage d'un avertissement, éventuellement asynchrone (voir async.h).
+* \Paramètres
+*     	warn:	code de l'avertissement
+*    	addr:	adresse de l'erreur 
+*/
+void warning(Warning warn, unsigned addr){
+	if(async_active())
+		async_warning(warn,addr);
+	else
+		print_warning(warn,addr);
 }
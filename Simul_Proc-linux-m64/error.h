@@ -1,6 +1,8 @@
 #ifndef _ERROR_H_
 #define _ERROR_H_
 
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 /*!
@@ -25,10 +27,11 @@ typedef enum
     ERR_SEGTEXT,	//!< Violation de taille du segment de texte
     ERR_SEGDATA,	//!< Violation de taille du segment de données
     ERR_SEGSTACK,	//!< Violation de taille du segment de pile
+    ERR_MEMORY,		//!< Mémoire du simulateur insuffisante pour le moteur d'exécution
 } Error; 
 
 //! Dernière valeur possible du code d'erreur
-static const unsigned LAST_ERROR = ERR_SEGSTACK;
+static const unsigned LAST_ERROR = ERR_MEMORY;
 
 //! Codes d'avertissement
 /*!
@@ -48,6 +51,10 @@ static const unsigned LAST_WARNING = WARN_HALT;
  * \note Toutes les erreurs étant fatales on ne revient jamais de cette
  * fonction. L'attribut \a noreturn est une extension (non standard) de GNU C
  * qui indique ce fait.
+ *
+ * Pendant un appel à catch_error() (dans le même processus léger), l'erreur
+ * n'est pas affichée et le simulateur ne s'arrête pas : l'exécution reprend
+ * au retour de catch_error(), qui transmet le code et l'adresse de l'erreur.
  * 
  * \param err code de l'erreur
  * \param addr adresse de l'erreur
@@ -59,6 +66,49 @@ void error(Error err, unsigned addr);
 #endif
 
 
+//! Flot de sortie du simulateur pour le processus léger courant
+/*!
+ * Les messages, traces et affichages de la machine sont écrits sur ce flot,
+ * la sortie standard par défaut. Chaque processus léger a le sien : des
+ * simulations concurrentes n'entremêlent pas leurs sorties.
+ *
+ * \return le flot de sortie
+ */
+FILE *sim_output(void);
+
+//! Choix du flot de sortie du processus léger courant
+/*!
+ * \param out le flot de sortie, ou NULL pour la sortie standard
+ */
+void set_sim_output(FILE *out);
+
+//! Exécution avec reprise sur erreur
+/*!
+ * Les appels à error() pendant l'exécution de \c fn reviennent ici (par
+ * \c longjmp) au lieu de terminer le programme. Les appels peuvent être
+ * imbriqués ; chaque processus léger a son propre point de reprise.
+ *
+ * \param fn la fonction à exécuter
+ * \param arg son paramètre
+ * \param err le code de l'erreur, si elle a eu lieu
+ * \param addr l'adresse de l'erreur, si elle a eu lieu
+ * \return vrai si \c fn s'est terminée normalement ; faux sur erreur
+ */
+bool catch_error(void (*fn)(void *arg), void *arg, Error *err, unsigned *addr);
+
+//! Reprise sur erreur active dans le processus léger courant ?
+/*!
+ * Utilisable depuis un gestionnaire de signal synchrone (voir guard.c).
+ */
+bool catch_active(void);
+
+//! Affichage du message d'une erreur, sans fin du simulateur
+/*!
+ * \param err code de l'erreur
+ * \param addr adresse de l'erreur
+ */
+void print_error(Error err, unsigned addr);
+
 //! Affichage d'un avertissement
 /*!
  * \param warn code de l'avertissement
@@ -66,4 +116,11 @@ void error(Error err, unsigned addr);
  */
 void warning(Warning warn, unsigned addr);
 
+//! Affichage d'un avertissement, toujours synchrone
+/*!
+ * \param warn code de l'avertissement
+ * \param addr adresse de l'erreur
+ */
+void print_warning(Warning warn, unsigned addr);
+
 #endif
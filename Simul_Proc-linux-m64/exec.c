@@ -5,30 +5,442 @@
  * \author Romain Guillot
  */
 
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include "exec.h"
 #include "error.h"
+#include "metrics.h"
+#include "async.h"
+
+//! Taille d'une ligne de cache (alignement du segment pré-décodé)
+#define CACHE_LINE 64
+
+//! Code threadé par \e goto calculés (extension GNU C) ?
+#if defined(__GNUC__) && !defined(NO_THREADED_CODE)
+#   define THREADED_CODE
+#endif
 
-bool instr_illop(Machine *pmach, Instruction instr);
-bool instr_nop(Machine *pmach, Instruction instr);
-bool instr_load(Machine *pmach, Instruction instr);
-bool instr_store(Machine *pmach, Instruction instr);
-bool instr_add(Machine *pmach, Instruction instr);
-bool instr_sub(Machine *pmach, Instruction instr);
-bool instr_branch(Machine *pmach, Instruction instr);
-bool instr_call(Machine *pmach, Instruction instr);
-bool instr_ret(Machine *pmach, Instruction instr);
-bool instr_push(Machine *pmach, Instruction instr);
-bool instr_pop(Machine *pmach, Instruction instr);
-bool instr_halt(Machine *pmach, Instruction instr);
-bool cmp_op(Machine *pmach, Instruction instr);
-unsigned calculate_adress(Machine *pmach, Instruction instr);
+//! Barrière du compilateur : l'état de la machine est en mémoire avant une lecture qui peut faire une faute (voir guard.h)
+#ifdef __GNUC__
+#   define SYNC_MACHINE() __asm__ __volatile__("" ::: "memory")
+#else
+#   define SYNC_MACHINE()
+#endif
+
+//! Variantes dont l'exécution vérifie l'adresse de l'opérande
+/*!
+ * X(variante, nom) : chacune a aussi une fonction d'exécution sans ces
+ * vérifications (\c instr_nom_verified()), pour les instructions que
+ * verify_program() a prouvées sûres. Les vérifications de la pile restent.
+ */
+#define CHECKED_KINDS(X) \
+	X(LOAD_ABS, load_abs) X(LOAD_IDX, load_idx) \
+	X(STORE_ABS, store_abs) X(STORE_IDX, store_idx) \
+	X(ADD_ABS, add_abs) X(ADD_IDX, add_idx) \
+	X(SUB_ABS, sub_abs) X(SUB_IDX, sub_idx) \
+	X(BRANCH_ABS, branch_abs) X(BRANCH_IDX, branch_idx) \
+	X(CALL_ABS, call_abs) X(CALL_IDX, call_idx) \
+	X(PUSH_ABS, push_abs) X(PUSH_IDX, push_idx) \
+	X(POP_ABS, pop_abs) X(POP_IDX, pop_idx)
+
+#define DECLARE_HANDLER(kind, name) bool instr_##name(Machine *pmach, const Micro_Op *op);
+OP_KINDS(DECLARE_HANDLER)
+#undef DECLARE_HANDLER
+#define DECLARE_VERIFIED(kind, name) bool instr_##name##_verified(Machine *pmach, const Micro_Op *op);
+CHECKED_KINDS(DECLARE_VERIFIED)
+#undef DECLARE_VERIFIED
+bool cmp_op(Machine *pmach, const Micro_Op *op);
 void set_cc(Machine *pmach, Word value);
 void error_instruction(Machine *pmach, Error err);
-void check_index_register(Machine *pmach, int index);
 void check_sp(Machine *pmach, int sp);
 void check_adress_data(Machine *pmach, unsigned adress);
+void write_data(Machine *pmach, unsigned adress, Word value);
+
+//! Fonctions d'exécution, indexées par variante
+static const Op_Handler handlers[NKINDS] = {
+#define HANDLER_ENTRY(kind, name) [OP_##kind] = instr_##name,
+	OP_KINDS(HANDLER_ENTRY)
+#undef HANDLER_ENTRY
+};
+
+//! Fonctions d'exécution sans vérification d'adresse, indexées par variante
+static const Op_Handler verified_handlers[NKINDS] = {
+#define VERIFIED_ENTRY(kind, name) [OP_##kind] = instr_##name##_verified,
+	CHECKED_KINDS(VERIFIED_ENTRY)
+#undef VERIFIED_ENTRY
+};
+
+//! Première variante de chaque super-instruction
+static const uint8_t fused_firsts[NKINDS] = {
+#define FUSED_PAIR_FIRST(kind, first, second) [OP_##kind] = OP_##first,
+	FUSED_PAIRS(FUSED_PAIR_FIRST)
+#undef FUSED_PAIR_FIRST
+#define FUSED_TRIPLE_FIRST(kind, first, second, third) [OP_##kind] = OP_##first,
+	FUSED_TRIPLES(FUSED_TRIPLE_FIRST)
+#undef FUSED_TRIPLE_FIRST
+};
+
+//! Décalage d'une fonction d'exécution depuis instr_illop() (voir op_handler())
+static inline intptr_t handler_offset(Op_Handler handler){
+
+	return (uintptr_t) handler - (uintptr_t) instr_illop;
+}
+
+//! Variante associée à chaque code opération et mode d'adressage
+/*!
+ * Les colonnes sont, dans l'ordre : absolu, immédiat, indexé. Le mode
+ * immédiat est prioritaire sur le mode indexé, comme dans les fonctions
+ * d'exécution d'origine.
+ */
+static const uint8_t variants[HALT + 1][3] = {
+	[ILLOP] = {OP_ILLOP, OP_ILLOP, OP_ILLOP},
+	[NOP] = {OP_NOP, OP_NOP, OP_NOP},
+	[LOAD] = {OP_LOAD_ABS, OP_LOAD_IMM, OP_LOAD_IDX},
+	[STORE] = {OP_STORE_ABS, OP_ERR_IMMEDIATE, OP_STORE_IDX},
+	[ADD] = {OP_ADD_ABS, OP_ADD_IMM, OP_ADD_IDX},
+	[SUB] = {OP_SUB_ABS, OP_SUB_IMM, OP_SUB_IDX},
+	[BRANCH] = {OP_BRANCH_ABS, OP_ERR_IMMEDIATE, OP_BRANCH_IDX},
+	[CALL] = {OP_CALL_ABS, OP_ERR_IMMEDIATE, OP_CALL_IDX},
+	[RET] = {OP_RET, OP_RET, OP_RET},
+	[PUSH] = {OP_PUSH_ABS, OP_PUSH_IMM, OP_PUSH_IDX},
+	[POP] = {OP_POP_ABS, OP_ERR_IMMEDIATE, OP_POP_IDX},
+	[HALT] = {OP_HALT, OP_HALT, OP_HALT},
+};
+
+//! Conditions satisfaites, par condition : un bit par code condition
+static const uint8_t condition_masks[LE + 1] = {
+	[NC] = 1 << CC_U | 1 << CC_Z | 1 << CC_P | 1 << CC_N,
+	[EQ] = 1 << CC_Z,
+	[NE] = 1 << CC_P | 1 << CC_N,
+	[GT] = 1 << CC_P,
+	[GE] = 1 << CC_Z | 1 << CC_P,
+	[LT] = 1 << CC_N,
+	[LE] = 1 << CC_N | 1 << CC_Z,
+};
+
+//! Pré-décodage d'une instruction
+/*!
+ * Le choix de la variante (code opération et mode d'adressage) est fait une
+ * fois pour toutes : les fonctions d'exécution ne testent plus le mode. Les
+ * valeurs immédiates et les déplacements sont étendus en signe.
+ *
+ * \param op l'instruction pré-décodée à remplir
+ * \param instr l'instruction à décoder
+ */
+void decode_instruction(Micro_Op *op, Instruction instr){
+
+	unsigned cop = instr.instr_generic._cop;
+	unsigned mode;
+
+	op->_cop = cop;
+	op->_regcond = instr.instr_generic._regcond;
+	op->_rindex = 0;
+
+	if (instr.instr_generic._immediate == 1){ //!< Mode immédiat
+		mode = 1;
+		op->_operand = instr.instr_immediate._value;
+	} else if (instr.instr_generic._indexed == 1){ //!< Mode indexé
+		mode = 2;
+		op->_rindex = instr.instr_indexed._rindex;
+		op->_operand = instr.instr_indexed._offset;
+	} else { //!< Mode absolu
+		mode = 0;
+		op->_operand = instr.instr_absolute._address;
+	}
+
+	if (cop > LAST_COP){
+		op->_kind = OP_UNKNOWN;
+	} else {
+		op->_kind = variants[cop][mode];
+		if ((cop == BRANCH || cop == CALL) && op->_kind != OP_ERR_IMMEDIATE
+		    && op->_regcond > LAST_CONDITION){
+			op->_kind = OP_ERR_CONDITION;
+		}
+	}
+	op->_handler = handler_offset(handlers[op->_kind]);
+}
+
+//! Pré-décodage du segment de texte
+/*!
+ * \param pmach la machine dont on décode le programme
+ * \return faux si la mémoire manque
+ */
+bool decode_program(Machine *pmach){
+
+	void *ops;
+
+	if (posix_memalign(&ops, CACHE_LINE, (pmach->_textsize + 1) * sizeof(Micro_Op)) != 0){
+		pmach->_decoded = NULL;
+		return false;
+	}
+	pmach->_decoded = ops;
+
+	for (unsigned i = 0; i < pmach->_textsize; ++i){
+		decode_instruction(&pmach->_decoded[i], pmach->_text[i]);
+	}
+
+	Micro_Op *end = &pmach->_decoded[pmach->_textsize];
+	end->_operand = 0;
+	end->_cop = COP_END;
+	end->_regcond = 0;
+	end->_rindex = 0;
+	end->_kind = OP_END;
+	end->_handler = handler_offset(handlers[OP_END]);
+
+	fuse_program(pmach);
+	return true;
+}
+
+//! Noms des super-instructions, pour le rapport de fusion
+static const char *fused_names[NKINDS] = {
+#define FUSED_PAIR_NAME(kind, first, second) [OP_##kind] = #kind,
+	FUSED_PAIRS(FUSED_PAIR_NAME)
+#undef FUSED_PAIR_NAME
+#define FUSED_TRIPLE_NAME(kind, first, second, third) [OP_##kind] = #kind,
+	FUSED_TRIPLES(FUSED_TRIPLE_NAME)
+#undef FUSED_TRIPLE_NAME
+};
+
+//! Nombre d'instructions couvertes par chaque variante
+static const uint8_t fused_lengths[NKINDS] = {
+#define FUSED_PAIR_LENGTH(kind, first, second) [OP_##kind] = 2,
+	FUSED_PAIRS(FUSED_PAIR_LENGTH)
+#undef FUSED_PAIR_LENGTH
+#define FUSED_TRIPLE_LENGTH(kind, first, second, third) [OP_##kind] = 3,
+	FUSED_TRIPLES(FUSED_TRIPLE_LENGTH)
+#undef FUSED_TRIPLE_LENGTH
+};
+
+//! Variante de l'instruction \c i après fusion
+/*!
+ * \param ops le segment pré-décodé ; à partir de \c i, les variantes simples
+ * \param i l'adresse de l'instruction
+ * \param textsize la taille du segment de texte
+ * \return la super-instruction qui commence en \c i, ou sa variante simple
+ */
+static uint8_t fused_kind(const Micro_Op *ops, unsigned i, unsigned textsize){
+
+	unsigned left = textsize - i;
+	uint8_t kind = ops[i]._kind;	// reste inchangée tant qu'aucune suite ne correspond
+#define MATCH_TRIPLE(fkind, first, second, third) \
+	if (kind == ops[i]._kind && left >= 3 && ops[i]._kind == OP_##first \
+	    && ops[i + 1]._kind == OP_##second && ops[i + 2]._kind == OP_##third){ \
+		kind = OP_##fkind; \
+	}
+#define MATCH_PAIR(fkind, first, second) \
+	if (kind == ops[i]._kind && left >= 2 && ops[i]._kind == OP_##first \
+	    && ops[i + 1]._kind == OP_##second){ \
+		kind = OP_##fkind; \
+	}
+	FUSED_TRIPLES(MATCH_TRIPLE)
+	FUSED_PAIRS(MATCH_PAIR)
+#undef MATCH_TRIPLE
+#undef MATCH_PAIR
+	return kind;
+}
+
+//! Fusion des suites d'instructions fréquentes en super-instructions
+/*!
+ * Le segment est parcouru dans l'ordre : au moment où l'on examine
+ * l'instruction \c i, les suivantes ont encore leur variante simple.
+ *
+ * \param pmach la machine dont on fusionne le programme
+ * \return le nombre de super-instructions créées
+ */
+unsigned fuse_program(Machine *pmach){
+
+	Micro_Op *ops = pmach->_decoded;
+	unsigned fused = 0;
+
+	for (unsigned i = 0; i < pmach->_textsize; ++i){
+		uint8_t kind = fused_kind(ops, i, pmach->_textsize);
+		if (kind != ops[i]._kind){
+			ops[i]._kind = kind;
+			fused += 1;
+		}
+	}
+
+	return fused;
+}
+
+//! Rapport de fusion
+/*!
+ * \param pmach la machine en cours d'exécution
+ * \param dispatches le nombre d'aiguillages effectués par simul_threaded()
+ */
+void print_fusions(Machine *pmach, uint64_t dispatches){
+
+	unsigned sites[NKINDS] = {0};
+
+	for (unsigned i = 0; i < pmach->_textsize; ++i){
+		sites[pmach->_decoded[i]._kind] += 1;
+	}
+
+	fprintf(sim_output(), "\n*** FUSIONS ***\n");
+	for (unsigned kind = FIRST_FUSED_KIND; kind < NKINDS; ++kind){
+		if (sites[kind] != 0){
+			fprintf(sim_output(), "%-28s %u site(s), %u instructions\n",
+			       fused_names[kind], sites[kind], fused_lengths[kind]);
+		}
+	}
+	if (dispatches != 0){
+		fprintf(sim_output(), "%llu dispatches for %llu instructions (%llu removed)\n",
+		       (unsigned long long) dispatches, (unsigned long long) pmach->_icount,
+		       (unsigned long long) (pmach->_icount - dispatches));
+	}
+}
+
+//! Variante simple d'une instruction pré-décodée
+static inline uint8_t simple_kind(const Micro_Op *op){
+
+	return op->_kind < FIRST_FUSED_KIND ? op->_kind : fused_firsts[op->_kind];
+}
+
+//! Choix de la fonction d'exécution, avec ou sans vérification d'adresse
+/*!
+ * \param op l'instruction pré-décodée
+ * \param checked faux si l'adresse de l'opérande a été prouvée valide
+ */
+void set_checked(Micro_Op *op, bool checked){
+
+	uint8_t kind = simple_kind(op);
+
+	if (verified_handlers[kind] != NULL){
+		intptr_t handler = handler_offset(checked ? handlers[kind] : verified_handlers[kind]);
+		// Pas d'écriture inutile : la page d'un segment projeté reste partagée (voir textcache.h)
+		if (op->_handler != handler){
+			op->_handler = handler;
+		}
+	}
+}
+
+//! L'instruction s'exécute-t-elle sans vérification d'adresse ?
+/*!
+ * \param op l'instruction pré-décodée
+ * \return vrai si set_checked() l'a rendue à sa variante sans vérification
+ */
+bool op_verified(const Micro_Op *op){
+
+	uint8_t kind = simple_kind(op);
+
+	return verified_handlers[kind] != NULL && op->_handler == handler_offset(verified_handlers[kind]);
+}
+
+//! Une instruction pré-décodée lue hors du simulateur est-elle exécutable ?
+static bool op_valid(const Micro_Op *op){
+
+	if (op->_kind >= NKINDS || op->_rindex >= NREGISTERS || op->_regcond >= NREGISTERS){
+		return false;
+	}
+
+	uint8_t kind = simple_kind(op);
+
+	if ((kind == OP_BRANCH_ABS || kind == OP_BRANCH_IDX || kind == OP_CALL_ABS || kind == OP_CALL_IDX)
+	    && op->_regcond > LAST_CONDITION){
+		return false;
+	}
+	return op->_handler == handler_offset(handlers[kind])
+		|| (verified_handlers[kind] != NULL && op->_handler == handler_offset(verified_handlers[kind]));
+}
+
+//! La super-instruction en \c i est-elle suivie des instructions qu'elle exécute ?
+static bool group_valid(const Micro_Op *ops, unsigned i, unsigned textsize){
+
+	unsigned left = textsize - i;
+
+	switch (ops[i]._kind){
+#define PAIR_VALID(fkind, first, second) \
+	case OP_##fkind: \
+		return left >= 2 && simple_kind(&ops[i + 1]) == OP_##second;
+#define TRIPLE_VALID(fkind, first, second, third) \
+	case OP_##fkind: \
+		return left >= 3 && simple_kind(&ops[i + 1]) == OP_##second \
+			&& simple_kind(&ops[i + 2]) == OP_##third;
+	FUSED_PAIRS(PAIR_VALID)
+	FUSED_TRIPLES(TRIPLE_VALID)
+#undef PAIR_VALID
+#undef TRIPLE_VALID
+	default:
+		return true;
+	}
+}
+
+//! Un segment pré-décodé lu hors du simulateur est-il exécutable ?
+/*!
+ * \param ops le segment pré-décodé, sentinelle comprise
+ * \param textsize la taille du segment de texte
+ * \return vrai s'il peut être exécuté
+ */
+bool decoded_valid(const Micro_Op *ops, unsigned textsize){
+
+	for (unsigned i = 0; i < textsize; ++i){
+		if (!op_valid(&ops[i]) || ops[i]._kind == OP_END || !group_valid(ops, i, textsize)){
+			return false;
+		}
+	}
+	return ops[textsize]._kind == OP_END && ops[textsize]._cop == COP_END
+		&& ops[textsize]._handler == handler_offset(handlers[OP_END]);
+}
+
+//! Un segment pré-décodé lu hors du simulateur est-il celui d'un segment de texte ?
+/*!
+ * \param ops le segment pré-décodé, validé par decoded_valid()
+ * \param textsize la taille du segment de texte
+ * \param text le segment de texte
+ * \return vrai si decode_program() produirait les mêmes instructions
+ */
+bool decoded_matches(const Micro_Op *ops, unsigned textsize, const Instruction *text){
+
+	// Fenêtre des variantes simples des instructions i à i + 2, pour fused_kind()
+	Micro_Op window[3];
+
+	for (unsigned i = 0; i < textsize; ++i){
+		Micro_Op op;
+		decode_instruction(&op, text[i]);
+		if (op._cop != ops[i]._cop || op._regcond != ops[i]._regcond || op._rindex != ops[i]._rindex
+		    || op._operand != ops[i]._operand || op._kind != simple_kind(&ops[i])){
+			return false;
+		}
+		// Les suivantes sont comparées au texte à leur tour : leurs variantes simples suffisent
+		for (unsigned k = 0; k < 3 && i + k < textsize; ++k){
+			window[k]._kind = simple_kind(&ops[i + k]);
+		}
+		if (fused_kind(window, 0, textsize - i) != ops[i]._kind){
+			return false;
+		}
+	}
+	return true;
+}
+
+//! Empreinte du pré-décodage de cet exécutable
+/*!
+ * FNV-1a des tailles des tables et des décalages de toutes les fonctions
+ * d'exécution.
+ *
+ * \return l'empreinte
+ */
+uint32_t decode_fingerprint(void){
+
+	uint32_t hash = 2166136261u;
+	intptr_t words[2 * NKINDS + 2];
+	unsigned n = 0;
+
+	words[n++] = NKINDS;
+	words[n++] = sizeof(Micro_Op);
+	for (unsigned kind = 0; kind < NKINDS; ++kind){
+		words[n++] = handlers[kind] != NULL ? handler_offset(handlers[kind]) : 0;
+		words[n++] = verified_handlers[kind] != NULL ? handler_offset(verified_handlers[kind]) : 0;
+	}
+
+	const unsigned char *bytes = (const unsigned char *) words;
+	for (size_t i = 0; i < sizeof(words); ++i){
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
+}
 
 //! Décodage et exécution d'une instruction
 /*!
@@ -38,33 +450,80 @@ void check_adress_data(Machine *pmach, unsigned adress);
  */
 bool decode_execute(Machine *pmach, Instruction instr){
 
-	bool b = false;
-	switch (instr.instr_generic._cop){
-		case ILLOP : b = instr_illop(pmach, instr); break;
-		case NOP : b = instr_nop(pmach, instr); break;
-		case LOAD : b = instr_load(pmach, instr); break;
-		case STORE : b = instr_store(pmach, instr); break;
-		case ADD : b = instr_add(pmach, instr); break;
-		case SUB : b = instr_sub(pmach, instr); break;
-		case BRANCH : b = instr_branch(pmach, instr); break;
-		case CALL : b = instr_call(pmach, instr); break;
-		case RET : b = instr_ret(pmach, instr); break;
-		case PUSH : b = instr_push(pmach, instr); break;
-		case POP : b = instr_pop(pmach, instr); break;
-		case HALT : b = instr_halt(pmach, instr); break;
-		default : error_instruction(pmach, ERR_UNKNOWN); break;
-	}
-	return b;
+	Micro_Op op;
+	decode_instruction(&op, instr);
+	return op_handler(&op)(pmach, &op);
 }
 
-//! Exécution de ILLOP
+//! Paramètres de l'instruction exécutée par catch_error()
+typedef struct {
+	Machine *_pmach;
+	Instruction _instr;
+	bool _execute;
+} Execute_Args;
+
+//! Instruction exécutée par catch_error()
+static void run_instruction(void *arg){
+
+	Execute_Args *args = arg;
+	args->_execute = decode_execute(args->_pmach, args->_instr);
+}
+
+//! Décodage et exécution d'une instruction avec compte rendu d'erreur
 /*!
  * \param pmach la machine/programme en cours d'exécution
  * \param instr l'instruction à exécuter
+ * \return le compte rendu de l'exécution
+ */
+Run_Status decode_execute_run(Machine *pmach, Instruction instr){
+
+	Execute_Args args = {pmach, instr, true};
+	Run_Status status = {RUN_CONTINUE, ERR_NOERROR, 0};
+
+	if (!catch_error(run_instruction, &args, &status._err, &status._pc)){
+		status._state = RUN_ERROR;
+	} else if (!args._execute){
+		status._state = RUN_HALT;
+		status._pc = pmach->_pc - 1;
+	}
+	return status;
+}
+
+//! Adresse d'une instruction en mode absolu
+#define ADDRESS_ABS(pmach, op) ((unsigned) (op)->_operand)
+
+//! Adresse d'une instruction en mode indexé
+#define ADDRESS_IDX(pmach, op) ((pmach)->_registers[(op)->_rindex] + (op)->_operand)
+
+//! Définition des variantes absolue et indexée d'une instruction
+/*!
+ * L'instruction est décrite par la fonction \c name_at() qui reçoit
+ * l'adresse de son opérande ; les deux variantes ne diffèrent que par le
+ * calcul de cette adresse. Chacune existe aussi sans vérification de
+ * l'adresse (voir set_checked()).
+ */
+#define DEFINE_ADDRESSED(name) \
+	bool instr_##name##_abs(Machine *pmach, const Micro_Op *op){ \
+		return name##_at(pmach, op, ADDRESS_ABS(pmach, op), true); \
+	} \
+	bool instr_##name##_idx(Machine *pmach, const Micro_Op *op){ \
+		return name##_at(pmach, op, ADDRESS_IDX(pmach, op), true); \
+	} \
+	bool instr_##name##_abs_verified(Machine *pmach, const Micro_Op *op){ \
+		return name##_at(pmach, op, ADDRESS_ABS(pmach, op), false); \
+	} \
+	bool instr_##name##_idx_verified(Machine *pmach, const Micro_Op *op){ \
+		return name##_at(pmach, op, ADDRESS_IDX(pmach, op), false); \
+	}
+
+//! Exécution de ILLOP
+/*!
+ * \param pmach la machine/programme en cours d'exécution
+ * \param op l'instruction à exécuter
  * \return toujours FAUX
  * Interruption du programme
  */
-bool instr_illop(Machine *pmach, Instruction instr){
+bool instr_illop(Machine *pmach, const Micro_Op *op){
 	
 	error_instruction(pmach, ERR_NOERROR);
 	return false;
@@ -73,262 +532,338 @@ bool instr_illop(Machine *pmach, Instruction instr){
 //! Exécution de NOP
 /*!
  * \param pmach la machine/programme en cours d'exécution
- * \param instr l'instruction à exécuter
+ * \param op l'instruction à exécuter
  * \return toujours vrai
  * Ne rien faire
  */
-bool instr_nop(Machine *pmach, Instruction instr){
+bool instr_nop(Machine *pmach, const Micro_Op *op){
 	
 	return true;
 }
 
-//! Décodage et exécution de LOAD
+//! Exécution de LOAD en mode immédiat
 /*!
  * \param pmach la machine/programme en cours d'exécution
- * \param instr l'instruction à exécuter
+ * \param op l'instruction à exécuter
  * \return vrai
  */
-bool instr_load(Machine *pmach, Instruction instr){
+bool instr_load_imm(Machine *pmach, const Micro_Op *op){
 
-	check_index_register(pmach, instr.instr_generic._regcond);
+	pmach->_registers[op->_regcond] = op->_operand;
+	set_cc(pmach, pmach->_registers[op->_regcond]);
+	return true;
+}
 
-	if (instr.instr_generic._immediate == 0){ //!< Mode absolu
+//! Exécution de LOAD à une adresse donnée
+/*!
+ * \param pmach la machine/programme en cours d'exécution
+ * \param op l'instruction à exécuter
+ * \param addr l'adresse de l'opérande
+ * \param checked faux si l'adresse est prouvée valide
+ * \return vrai
+ */
+static inline bool load_at(Machine *pmach, const Micro_Op *op, unsigned addr, bool checked){
 
-		unsigned addr = calculate_adress(pmach, instr);
+	if (checked){
 		check_adress_data(pmach, addr);
-		pmach->_registers[instr.instr_generic._regcond] =  pmach->_data[addr];
-
-	} else { //!< Mode immédiat
-		pmach->_registers[instr.instr_generic._regcond] = instr.instr_immediate._value;
+	} else {
+		SYNC_MACHINE();
 	}
-	
-
-	set_cc(pmach, pmach->_registers[instr.instr_generic._regcond]);
+	pmach->_registers[op->_regcond] =  pmach->_data[addr];
+	set_cc(pmach, pmach->_registers[op->_regcond]);
 	return true;
 }
+DEFINE_ADDRESSED(load)
 
-//! Décodage et exécution de STORE
+//! Exécution de STORE à une adresse donnée
 /*!
  * \param pmach la machine/programme en cours d'exécution
- * \param instr l'instruction à exécuter
+ * \param op l'instruction à exécuter
+ * \param addr l'adresse de rangement
+ * \param checked faux si l'adresse est prouvée valide
  * \return vrai
  */
-bool instr_store(Machine *pmach, Instruction instr){
-
-	if (instr.instr_generic._immediate == 0){ //!< Mode absolu
+static inline bool store_at(Machine *pmach, const Micro_Op *op, unsigned addr, bool checked){
 
-		check_index_register(pmach, instr.instr_generic._regcond);
-		unsigned addr = calculate_adress(pmach, instr);
+	if (checked){
 		check_adress_data(pmach, addr);
 		if (addr >= pmach->_dataend){
 			error_instruction(pmach, ERR_SEGDATA);
 		}
-		pmach->_data[addr] = pmach->_registers[instr.instr_generic._regcond];
-
-	} else { //!< Instruction illégale
-		error_instruction(pmach, ERR_IMMEDIATE);
-
 	}
-	
+	write_data(pmach, addr, pmach->_registers[op->_regcond]);
 	return true;
 }
+DEFINE_ADDRESSED(store)
 
-//! Décodage et exécution de ADD
+//! Exécution de ADD en mode immédiat
 /*!
  * \param pmach la machine/programme en cours d'exécution
- * \param instr l'instruction à exécuter
+ * \param op l'instruction à exécuter
  * \return vrai
  */
-bool instr_add(Machine *pmach, Instruction instr){
-	
-	check_index_register(pmach, instr.instr_generic._regcond);
+bool instr_add_imm(Machine *pmach, const Micro_Op *op){
 
-	if (instr.instr_generic._immediate == 0){ //!< Mode absolu
+	pmach->_registers[op->_regcond] += op->_operand;
+	set_cc(pmach, pmach->_registers[op->_regcond]);
+	return true;
+}
 
-		unsigned addr = calculate_adress(pmach, instr);
-		check_adress_data(pmach, addr);
-		pmach->_registers[instr.instr_generic._regcond] += pmach->_data[addr];
+//! Exécution de ADD à une adresse donnée
+/*!
+ * \param pmach la machine/programme en cours d'exécution
+ * \param op l'instruction à exécuter
+ * \param addr l'adresse de l'opérande
+ * \param checked faux si l'adresse est prouvée valide
+ * \return vrai
+ */
+static inline bool add_at(Machine *pmach, const Micro_Op *op, unsigned addr, bool checked){
 
-	} else { //!< Mode immédiat
-		pmach->_registers[instr.instr_generic._regcond] += instr.instr_immediate._value;
+	if (checked){
+		check_adress_data(pmach, addr);
+	} else {
+		SYNC_MACHINE();
 	}
-
-	set_cc(pmach, pmach->_registers[instr.instr_generic._regcond]);
+	pmach->_registers[op->_regcond] += pmach->_data[addr];
+	set_cc(pmach, pmach->_registers[op->_regcond]);
 	return true;
 }
+DEFINE_ADDRESSED(add)
 
-//! Décodage et exécution de SUB
+//! Exécution de SUB en mode immédiat
 /*!
  * \param pmach la machine/programme en cours d'exécution
- * \param instr l'instruction à exécuter
+ * \param op l'instruction à exécuter
  * \return vrai
  */
-bool instr_sub(Machine *pmach, Instruction instr){
+bool instr_sub_imm(Machine *pmach, const Micro_Op *op){
 
-	check_index_register(pmach, instr.instr_generic._regcond);
- 
-	if (instr.instr_generic._immediate == 0){ //!< Mode absolu
+	pmach->_registers[op->_regcond] -= op->_operand;
+	set_cc(pmach, pmach->_registers[op->_regcond]);
+	return true;
+}
 
-		unsigned addr = calculate_adress(pmach, instr);
-		check_adress_data(pmach, addr);
-		pmach->_registers[instr.instr_generic._regcond] -= pmach->_data[addr];
+//! Exécution de SUB à une adresse donnée
+/*!
+ * \param pmach la machine/programme en cours d'exécution
+ * \param op l'instruction à exécuter
+ * \param addr l'adresse de l'opérande
+ * \param checked faux si l'adresse est prouvée valide
+ * \return vrai
+ */
+static inline bool sub_at(Machine *pmach, const Micro_Op *op, unsigned addr, bool checked){
 
-	} else { //!< Mode immédiat
-		pmach->_registers[instr.instr_generic._regcond] -= instr.instr_immediate._value;
+	if (checked){
+		check_adress_data(pmach, addr);
+	} else {
+		SYNC_MACHINE();
 	}
-
-	set_cc(pmach, pmach->_registers[instr.instr_generic._regcond]);
+	pmach->_registers[op->_regcond] -= pmach->_data[addr];
+	set_cc(pmach, pmach->_registers[op->_regcond]);
 	return true;
 }
+DEFINE_ADDRESSED(sub)
 
-//! Décodage et exécution de BRANCH
+//! Exécution de BRANCH vers une adresse donnée
 /*!
  * \param pmach la machine/programme en cours d'exécution
- * \param instr l'instruction à exécuter
+ * \param op l'instruction à exécuter
+ * \param addr l'adresse de branchement
+ * \param checked faux si l'adresse est prouvée valide
  * \return vrai
  */
-bool instr_branch(Machine *pmach, Instruction instr){
+static inline bool branch_at(Machine *pmach, const Micro_Op *op, unsigned addr, bool checked){
 	
-	if (instr.instr_generic._immediate == 0){ //!< Mode absolu
-		if (cmp_op(pmach, instr)){ //!< Verification condition
-			unsigned addr = calculate_adress(pmach, instr);
-			if (addr < 0 || addr >= pmach->_textsize){ //!< Verification emplacement pc
-				error_instruction(pmach, ERR_SEGTEXT); 
-			}			
-			pmach->_pc = addr;
-		}
-	} else { //!< Instruction illégale
-		error_instruction(pmach, ERR_IMMEDIATE);
+	if (cmp_op(pmach, op)){ //!< Verification condition
+		if (checked && addr >= pmach->_textsize){ //!< Verification emplacement pc
+			error_instruction(pmach, ERR_SEGTEXT); 
+		}			
+		count_jump(pmach, addr);
+		pmach->_pc = addr;
 	}
-
 	return true;
 }
+DEFINE_ADDRESSED(branch)
 
-//! Décodage et exécution de CALL
+//! Exécution de CALL vers une adresse donnée
 /*!
  * \param pmach la machine/programme en cours d'exécution
- * \param instr l'instruction à exécuter
+ * \param op l'instruction à exécuter
+ * \param addr l'adresse du sous-programme
+ * \param checked faux si l'adresse est prouvée valide
  * \return vrai
  */
-bool instr_call(Machine *pmach, Instruction instr){
-
-	if (instr.instr_generic._immediate == 0){ //!< Mode absolu
-		if (cmp_op(pmach, instr)){ //!< Verification condition
-			check_sp(pmach, pmach->_sp);
-			unsigned addr = calculate_adress(pmach, instr);
-			pmach->_data[pmach->_sp] = pmach->_pc;
-			pmach->_sp -= 1;
-			if (addr < 0 || addr >= pmach->_textsize){ //!< Verification emplacement pc
-				error_instruction(pmach, ERR_SEGTEXT); 
-			}
-			pmach->_pc = addr;
+static inline bool call_at(Machine *pmach, const Micro_Op *op, unsigned addr, bool checked){
+
+	if (cmp_op(pmach, op)){ //!< Verification condition
+		check_sp(pmach, pmach->_sp);
+		write_data(pmach, pmach->_sp, pmach->_pc);
+		pmach->_sp -= 1;
+		pmach->_depth += 1;
+		count_push(pmach);
+		if (checked && addr >= pmach->_textsize){ //!< Verification emplacement pc
+			error_instruction(pmach, ERR_SEGTEXT); 
 		}
-	} else { //!< Instruction illégale
-		error_instruction(pmach, ERR_IMMEDIATE);
+		count_jump(pmach, addr);
+		pmach->_pc = addr;
 	}
-
 	return true;
 }
+DEFINE_ADDRESSED(call)
 
 //! Décodage et exécution de RET
 /*!
  * \param pmach la machine/programme en cours d'exécution
- * \param instr l'instruction à exécuter
+ * \param op l'instruction à exécuter
  * \return vrai
  */
-bool instr_ret(Machine *pmach, Instruction instr){
+bool instr_ret(Machine *pmach, const Micro_Op *op){
 	
 	check_sp(pmach, pmach->_sp + 1);
 	pmach->_sp += 1;
-	pmach->_pc = pmach->_data[pmach->_sp];
+	unsigned addr = pmach->_data[pmach->_sp];
+	count_jump(pmach, addr < pmach->_textsize ? addr : pmach->_textsize);
+	pmach->_pc = addr;
+	pmach->_depth -= 1;
 	return true;
 }
 
-//! Décodage et exécution de PUSH
+//! Exécution de PUSH en mode immédiat
 /*!
  * \param pmach la machine/programme en cours d'exécution
- * \param instr l'instruction à exécuter
+ * \param op l'instruction à exécuter
  * \return vrai
  */
-bool instr_push(Machine *pmach, Instruction instr){
+bool instr_push_imm(Machine *pmach, const Micro_Op *op){
 
 	check_sp(pmach, pmach->_sp);
+	write_data(pmach, pmach->_sp, op->_operand);
+	check_sp(pmach, pmach->_sp - 1);
+	pmach->_sp -= 1;
+	count_push(pmach);
+	return true;
+}
 
-	if (instr.instr_generic._immediate == 0){ //!< Mode absolu
+//! Exécution de PUSH depuis une adresse donnée
+/*!
+ * \param pmach la machine/programme en cours d'exécution
+ * \param op l'instruction à exécuter
+ * \param addr l'adresse de la valeur à empiler
+ * \param checked faux si l'adresse est prouvée valide
+ * \return vrai
+ */
+static inline bool push_at(Machine *pmach, const Micro_Op *op, unsigned addr, bool checked){
 
-		unsigned addr = calculate_adress(pmach, instr);
+	check_sp(pmach, pmach->_sp);
+	if (checked){
 		check_adress_data(pmach, addr);
-		pmach->_data[pmach->_sp] = pmach->_data[addr];
-
-	} else { //!< Mode immediat
-
-		pmach->_data[pmach->_sp] = instr.instr_immediate._value;
-
+	} else {
+		SYNC_MACHINE();
 	}
-
+	write_data(pmach, pmach->_sp, pmach->_data[addr]);
 	check_sp(pmach, pmach->_sp - 1);
 	pmach->_sp -= 1;
+	count_push(pmach);
 	return true;
 }
+DEFINE_ADDRESSED(push)
 
-//! Décodage et exécution de POP
+//! Exécution de POP vers une adresse donnée
 /*!
  * \param pmach la machine/programme en cours d'exécution
- * \param instr l'instruction à exécuter
+ * \param op l'instruction à exécuter
+ * \param addr l'adresse de rangement
+ * \param checked faux si l'adresse est prouvée valide
  * \return vrai
  */
-bool instr_pop(Machine *pmach, Instruction instr){
+static inline bool pop_at(Machine *pmach, const Micro_Op *op, unsigned addr, bool checked){
 
-	if (instr.instr_generic._immediate == 1){ //!< Instruction illégale
-		error_instruction(pmach, ERR_IMMEDIATE);
+	if (checked){
+		check_adress_data(pmach, addr);
 	}
-
-	unsigned addr = calculate_adress(pmach, instr);
-	check_adress_data(pmach, addr);
 	check_sp(pmach, pmach->_sp + 1);
 	pmach->_sp += 1;
-	if (addr >= pmach->_dataend){
+	if (checked && addr >= pmach->_dataend){
 		error_instruction(pmach, ERR_SEGDATA);
 	}
-	pmach->_data[addr] = pmach->_data[pmach->_sp];
-
+	write_data(pmach, addr, pmach->_data[pmach->_sp]);
 	return true;
 }
+DEFINE_ADDRESSED(pop)
 
 //! Décodage et exécution de HALT
 /*!
  * \param pmach la machine/programme en cours d'exécution
- * \param instr l'instruction à exécuter
+ * \param op l'instruction à exécuter
  * \return faux
  */
-bool instr_halt(Machine *pmach, Instruction instr){
+bool instr_halt(Machine *pmach, const Micro_Op *op){
 	warning(WARN_HALT, pmach->_pc-1);
 	return false;
 }
 
-//! Verification du code operande
+//! Valeur immédiate interdite (STORE, BRANCH, CALL, POP)
 /*!
  * \param pmach la machine/programme en cours d'exécution
- * \param instr l'instruction à exécuter
- * \return vrai si cc respecte la condition; faux sinon
+ * \param op l'instruction à exécuter
+ * \return faux
  */
-bool cmp_op(Machine *pmach, Instruction instr){
+bool instr_err_immediate(Machine *pmach, const Micro_Op *op){
+	error_instruction(pmach, ERR_IMMEDIATE);
+	return false;
+}
 
-	bool b = false;
-	int cc = pmach->_cc;
+//! Condition invalide (BRANCH, CALL)
+/*!
+ * \param pmach la machine/programme en cours d'exécution
+ * \param op l'instruction à exécuter
+ * \return faux
+ */
+bool instr_err_condition(Machine *pmach, const Micro_Op *op){
+	error_instruction(pmach, ERR_CONDITION);
+	return false;
+}
 
-	switch (instr.instr_generic._regcond){	
-		case NC : b = true; break; //!< Résultat quelconque
-		case EQ : b = (cc == CC_Z) ? true : false; break; //!< Résultat nul
-		case NE : b = (cc == CC_P || cc == CC_N) ? true : false; break; //!< Résultat différent de 0
-		case GT : b = (cc == CC_P) ? true : false; break; //!< Résultat positif
-		case GE : b = (cc == CC_Z || cc == CC_P) ? true : false; break; //!< Résultat positif ou nul
-		case LT : b = (cc == CC_N) ? true : false; break; //!< Résultat négatif
-		case LE : b = (cc == CC_N || cc == CC_Z) ? true : false; break; //!< Résultat négatif ou nul
-		default : error_instruction(pmach, ERR_CONDITION); break;
-	}
+//! Code opération inconnu
+/*!
+ * \param pmach la machine/programme en cours d'exécution
+ * \param op l'instruction à exécuter
+ * \return faux
+ */
+bool instr_unknown(Machine *pmach, const Micro_Op *op){
+	error_instruction(pmach, ERR_UNKNOWN);
+	return false;
+}
+
+//! Sortie du segment de texte
+/*!
+ * Exécutée quand le compteur ordinal atteint la sentinelle placée après la
+ * dernière instruction. L'erreur est signalée à l'adresse de la sentinelle,
+ * comme le fait simul(), et la sentinelle n'est pas comptée comme une
+ * instruction exécutée.
+ *
+ * \param pmach la machine/programme en cours d'exécution
+ * \param op la sentinelle
+ * \return faux
+ */
+bool instr_end(Machine *pmach, const Micro_Op *op){
+	pmach->_icount -= 1;
+	error(ERR_SEGTEXT, pmach->_pc - 1);
+	return false;
+}
+
+//! Verification du code operande
+/*!
+ * La validité de la condition a été vérifiée au décodage (voir
+ * instr_err_condition()).
+ *
+ * \param pmach la machine/programme en cours d'exécution
+ * \param op l'instruction à exécuter
+ * \return vrai si cc respecte la condition; faux sinon
+ */
+bool cmp_op(Machine *pmach, const Micro_Op *op){
 
-	return b;		
+	return (condition_masks[op->_regcond] >> pmach->_cc) & 1;
 }
 
 //! Assignation du code operande
@@ -347,37 +882,6 @@ void set_cc(Machine *pmach, Word value){
 	}
 }
 
-//! Calcule l'adresse en fonction de l'instruction
-/*!
- * \param pmach la machine/programme en cours d'exécution
- * \param instr l'instruction à exécuter
- * \return l'adresse
- * on suppose que instr.instr_generic._immediate = 0
- */
-unsigned calculate_adress(Machine *pmach, Instruction instr){
-	
-	unsigned addr;
-	if (instr.instr_generic._indexed == 1){ //!< Mode indexé
-		check_index_register(pmach, instr.instr_indexed._rindex);
-		addr = pmach->_registers[instr.instr_indexed._rindex]+instr.instr_indexed._offset;
-	} else { //!< Mode absolu
-		addr = instr.instr_absolute._address;
-	}
-
-	return addr;
-}
-
-//! Verifie que l'on accede pas à un registre inconnu
-/*!
- * \param pmach la machine/programme en cours d'exécution
- * \param index l'indexe du registre à acceder
- */
-void check_index_register(Machine *pmach, int index){
-	if (index<0 || index > (NREGISTERS-1)){
-		error_instruction(pmach, ERR_ILLEGAL);
-	} 
-}
-
 //! Verifie que l'on accede pas en dehors de la pile, ou que la pile est pleine
 /*!
  * \param pmach la machine/programme en cours d'exécution
@@ -395,11 +899,27 @@ void check_sp(Machine *pmach, int sp){
  * \param sp l'adresse de la memoire à acceder
  */
 void check_adress_data(Machine *pmach, unsigned adress){
-	if (adress < 0 || adress >= pmach->_datasize){
+	if (adress >= pmach->_datasize){
 		error_instruction(pmach, ERR_SEGDATA);
 	}
 }
 
+//! Ecriture dans le segment de données
+/*!
+ * La page écrite est marquée modifiée si les pages sont suivies (voir
+ * checkpoint.h).
+ *
+ * \param pmach la machine/programme en cours d'exécution
+ * \param adress l'adresse à écrire
+ * \param value la valeur écrite
+ */
+void write_data(Machine *pmach, unsigned adress, Word value){
+	pmach->_data[adress] = value;
+	if (pmach->_dirty != NULL){
+		pmach->_dirty[adress / DATA_PAGE_WORDS] = 1;
+	}
+}
+
 //! Instruction illégale
 /*!
  * Affiche l'instruction illégale
@@ -410,6 +930,221 @@ void error_instruction(Machine *pmach, Error err){
 	error(err, pmach->_pc);
 }
 
+//! Exécution d'une variante connue à la compilation
+/*!
+ * Appelée avec une variante constante, la fonction se réduit à l'appel (en
+ * ligne) de la fonction d'exécution de cette variante.
+ *
+ * \param kind la variante
+ * \param pmach la machine/programme en cours d'exécution
+ * \param op l'instruction à exécuter
+ * \return faux après l'exécution de \c HALT ; vrai sinon
+ */
+static inline bool execute_variant(Op_Kind kind, Machine *pmach, const Micro_Op *op){
+
+	switch (kind){
+#define VARIANT_CASE(kind, name) case OP_##kind: return instr_##name(pmach, op);
+		OP_KINDS(VARIANT_CASE)
+#undef VARIANT_CASE
+		default: return false;
+	}
+}
+
+//! Exécution sans vérification d'adresse d'une variante connue à la compilation
+/*!
+ * Comme execute_variant(), pour une instruction prouvée sûre : les variantes
+ * sans vérification d'adresse s'exécutent comme à l'ordinaire.
+ *
+ * \param kind la variante
+ * \param pmach la machine/programme en cours d'exécution
+ * \param op l'instruction à exécuter
+ * \return faux après l'exécution de \c HALT ; vrai sinon
+ */
+static inline bool execute_verified(Op_Kind kind, Machine *pmach, const Micro_Op *op){
+
+	switch (kind){
+#define VERIFIED_CASE(kind, name) case OP_##kind: return instr_##name##_verified(pmach, op);
+		CHECKED_KINDS(VERIFIED_CASE)
+#undef VERIFIED_CASE
+		default: return execute_variant(kind, pmach, op);
+	}
+}
+
+#ifdef THREADED_CODE
+//! Toutes les instructions du groupe qui commence en \c i sont-elles sans vérification d'adresse ?
+static bool verified_group(const Micro_Op *ops, unsigned i){
+
+	unsigned length = ops[i]._kind < FIRST_FUSED_KIND ? 1 : fused_lengths[ops[i]._kind];
+
+	for (unsigned j = i; j < i + length; ++j){
+		uint8_t kind = simple_kind(&ops[j]);
+		if (verified_handlers[kind] != NULL && ops[j]._handler != handler_offset(verified_handlers[kind])){
+			return false;
+		}
+	}
+	return true;
+}
+#endif
+
+//! Simulation par code \e threadé
+/*!
+ * Le tableau \c code associe à chaque instruction pré-décodée (sentinelle
+ * comprise) l'étiquette du code de sa variante. Il est alloué à la première
+ * exécution du programme chargé et libéré par free_program() : une erreur
+ * rattrapée par catch_error() ne le perd pas. Seul \c RET peut placer le
+ * compteur ordinal au-delà de la sentinelle : c'est la seule instruction
+ * après laquelle on vérifie le compteur ordinal.
+ *
+ * Une super-instruction exécute les instructions de son groupe l'une après
+ * l'autre en avançant le compteur ordinal entre chacune : les erreurs sont
+ * signalées à la même adresse que sans fusion.
+ *
+ * Un groupe dont toutes les adresses ont été prouvées valides (voir
+ * set_checked()) a sa propre étiquette, sans vérification d'adresse. Le
+ * repli sur un \c switch garde toujours les vérifications.
+ *
+ * \param pmach la machine en cours d'exécution
+ * \return le nombre d'aiguillages effectués
+ */
+uint64_t simul_threaded(Machine *pmach){
+
+	Micro_Op *ops = pmach->_decoded;
+	const Micro_Op *op;
+	uint64_t dispatches = 0;
+
+#ifdef THREADED_CODE
+	static void *const labels[NKINDS] = {
+#	define LABEL_ENTRY(kind, name) [OP_##kind] = &&do_##kind,
+		OP_KINDS(LABEL_ENTRY)
+#	undef LABEL_ENTRY
+#	define FUSED_PAIR_LABEL(kind, first, second) [OP_##kind] = &&do_##kind,
+		FUSED_PAIRS(FUSED_PAIR_LABEL)
+#	undef FUSED_PAIR_LABEL
+#	define FUSED_TRIPLE_LABEL(kind, first, second, third) [OP_##kind] = &&do_##kind,
+		FUSED_TRIPLES(FUSED_TRIPLE_LABEL)
+#	undef FUSED_TRIPLE_LABEL
+	};
+	static void *const verified_labels[NKINDS] = {
+#	define VERIFIED_LABEL(kind, name) [OP_##kind] = &&verified_##kind,
+		CHECKED_KINDS(VERIFIED_LABEL)
+#	undef VERIFIED_LABEL
+#	define FUSED_PAIR_VERIFIED(kind, first, second) [OP_##kind] = &&verified_##kind,
+		FUSED_PAIRS(FUSED_PAIR_VERIFIED)
+#	undef FUSED_PAIR_VERIFIED
+#	define FUSED_TRIPLE_VERIFIED(kind, first, second, third) [OP_##kind] = &&verified_##kind,
+		FUSED_TRIPLES(FUSED_TRIPLE_VERIFIED)
+#	undef FUSED_TRIPLE_VERIFIED
+	};
+	// Le tableau appartient à la machine : une erreur quitte la boucle par longjmp() (catch_error())
+	if (pmach->_threaded == NULL){
+		pmach->_threaded = malloc((pmach->_textsize + 1) * sizeof(void *));
+		if (pmach->_threaded == NULL){
+			error(ERR_MEMORY, pmach->_pc);
+		}
+	}
+	void **code = pmach->_threaded;
+
+	for (unsigned i = 0; i <= pmach->_textsize; ++i){
+		uint8_t kind = ops[i]._kind;
+		code[i] = verified_labels[kind] != NULL && verified_group(ops, i) ? verified_labels[kind] : labels[kind];
+	}
+
+#	define CASE(kind) do_##kind:
+#	define NEXT() do { \
+		op = &ops[pmach->_pc++]; \
+		pmach->_icount += 1; \
+		dispatches += 1; \
+		goto *code[op - ops]; \
+	} while (0)
+
+	NEXT();
+#else
+#	define CASE(kind) case OP_##kind:
+#	define NEXT() continue
+
+	for (;;){
+		op = &ops[pmach->_pc++];
+		pmach->_icount += 1;
+		dispatches += 1;
+		switch (op->_kind){
+#endif
+#define THREADED_VARIANT(kind, name) \
+	CASE(kind) \
+		if (!instr_##name(pmach, op)){ \
+			goto out; \
+		} \
+		if (OP_##kind == OP_RET && pmach->_pc >= pmach->_textsize){ \
+			error(ERR_SEGTEXT, pmach->_pc); \
+		} \
+		NEXT();
+
+#define STEP(kind) \
+		execute_variant(OP_##kind, pmach, op); \
+		op = &ops[pmach->_pc++]; \
+		pmach->_icount += 1;
+#define THREADED_PAIR(kind, first, second) \
+	CASE(kind) \
+		STEP(first) \
+		execute_variant(OP_##second, pmach, op); \
+		NEXT();
+#define THREADED_TRIPLE(kind, first, second, third) \
+	CASE(kind) \
+		STEP(first) \
+		STEP(second) \
+		execute_variant(OP_##third, pmach, op); \
+		NEXT();
+
+	OP_KINDS(THREADED_VARIANT)
+	FUSED_PAIRS(THREADED_PAIR)
+	FUSED_TRIPLES(THREADED_TRIPLE)
+
+#ifdef THREADED_CODE
+#	define VERIFIED_VARIANT(kind, name) \
+	verified_##kind: \
+		instr_##name##_verified(pmach, op); \
+		NEXT();
+#	define VERIFIED_STEP(kind) \
+		execute_verified(OP_##kind, pmach, op); \
+		op = &ops[pmach->_pc++]; \
+		pmach->_icount += 1;
+#	define VERIFIED_PAIR(kind, first, second) \
+	verified_##kind: \
+		VERIFIED_STEP(first) \
+		execute_verified(OP_##second, pmach, op); \
+		NEXT();
+#	define VERIFIED_TRIPLE(kind, first, second, third) \
+	verified_##kind: \
+		VERIFIED_STEP(first) \
+		VERIFIED_STEP(second) \
+		execute_verified(OP_##third, pmach, op); \
+		NEXT();
+
+	CHECKED_KINDS(VERIFIED_VARIANT)
+	FUSED_PAIRS(VERIFIED_PAIR)
+	FUSED_TRIPLES(VERIFIED_TRIPLE)
+
+#	undef VERIFIED_VARIANT
+#	undef VERIFIED_PAIR
+#	undef VERIFIED_TRIPLE
+#	undef VERIFIED_STEP
+#endif
+
+#ifndef THREADED_CODE
+		}
+	}
+#endif
+
+#undef THREADED_VARIANT
+#undef THREADED_PAIR
+#undef THREADED_TRIPLE
+#undef STEP
+#undef CASE
+#undef NEXT
+
+out:
+	return dispatches;
+}
+
 //! Trace de l'exécution
 /*!
  * On écrit l'adresse et l'instruction sous forme lisible.
@@ -421,7 +1156,22 @@ void error_instruction(Machine *pmach, Error err){
  */
 void trace(const char *msg, Machine *pmach, Instruction instr, unsigned addr){
 	
-	printf("TRACE: %s: 0x%.4x: ", msg, (uint32_t)addr);
+	if (async_active()){
+		async_trace(msg, instr, addr);
+	} else {
+		print_trace(msg, instr, addr);
+	}
+}
+
+//! Affichage d'une ligne de trace
+/*!
+ * \param msg le message de trace
+ * \param instr l'instruction à exécuter
+ * \param addr son adresse
+ */
+void print_trace(const char *msg, Instruction instr, unsigned addr){
+	
+	fprintf(sim_output(), "TRACE: %s: 0x%.4x: ", msg, (uint32_t)addr);
 	print_instruction(instr, addr);
-	printf("\n");
+	fprintf(sim_output(), "\n");
 }
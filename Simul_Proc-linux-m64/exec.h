@@ -6,8 +6,246 @@
  * \brief Exécution d'une instruction.
  */
 
+#include <stdint.h>
+
 #include "machine.h"
 
+//! Variantes des instructions pré-décodées
+/*!
+ * Chaque code opération est décliné en une variante par mode d'adressage
+ * légal (\c _IMM immédiat, \c _ABS absolu, \c _IDX indexé). Les
+ * combinaisons illégales (valeur immédiate interdite, condition invalide,
+ * code opération inconnu) ont chacune leur variante qui signale l'erreur à
+ * l'exécution. \c END est la sentinelle placée après le segment de texte.
+ *
+ * X(variante, nom de la fonction d'exécution sans le préfixe \c instr_)
+ */
+#define OP_KINDS(X) \
+    X(ILLOP, illop) \
+    X(NOP, nop) \
+    X(LOAD_IMM, load_imm) \
+    X(LOAD_ABS, load_abs) \
+    X(LOAD_IDX, load_idx) \
+    X(STORE_ABS, store_abs) \
+    X(STORE_IDX, store_idx) \
+    X(ADD_IMM, add_imm) \
+    X(ADD_ABS, add_abs) \
+    X(ADD_IDX, add_idx) \
+    X(SUB_IMM, sub_imm) \
+    X(SUB_ABS, sub_abs) \
+    X(SUB_IDX, sub_idx) \
+    X(BRANCH_ABS, branch_abs) \
+    X(BRANCH_IDX, branch_idx) \
+    X(CALL_ABS, call_abs) \
+    X(CALL_IDX, call_idx) \
+    X(RET, ret) \
+    X(PUSH_IMM, push_imm) \
+    X(PUSH_ABS, push_abs) \
+    X(PUSH_IDX, push_idx) \
+    X(POP_ABS, pop_abs) \
+    X(POP_IDX, pop_idx) \
+    X(HALT, halt) \
+    X(ERR_IMMEDIATE, err_immediate) \
+    X(ERR_CONDITION, err_condition) \
+    X(UNKNOWN, unknown) \
+    X(END, end)
+
+//! Super-instructions : paires d'instructions consécutives fusionnées
+/*!
+ * X(super-instruction, première variante, seconde variante)
+ *
+ * Seule la dernière instruction d'un groupe peut modifier le compteur
+ * ordinal (\c BRANCH, \c CALL) ; aucune ne peut arrêter le programme.
+ */
+#define FUSED_PAIRS(X) \
+    X(SUB_IMM_BRANCH_ABS, SUB_IMM, BRANCH_ABS) \
+    X(ADD_IMM_BRANCH_ABS, ADD_IMM, BRANCH_ABS) \
+    X(LOAD_ABS_ADD_ABS, LOAD_ABS, ADD_ABS) \
+    X(LOAD_IDX_ADD_IDX, LOAD_IDX, ADD_IDX) \
+    X(LOAD_IDX_LOAD_IDX, LOAD_IDX, LOAD_IDX) \
+    X(ADD_IDX_SUB_IMM, ADD_IDX, SUB_IMM) \
+    X(PUSH_ABS_PUSH_ABS, PUSH_ABS, PUSH_ABS)
+
+//! Super-instructions : triplets d'instructions consécutives fusionnés
+/*!
+ * X(super-instruction, première, deuxième et troisième variantes)
+ */
+#define FUSED_TRIPLES(X) \
+    X(ADD_IDX_SUB_IMM_BRANCH_ABS, ADD_IDX, SUB_IMM, BRANCH_ABS) \
+    X(PUSH_ABS_PUSH_ABS_CALL_ABS, PUSH_ABS, PUSH_ABS, CALL_ABS) \
+    X(LOAD_IDX_LOAD_IDX_SUB_IMM, LOAD_IDX, LOAD_IDX, SUB_IMM)
+
+//! Variante d'une instruction pré-décodée
+typedef enum
+{
+#define OP_KIND_ENUM(kind, name) OP_##kind,
+    OP_KINDS(OP_KIND_ENUM)
+#undef OP_KIND_ENUM
+#define FUSED_PAIR_ENUM(kind, first, second) OP_##kind,
+    FUSED_PAIRS(FUSED_PAIR_ENUM)
+#undef FUSED_PAIR_ENUM
+#define FUSED_TRIPLE_ENUM(kind, first, second, third) OP_##kind,
+    FUSED_TRIPLES(FUSED_TRIPLE_ENUM)
+#undef FUSED_TRIPLE_ENUM
+    NKINDS		//!< Nombre de variantes, super-instructions comprises
+} Op_Kind;
+
+//! Première super-instruction : les variantes simples la précèdent
+#define FIRST_FUSED_KIND (OP_END + 1)
+
+//! Code opération de la sentinelle placée après la fin du segment de texte
+#define COP_END 0xff
+
+struct Micro_Op;
+
+//! Fonction d'exécution d'une instruction pré-décodée
+/*!
+ * \param pmach la machine/programme en cours d'exécution
+ * \param op l'instruction pré-décodée à exécuter
+ * \return faux après l'exécution de \c HALT ; vrai sinon
+ */
+typedef bool (*Op_Handler)(Machine *pmach, const struct Micro_Op *op);
+
+//! Fonction d'exécution de \c ILLOP, origine des décalages \c _handler
+bool instr_illop(Machine *pmach, const struct Micro_Op *op);
+
+//! Instruction pré-décodée
+/*!
+ * Les champs de bits de l'\link Instruction \endlink sont extraits une seule
+ * fois, au chargement du programme : on conserve la fonction d'exécution
+ * spécialisée pour le code opération et le mode d'adressage, et les
+ * opérandes déjà dépaquetés. La structure occupe 16 octets, soit 4
+ * instructions par ligne de cache.
+ *
+ * La fonction d'exécution est notée par son décalage depuis instr_illop()
+ * (voir op_handler()) : le segment pré-décodé ne contient aucune adresse,
+ * ne dépend que de l'exécutable et non de l'adresse où il est chargé, et
+ * peut être projeté tel quel depuis un fichier (voir textcache.h).
+ *
+ * \c _handler exécute toujours l'instruction seule ; \c _kind peut désigner
+ * une super-instruction (voir fuse_program()), utilisée uniquement par
+ * simul_threaded().
+ */
+typedef struct Micro_Op
+{
+    intptr_t _handler;		//!< Fonction d'exécution, en décalage depuis instr_illop()
+    int32_t _operand;		//!< Valeur immédiate ou déplacement (étendus en signe), ou adresse absolue
+    uint8_t _cop;		//!< Code opération
+    uint8_t _regcond;		//!< Numéro de registre ou condition
+    uint8_t _rindex;		//!< Numéro du registre d'index
+    uint8_t _kind;		//!< Variante (\link Op_Kind \endlink)
+} Micro_Op;
+
+//! Fonction d'exécution d'une instruction pré-décodée
+static inline Op_Handler op_handler(const Micro_Op *op)
+{
+    return (Op_Handler) ((uintptr_t) instr_illop + op->_handler);
+}
+
+//! Pré-décodage d'une instruction
+/*!
+ * \param op l'instruction pré-décodée à remplir
+ * \param instr l'instruction à décoder
+ */
+void decode_instruction(Micro_Op *op, Instruction instr);
+
+//! Pré-décodage du segment de texte
+/*!
+ * Construit le tableau \c _decoded de la machine à partir de son segment de
+ * texte. Le tableau est aligné sur une ligne de cache et se termine par une
+ * sentinelle (code \c COP_END) qui signale la sortie du segment de texte.
+ * Les super-instructions sont ensuite créées par fuse_program().
+ *
+ * \param pmach la machine dont on décode le programme
+ * \return faux si la mémoire manque (\c _decoded vaut alors NULL)
+ */
+bool decode_program(Machine *pmach);
+
+//! Fusion des suites d'instructions fréquentes en super-instructions
+/*!
+ * Chaque instruction qui commence une suite décrite par \c FUSED_TRIPLES ou
+ * \c FUSED_PAIRS (la plus longue d'abord) reçoit la variante de la
+ * super-instruction correspondante. Les instructions suivantes du groupe
+ * gardent leur variante : un branchement au milieu du groupe reste correct.
+ * Appelée par decode_program().
+ *
+ * \param pmach la machine dont on fusionne le programme
+ * \return le nombre de super-instructions créées
+ */
+unsigned fuse_program(Machine *pmach);
+
+//! Rapport de fusion
+/*!
+ * Affiche, pour chaque super-instruction, le nombre d'emplacements du
+ * segment de texte où elle a été créée, puis le nombre d'aiguillages évités
+ * lors de la dernière exécution par simul_threaded().
+ *
+ * \param pmach la machine en cours d'exécution
+ * \param dispatches le nombre d'aiguillages effectués (retourné par
+ * simul_threaded()), ou 0 si le programme n'a pas été exécuté ainsi
+ */
+void print_fusions(Machine *pmach, uint64_t dispatches);
+
+//! Choix de la fonction d'exécution, avec ou sans vérification d'adresse
+/*!
+ * Les variantes absolues et indexées de LOAD, STORE, ADD, SUB, BRANCH,
+ * CALL, PUSH et POP vérifient l'adresse de leur opérande ; chacune a une
+ * fonction d'exécution sans ces vérifications, pour une instruction dont
+ * verify_program() a prouvé l'adresse valide. Les vérifications de la pile
+ * sont toujours faites. Seule \c _handler change : la variante (\c _kind)
+ * reste celle du pré-décodage. Sans effet sur les autres variantes.
+ *
+ * \param op l'instruction pré-décodée (éventuellement la première d'une
+ * super-instruction)
+ * \param checked faux si l'adresse de l'opérande a été prouvée valide
+ */
+void set_checked(Micro_Op *op, bool checked);
+
+//! L'instruction s'exécute-t-elle sans vérification d'adresse ?
+/*!
+ * \param op l'instruction pré-décodée
+ * \return vrai si set_checked() l'a rendue à sa variante sans vérification
+ */
+bool op_verified(const Micro_Op *op);
+
+//! Un segment pré-décodé lu hors du simulateur est-il exécutable ?
+/*!
+ * Vérifie que chaque instruction a une variante, une fonction d'exécution
+ * et des numéros de registre et de condition que peuvent produire
+ * decode_program() et set_checked(), que chaque super-instruction est
+ * suivie des instructions qu'elle exécute, et que la sentinelle est en
+ * place : les moteurs indexent des tableaux par ces champs sans les
+ * contrôler.
+ *
+ * \param ops le segment pré-décodé, sentinelle comprise
+ * \param textsize la taille du segment de texte
+ * \return vrai s'il peut être exécuté
+ */
+bool decoded_valid(const Micro_Op *ops, unsigned textsize);
+
+//! Un segment pré-décodé lu hors du simulateur est-il celui d'un segment de texte ?
+/*!
+ * Pré-décode à nouveau chaque instruction du texte et la compare, fusion
+ * comprise, à celle du segment. Les fonctions d'exécution ne sont pas
+ * comparées : verify_program() les choisit à nouveau.
+ *
+ * \param ops le segment pré-décodé, validé par decoded_valid()
+ * \param textsize la taille du segment de texte
+ * \param text le segment de texte
+ * \return vrai si decode_program() produirait les mêmes instructions
+ */
+bool decoded_matches(const Micro_Op *ops, unsigned textsize, const Instruction *text);
+
+//! Empreinte du pré-décodage de cet exécutable
+/*!
+ * Un segment pré-décodé n'a de sens que pour l'exécutable qui l'a produit :
+ * l'empreinte change avec la liste des variantes et les décalages des
+ * fonctions d'exécution.
+ *
+ * \return l'empreinte
+ */
+uint32_t decode_fingerprint(void);
+
 //! Décodage et exécution d'une instruction
 /*!
  * \param pmach la machine/programme en cours d'exécution
@@ -16,9 +254,38 @@
  */
 bool decode_execute(Machine *pmach, Instruction instr);
 
+//! Décodage et exécution d'une instruction avec compte rendu d'erreur
+/*!
+ * Comme decode_execute(), mais une erreur est rapportée à l'appelant au lieu
+ * de terminer le programme (voir catch_error()).
+ *
+ * \param pmach la machine/programme en cours d'exécution
+ * \param instr l'instruction à exécuter
+ * \return \c RUN_CONTINUE, \c RUN_HALT, ou \c RUN_ERROR avec le code et
+ * l'adresse de l'erreur
+ */
+Run_Status decode_execute_run(Machine *pmach, Instruction instr);
+
+//! Simulation par code \e threadé
+/*!
+ * Variante de simul() sans trace ni mise au point : chaque instruction
+ * pré-décodée est associée à l'adresse de son code d'exécution, et la fin de
+ * chaque instruction saute directement au code de la suivante (\e goto
+ * calculés de GNU C). Sans cette extension, on se replie sur un \c switch.
+ * Les super-instructions exécutent leur groupe d'instructions en un seul
+ * aiguillage. Si la mémoire manque pour le tableau des étiquettes, rien
+ * n'est exécuté et l'erreur \c ERR_MEMORY est signalée par error().
+ *
+ * \param pmach la machine en cours d'exécution
+ * \return le nombre d'aiguillages effectués
+ */
+uint64_t simul_threaded(Machine *pmach);
+
 //! Trace de l'exécution
 /*!
- * On écrit l'adresse et l'instruction sous forme lisible.
+ * On écrit l'adresse et l'instruction sous forme lisible ; pendant
+ * l'écriture asynchrone (voir async.h), la ligne est mise en forme et écrite
+ * par le processus léger d'écriture.
  *
  * \param msg le message de trace
  * \param pmach la machine en cours d'exécution
@@ -27,4 +294,12 @@ bool decode_execute(Machine *pmach, Instruction instr);
  */
 void trace(const char *msg, Machine *pmach, Instruction instr, unsigned addr);
 
+//! Affichage d'une ligne de trace, toujours synchrone
+/*!
+ * \param msg le message de trace
+ * \param instr l'instruction à exécuter
+ * \param addr son adresse
+ */
+void print_trace(const char *msg, Instruction instr, unsigned addr);
+
 #endif
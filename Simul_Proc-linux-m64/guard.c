@@ -0,0 +1,118 @@
+/*!
+ * \file guard.c
+ * \brief Segment de données gardé par des pages inaccessibles
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "guard.h"
+#include "error.h"
+#include "verify.h"
+#include "paging.h"
+
+//! Étendue des adresses de données qu'une instruction peut former, en octets
+#define GUARD_REACH (((size_t) UINT32_MAX + 1) * sizeof(Word))
+
+//! Machine gardée du processus léger, ou NULL
+static __thread Machine *guarded = NULL;
+
+//! Installation unique du gestionnaire de SIGSEGV
+static pthread_once_t handler_once = PTHREAD_ONCE_INIT;
+
+//! Gestionnaire installé ?
+static bool handler_installed = false;
+
+//! Message d'une faute hors reprise sur erreur (voir guard_fault())
+static const char fault_message[] = "ERROR: Violation de taille du segment de données\n";
+
+//! Gestionnaire de SIGSEGV
+/*!
+ * Une faute dans la réservation ne peut venir que de la lecture de
+ * l'opérande de l'instruction en cours : c'est une erreur du programme
+ * simulé. Pendant un catch_error(), elle est signalée par error(), qui
+ * quitte le gestionnaire par longjmp() vers le point de reprise. Sinon,
+ * seules des fonctions sûres dans un gestionnaire de signal sont permises :
+ * un message fixe est écrit sur la sortie d'erreur, sans l'adresse, et le
+ * simulateur s'arrête par _exit(). Toute autre faute est une erreur du
+ * simulateur : on rétablit le comportement par défaut, et l'instruction
+ * fautive la refait au retour.
+ */
+static void guard_fault(int signo, siginfo_t *info, void *context)
+{
+	Machine *pmach = guarded;
+	char *addr = info->si_addr;
+
+	if (pmach != NULL && addr >= (char *) pmach->_guard
+	    && addr < (char *) pmach->_guard + pmach->_guardsize) {
+		if (catch_active())
+			error(ERR_SEGDATA, pmach->_pc);
+		ssize_t ignored = write(STDERR_FILENO, fault_message, sizeof(fault_message) - 1);
+		(void) ignored;
+		_exit(1);
+	}
+	signal(SIGSEGV, SIG_DFL);
+}
+
+//! Installation du gestionnaire de SIGSEGV, pour tout le processus
+static void install_handler(void)
+{
+	// SA_NODEFER : error() quitte le gestionnaire par longjmp(), sans rétablir le masque des signaux
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = guard_fault;
+	action.sa_flags = SA_SIGINFO | SA_NODEFER;
+	sigemptyset(&action.sa_mask);
+	handler_installed = sigaction(SIGSEGV, &action, NULL) == 0;
+}
+
+//! Protection du segment de données d'une machine par des pages inaccessibles
+bool guard_data(Machine *pmach)
+{
+	if (guarded != NULL)
+		return false;
+	pthread_once(&handler_once, install_handler);
+	if (!handler_installed)
+		return false;
+
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t bytes = (size_t) pmach->_datasize * sizeof(Word);
+	size_t mapped = (bytes + page - 1) / page * page;
+	size_t size = mapped + GUARD_REACH;
+	char *base = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	if (base == MAP_FAILED)
+		return false;
+	if (mapped > 0 && mprotect(base, mapped, PROT_READ | PROT_WRITE) != 0) {
+		munmap(base, size);
+		return false;
+	}
+
+	// Le segment finit en fin de page : le mot qui le suit est inaccessible
+	Word *data = (Word *) (base + mapped - bytes);
+	Word *old = pmach->_data;
+	data_load(data, old, pmach->_datasize);
+	pmach->_data = data;
+	data_free(old, pmach->_datasize);
+	pmach->_guard = base;
+	pmach->_guardsize = size;
+	guarded = pmach;
+	verify_program(pmach);
+	return true;
+}
+
+//! Libération de la réservation d'une machine gardée
+void guard_free(Machine *pmach)
+{
+	munmap(pmach->_guard, pmach->_guardsize);
+	if (guarded == pmach)
+		guarded = NULL;
+	pmach->_guard = NULL;
+	pmach->_guardsize = 0;
+}
@@ -0,0 +1,57 @@
+#ifndef _GUARD_H_
+#define _GUARD_H_
+
+/*!
+ * \file guard.h
+ * \brief Segment de données gardé par des pages inaccessibles
+ *
+ * Le segment de données est recopié dans une réservation de mémoire
+ * virtuelle (mmap()) qui le place en fin de page et le fait suivre de pages
+ * inaccessibles couvrant toutes les adresses qu'une instruction peut
+ * former : un mot non signé (registre plus déplacement en mode indexé), soit
+ * 16 Gio de mémoire virtuelle, sans mémoire réelle. Une lecture hors du
+ * segment fait alors une faute de segmentation, que le gestionnaire de
+ * \c SIGSEGV rapporte comme \c ERR_SEGDATA à l'adresse de l'instruction
+ * (error()) : LOAD, ADD, SUB et PUSH s'exécutent sans comparer l'adresse
+ * de leur opérande (voir verify_program()).
+ *
+ * STORE et POP gardent leur vérification : la limite qui compte pour eux
+ * est \c dataend, au milieu du segment. Les vérifications de la pile
+ * restent aussi, pour la même raison. simul_jit() garde toutes ses
+ * vérifications : son code ne tient pas le compteur ordinal à jour.
+ */
+
+#include <stdbool.h>
+
+#include "machine.h"
+
+//! Protection du segment de données d'une machine par des pages inaccessibles
+/*!
+ * Le segment est recopié dans la réservation, et l'ancien, alloué par
+ * data_alloc(), est libéré. La machine est ensuite vérifiée à nouveau
+ * (verify_program()). Une seule machine gardée par processus léger, jusqu'à
+ * guard_free() ; elle ne peut pas servir de modèle à des clones (voir
+ * clone.h). Le gestionnaire de \c SIGSEGV est installé au premier appel,
+ * pour tout le processus.
+ *
+ * Hors de catch_error(), une lecture hors du segment arrête le simulateur
+ * avec un message fixe sur la sortie d'erreur, sans passer par error() :
+ * les flots \c stdio ne sont pas vidés. Pour que l'erreur soit rapportée
+ * comme les autres, on exécute la machine sous catch_error().
+ *
+ * \param pmach la machine, chargée
+ * \return faux si une autre machine est déjà gardée dans ce processus
+ * léger, ou si la réservation ou le gestionnaire de \c SIGSEGV ne peuvent
+ * être mis en place
+ */
+bool guard_data(Machine *pmach);
+
+//! Libération de la réservation d'une machine gardée
+/*!
+ * Appelée par free_program().
+ *
+ * \param pmach la machine gardée
+ */
+void guard_free(Machine *pmach);
+
+#endif
@@ -9,6 +9,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include "instruction.h"
+#include "error.h"
 
 //! Forme imprimable des codes opérations
 const char *cop_names[] = {
@@ -31,15 +32,15 @@ const char *condition_names[] = {
 void print_op(Instruction instr) {
 	// instruction à valeur absolu
 	if (instr.instr_generic._immediate == 0 && instr.instr_generic._indexed == 0) {
-		printf("@0x%.4x", instr.instr_generic._pad);
+		fprintf(sim_output(), "@0x%.4x", instr.instr_generic._pad);
 	}
 	// instruction immédiate
 	else if(instr.instr_generic._immediate == 1 && instr.instr_generic._indexed == 0) {
-		printf("#%u", instr.instr_generic._pad);
+		fprintf(sim_output(), "#%u", instr.instr_generic._pad);
 	}
 	// instruction à une adresse relative indexée
 	else if (instr.instr_generic._immediate == 0 && instr.instr_generic._indexed == 1) {
-		printf("%d[R%.2u]", instr.instr_indexed._offset, instr.instr_indexed._rindex);
+		fprintf(sim_output(), "%d[R%.2u]", instr.instr_indexed._offset, instr.instr_indexed._rindex);
 	}
 }
 
@@ -55,7 +56,7 @@ void print_instruction(Instruction instr, unsigned addr) {
 		case ILLOP :
 		case NOP :
 		{
-			printf("%s", cop_names[instr.instr_generic._cop]);
+			fprintf(sim_output(), "%s", cop_names[instr.instr_generic._cop]);
 		}
 		break;
 
@@ -64,7 +65,7 @@ void print_instruction(Instruction instr, unsigned addr) {
 		case ADD :
 		case SUB : 
 		{
-			printf("%s R%.2d, ", cop_names[instr.instr_generic._cop], instr.instr_generic._regcond);
+			fprintf(sim_output(), "%s R%.2d, ", cop_names[instr.instr_generic._cop], instr.instr_generic._regcond);
 			print_op(instr);
 		}
 		break;
@@ -72,14 +73,14 @@ void print_instruction(Instruction instr, unsigned addr) {
 		case PUSH :
 		case POP :
 		{
-			printf("%s ", cop_names[instr.instr_generic._cop]);
+			fprintf(sim_output(), "%s ", cop_names[instr.instr_generic._cop]);
 			print_op(instr);
 		}
 		break;
 
 		default :
 		{
-			printf("%s %s, ", cop_names[instr.instr_generic._cop], condition_names[instr.instr_generic._regcond]);
+			fprintf(sim_output(), "%s %s, ", cop_names[instr.instr_generic._cop], condition_names[instr.instr_generic._regcond]);
 			print_op(instr);	
 		}
 	}
@@ -0,0 +1,720 @@
+/*!
+ * \file jit.c
+ * \brief Compilation à la volée du segment de texte en code x86-64.
+ *
+ * Registres de l'hôte pendant l'exécution du code compilé :
+ *
+ *	- \c rbx : la machine (\c Machine *) ;
+ *	- \c r12 : le segment de données (\c _data) ;
+ *	- \c r13 : la table des adresses natives de chaque instruction ;
+ *	- \c r14 : le compteur d'instructions (\c _icount) ;
+ *	- \c r15d : le code condition (\c _cc) ;
+ *	- \c eax, \c ecx, \c edx : registres de travail.
+ *
+ * Le code compilé retourne \c JIT_HALT après \c HALT, ou le code de l'erreur
+ * rencontrée ; le compteur ordinal de la machine est alors à jour.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jit.h"
+#include "exec.h"
+#include "error.h"
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__FreeBSD__))
+#   define JIT_X86_64
+#endif
+
+#ifdef JIT_X86_64
+
+#include <sys/mman.h>
+
+//! Valeur de retour du code compilé après \c HALT
+#define JIT_HALT (-1)
+
+//! Taille maximale du code d'une instruction
+#define MAX_INSTR_CODE 160
+
+//! Taille d'une amorce d'erreur
+#define STUB_CODE 15
+
+//! Nombre maximal d'amorces d'erreur par instruction
+#define MAX_INSTR_STUBS 5
+
+//! Registres de l'hôte (numérotation x86-64)
+enum { RAX = 0, RCX = 1, RDX = 2, RSI = 6, R12 = 4, R14 = 6, R15 = 7 };
+
+//! Préfixes REX : opérande de 64 bits, extension du champ reg de ModRM
+enum { REX_W = 0x48, REX_R = 0x44, REX_WR = 0x4c };
+
+//! Codes opération \c 81 /n
+enum { ALU_ADD = 0, ALU_SUB = 5, ALU_CMP = 7, ALU_LOAD = -1 };
+
+//! Codes des conditions x86 utilisées (second octet de \c 0F 8x)
+enum { JB = 0x82, JAE = 0x83, JA = 0x87, JMP = 0 };
+
+//! Sorties communes du code compilé
+typedef enum
+{
+	EXIT_OUT_OF_TEXT,	//!< Compteur ordinal (dans eax) hors du segment de texte
+	EXIT_HALT,		//!< Arrêt normal (code de retour dans eax)
+} Exit;
+
+//! Saut à résoudre en fin de compilation
+typedef struct
+{
+	size_t _at;		//!< Position du déplacement de 32 bits à corriger
+	unsigned _target;	//!< Instruction visée, ou sortie commune (\link Exit \endlink)
+} Fixup;
+
+//! Amorce d'erreur à émettre en fin de compilation
+typedef struct
+{
+	size_t _at;		//!< Position du déplacement de 32 bits à corriger
+	Error _err;		//!< Code de l'erreur
+	unsigned _pc;		//!< Compteur ordinal (et adresse signalée) de l'erreur
+} Error_Stub;
+
+//! Tampon de compilation
+typedef struct
+{
+	uint8_t *_code;		//!< Zone de code (projetée par \c mmap)
+	size_t _size;		//!< Taille de la zone
+	size_t _len;		//!< Nombre d'octets émis
+
+	Fixup *_jumps;		//!< Branchements vers les instructions
+	unsigned _njumps;
+	Fixup *_exits;		//!< Sauts vers les sorties communes
+	unsigned _nexits;
+	Error_Stub *_stubs;	//!< Amorces d'erreur
+	unsigned _nstubs;
+
+	size_t *_native;	//!< Position du code de chaque instruction (et de la sentinelle)
+	const Machine *_pmach;	//!< Machine compilée
+} Jit;
+
+//! Déplacement d'un champ de la machine
+#define FIELD(field) ((int32_t) offsetof(Machine, field))
+
+//! Déplacement d'un registre général dans la machine
+#define REGISTER(r) (FIELD(_registers) + 4 * (int32_t) (r))
+
+//! Registre de pile du processeur simulé
+#define SP (NREGISTERS - 1)
+
+static void emit8(Jit *jit, uint8_t byte)
+{
+	jit->_code[jit->_len++] = byte;
+}
+
+static void emit32(Jit *jit, uint32_t word)
+{
+	memcpy(jit->_code + jit->_len, &word, 4);
+	jit->_len += 4;
+}
+
+static void emit_bytes(Jit *jit, const uint8_t *bytes, size_t n)
+{
+	memcpy(jit->_code + jit->_len, bytes, n);
+	jit->_len += n;
+}
+
+//! Correction d'un déplacement de 32 bits pour viser une position
+static void patch(Jit *jit, size_t at, size_t target)
+{
+	int32_t rel = (int32_t) (target - (at + 4));
+	memcpy(jit->_code + at, &rel, 4);
+}
+
+//! \c op reg, [rbx + disp32] : accès à un champ de la machine
+/*!
+ * \param rex préfixe REX, ou 0
+ */
+static void emit_machine(Jit *jit, uint8_t rex, uint8_t opcode, int r, int32_t disp)
+{
+	if (rex != 0)
+		emit8(jit, rex);
+	emit8(jit, opcode);
+	emit8(jit, 0x80 | r << 3 | 3);
+	emit32(jit, disp);
+}
+
+//! \c mov r32, Rn
+static void emit_get_register(Jit *jit, int r, unsigned reg)
+{
+	emit_machine(jit, 0, 0x8b, r, REGISTER(reg));
+}
+
+//! \c mov Rn, r32
+static void emit_set_register(Jit *jit, int r, unsigned reg)
+{
+	emit_machine(jit, 0, 0x89, r, REGISTER(reg));
+}
+
+//! \c op r32, [r12 + 4 * addr] : mot de données d'adresse connue
+static void emit_data_abs(Jit *jit, uint8_t opcode, int r, unsigned addr)
+{
+	emit8(jit, 0x41);
+	emit8(jit, opcode);
+	emit8(jit, 0x80 | r << 3 | 4);
+	emit8(jit, 0x24);
+	emit32(jit, addr * 4);
+}
+
+//! \c op r32, [r12 + 4 * index] : mot de données d'adresse calculée
+static void emit_data_idx(Jit *jit, uint8_t opcode, int r, int index)
+{
+	emit8(jit, 0x41);
+	emit8(jit, opcode);
+	emit8(jit, r << 3 | 4);
+	emit8(jit, 0x80 | index << 3 | 4);
+}
+
+//! \c mov dword [r12 + 4 * index], imm32
+static void emit_data_idx_imm(Jit *jit, int index, uint32_t imm)
+{
+	emit8(jit, 0x41);
+	emit8(jit, 0xc7);
+	emit8(jit, 0x04);
+	emit8(jit, 0x80 | index << 3 | 4);
+	emit32(jit, imm);
+}
+
+//! \c add, \c sub ou \c cmp r32, imm32
+static void emit_alu_imm(Jit *jit, int alu, int r, uint32_t imm)
+{
+	emit8(jit, 0x81);
+	emit8(jit, 0xc0 | alu << 3 | r);
+	emit32(jit, imm);
+}
+
+//! \c mov r32, imm32
+static void emit_mov_imm(Jit *jit, int r, uint32_t imm)
+{
+	emit8(jit, 0xb8 + r);
+	emit32(jit, imm);
+}
+
+//! Saut (conditionnel si \c jcc n'est pas \c JMP) dont le déplacement reste à corriger
+/*!
+ * \return la position du déplacement
+ */
+static size_t emit_jump(Jit *jit, int jcc)
+{
+	if (jcc != JMP) {
+		emit8(jit, 0x0f);
+		emit8(jit, jcc);
+	} else {
+		emit8(jit, 0xe9);
+	}
+	emit32(jit, 0);
+	return jit->_len - 4;
+}
+
+//! Saut vers une amorce d'erreur
+static void emit_error(Jit *jit, int jcc, Error err, unsigned pc)
+{
+	size_t at = emit_jump(jit, jcc);
+	jit->_stubs[jit->_nstubs++] = (Error_Stub) {at, err, pc};
+}
+
+//! Saut vers une sortie commune
+static void emit_exit(Jit *jit, int jcc, Exit exit)
+{
+	size_t at = emit_jump(jit, jcc);
+	jit->_exits[jit->_nexits++] = (Fixup) {at, exit};
+}
+
+//! Saut direct vers le code d'une instruction du segment de texte
+static void emit_jump_text(Jit *jit, unsigned target)
+{
+	size_t at = emit_jump(jit, JMP);
+	jit->_jumps[jit->_njumps++] = (Fixup) {at, target};
+}
+
+//! Saut vers l'instruction dont l'adresse est dans un registre
+/*!
+ * L'adresse est d'abord comparée à la taille du segment de texte ; au-delà,
+ * on sort avec l'erreur \c ERR_SEGTEXT à cette adresse (sauf \c err_pc non
+ * nul : l'erreur est alors signalée en \c err_pc, l'instruction fautive).
+ */
+static void emit_jump_dynamic(Jit *jit, int r, unsigned err_pc)
+{
+	emit_alu_imm(jit, ALU_CMP, r, jit->_pmach->_textsize);
+	if (err_pc != 0) {
+		emit_error(jit, JAE, ERR_SEGTEXT, err_pc);
+	} else {
+		if (r != RAX)
+			emit_bytes(jit, (const uint8_t[]) {0x89, 0xc0 | r << 3}, 2);	// mov eax, r
+		emit_exit(jit, JAE, EXIT_OUT_OF_TEXT);
+	}
+	// jmp [r13 + 8 * r]
+	emit_bytes(jit, (const uint8_t[]) {0x41, 0xff, 0x64, 0xc0 | r << 3 | 5, 0x00}, 5);
+}
+
+//! Mise à jour du code condition d'après \c eax (voir set_cc())
+static void emit_set_cc(Jit *jit)
+{
+	static const uint8_t code[] = {
+		0x31, 0xc9,			// xor ecx, ecx
+		0x85, 0xc0,			// test eax, eax
+		0x0f, 0x95, 0xc1,		// setne cl
+		0x44, 0x8d, 0x79, 0x01,		// lea r15d, [rcx + 1]
+	};
+	emit_bytes(jit, code, sizeof(code));
+}
+
+//! Test de la condition d'un branchement
+/*!
+ * \return la position du saut (à corriger) vers l'instruction suivante quand
+ * la condition est fausse, ou 0 pour une condition toujours vraie
+ */
+static size_t emit_condition(Jit *jit, unsigned cond)
+{
+	static const uint8_t masks[LE + 1] = {
+		[EQ] = 1 << CC_Z,
+		[NE] = 1 << CC_P | 1 << CC_N,
+		[GT] = 1 << CC_P,
+		[GE] = 1 << CC_Z | 1 << CC_P,
+		[LT] = 1 << CC_N,
+		[LE] = 1 << CC_N | 1 << CC_Z,
+	};
+
+	if (cond == NC)
+		return 0;
+	emit_mov_imm(jit, RAX, masks[cond]);
+	emit_bytes(jit, (const uint8_t[]) {0x44, 0x0f, 0xa3, 0xf8}, 4);	// bt eax, r15d
+	return emit_jump(jit, JAE);					// jnc
+}
+
+//! Fin d'un branchement conditionnel : la condition fausse mène ici
+static void patch_here(Jit *jit, size_t at)
+{
+	if (at != 0)
+		patch(jit, at, jit->_len);
+}
+
+//! Vérification du sommet de pile contenu dans un registre (voir check_sp())
+static void emit_check_sp(Jit *jit, int r, unsigned pc)
+{
+	emit_alu_imm(jit, ALU_CMP, r, jit->_pmach->_dataend);
+	emit_error(jit, JB, ERR_SEGSTACK, pc);
+	emit_alu_imm(jit, ALU_CMP, r, jit->_pmach->_datasize - 1);
+	emit_error(jit, JA, ERR_SEGSTACK, pc);
+}
+
+//! Calcul d'une adresse indexée dans un registre
+static void emit_indexed_address(Jit *jit, int r, const Micro_Op *op)
+{
+	emit_get_register(jit, r, op->_rindex);
+	emit_alu_imm(jit, ALU_ADD, r, op->_operand);
+}
+
+//! Vérification d'une adresse de données calculée (voir check_adress_data())
+/*!
+ * Rien n'est émis pour une instruction dont l'adresse a été prouvée valide
+ * (voir set_checked()), sauf sur une machine gardée : verify_program() y
+ * tient pour sûres les lectures que seule la garde protège, et le code
+ * compilé ne saurait pas rapporter la faute (voir guard.h).
+ */
+static void emit_check_data(Jit *jit, const Micro_Op *op, int r, unsigned limit, unsigned pc)
+{
+	if (op_verified(op) && jit->_pmach->_guard == NULL)
+		return;
+	emit_alu_imm(jit, ALU_CMP, r, limit);
+	emit_error(jit, JAE, ERR_SEGDATA, pc);
+}
+
+//! Opérande mémoire de LOAD, ADD ou SUB, lu dans \c ecx
+/*!
+ * \return faux si l'adresse absolue est hors du segment de données : le
+ * code émis se limite alors au saut vers l'amorce d'erreur
+ */
+static bool emit_memory_operand(Jit *jit, const Micro_Op *op, bool indexed, unsigned pc)
+{
+	if (indexed) {
+		emit_indexed_address(jit, RCX, op);
+		emit_check_data(jit, op, RCX, jit->_pmach->_datasize, pc);
+		emit_data_idx(jit, 0x8b, RCX, RCX);
+	} else if ((unsigned) op->_operand >= jit->_pmach->_datasize) {
+		emit_error(jit, JMP, ERR_SEGDATA, pc);
+		return false;
+	} else {
+		emit_data_abs(jit, 0x8b, RCX, op->_operand);
+	}
+	return true;
+}
+
+//! Opération sur un registre général : Rn = / += / -= ecx ou la valeur immédiate
+static void emit_arith(Jit *jit, const Micro_Op *op, int alu, bool immediate)
+{
+	if (alu == ALU_LOAD) {
+		if (immediate)
+			emit_mov_imm(jit, RAX, op->_operand);
+		else
+			emit_bytes(jit, (const uint8_t[]) {0x89, 0xc8}, 2);		// mov eax, ecx
+	} else {
+		emit_get_register(jit, RAX, op->_regcond);
+		if (immediate)
+			emit_alu_imm(jit, alu, RAX, op->_operand);
+		else
+			emit_bytes(jit, (const uint8_t[]) {alu == ALU_ADD ? 0x01 : 0x29, 0xc8}, 2);	// add/sub eax, ecx
+	}
+	emit_set_register(jit, RAX, op->_regcond);
+	emit_set_cc(jit);
+}
+
+//! Traduction d'une instruction
+/*!
+ * L'ordre des vérifications et des effets de bord est celui des fonctions
+ * d'exécution de exec.c.
+ *
+ * \param jit le tampon de compilation
+ * \param op l'instruction pré-décodée
+ * \param addr son adresse dans le segment de texte
+ */
+static void compile_instruction(Jit *jit, const Micro_Op *op, unsigned addr)
+{
+	const Machine *pmach = jit->_pmach;
+	unsigned pc = addr + 1;		// compteur ordinal pendant l'exécution
+	unsigned operand = op->_operand;
+	Micro_Op single;
+	size_t skip;
+
+	// Les super-instructions ne concernent que simul_threaded()
+	decode_instruction(&single, pmach->_text[addr]);
+
+	emit_bytes(jit, (const uint8_t[]) {0x49, 0xff, 0xc6}, 3);		// inc r14
+
+	switch (single._kind) {
+	case OP_NOP:
+		break;
+
+	case OP_LOAD_IMM:
+		emit_arith(jit, op, ALU_LOAD, true);
+		break;
+	case OP_ADD_IMM:
+		emit_arith(jit, op, ALU_ADD, true);
+		break;
+	case OP_SUB_IMM:
+		emit_arith(jit, op, ALU_SUB, true);
+		break;
+	case OP_LOAD_ABS:
+	case OP_LOAD_IDX:
+		if (emit_memory_operand(jit, op, single._kind == OP_LOAD_IDX, pc))
+			emit_arith(jit, op, ALU_LOAD, false);
+		break;
+	case OP_ADD_ABS:
+	case OP_ADD_IDX:
+		if (emit_memory_operand(jit, op, single._kind == OP_ADD_IDX, pc))
+			emit_arith(jit, op, ALU_ADD, false);
+		break;
+	case OP_SUB_ABS:
+	case OP_SUB_IDX:
+		if (emit_memory_operand(jit, op, single._kind == OP_SUB_IDX, pc))
+			emit_arith(jit, op, ALU_SUB, false);
+		break;
+
+	case OP_STORE_ABS:
+		if (operand >= pmach->_datasize || operand >= pmach->_dataend) {
+			emit_error(jit, JMP, ERR_SEGDATA, pc);
+			break;
+		}
+		emit_get_register(jit, RAX, op->_regcond);
+		emit_data_abs(jit, 0x89, RAX, operand);
+		break;
+	case OP_STORE_IDX:
+		emit_indexed_address(jit, RCX, op);
+		emit_check_data(jit, op, RCX, pmach->_datasize < pmach->_dataend ? pmach->_datasize : pmach->_dataend, pc);
+		emit_get_register(jit, RAX, op->_regcond);
+		emit_data_idx(jit, 0x89, RAX, RCX);
+		break;
+
+	case OP_BRANCH_ABS:
+		skip = emit_condition(jit, op->_regcond);
+		if (operand >= pmach->_textsize)
+			emit_error(jit, JMP, ERR_SEGTEXT, pc);
+		else
+			emit_jump_text(jit, operand);
+		patch_here(jit, skip);
+		break;
+	case OP_BRANCH_IDX:
+		skip = emit_condition(jit, op->_regcond);
+		emit_indexed_address(jit, RDX, op);
+		emit_jump_dynamic(jit, RDX, pc);
+		patch_here(jit, skip);
+		break;
+
+	case OP_CALL_ABS:
+	case OP_CALL_IDX:
+		skip = emit_condition(jit, op->_regcond);
+		if (single._kind == OP_CALL_IDX)
+			emit_indexed_address(jit, RDX, op);		// avant de modifier SP
+		emit_get_register(jit, RAX, SP);
+		emit_check_sp(jit, RAX, pc);
+		emit_data_idx_imm(jit, RAX, pc);
+		emit_alu_imm(jit, ALU_SUB, RAX, 1);
+		emit_set_register(jit, RAX, SP);
+		if (single._kind == OP_CALL_IDX)
+			emit_jump_dynamic(jit, RDX, pc);
+		else if (operand >= pmach->_textsize)
+			emit_error(jit, JMP, ERR_SEGTEXT, pc);
+		else
+			emit_jump_text(jit, operand);
+		patch_here(jit, skip);
+		break;
+
+	case OP_RET:
+		emit_get_register(jit, RAX, SP);
+		emit_alu_imm(jit, ALU_ADD, RAX, 1);
+		emit_check_sp(jit, RAX, pc);
+		emit_set_register(jit, RAX, SP);
+		emit_data_idx(jit, 0x8b, RAX, RAX);
+		// Le nouveau compteur ordinal est vérifié comme au début de la boucle de simul()
+		emit_jump_dynamic(jit, RAX, 0);
+		break;
+
+	case OP_PUSH_IMM:
+		emit_get_register(jit, RAX, SP);
+		emit_check_sp(jit, RAX, pc);
+		emit_data_idx_imm(jit, RAX, operand);
+		emit_alu_imm(jit, ALU_SUB, RAX, 1);
+		emit_check_sp(jit, RAX, pc);
+		emit_set_register(jit, RAX, SP);
+		break;
+	case OP_PUSH_ABS:
+	case OP_PUSH_IDX:
+		if (single._kind == OP_PUSH_IDX)
+			emit_indexed_address(jit, RDX, op);		// avant de modifier SP
+		emit_get_register(jit, RAX, SP);
+		emit_check_sp(jit, RAX, pc);
+		if (single._kind == OP_PUSH_IDX) {
+			emit_check_data(jit, op, RDX, pmach->_datasize, pc);
+			emit_data_idx(jit, 0x8b, RDX, RDX);
+		} else if (operand >= pmach->_datasize) {
+			emit_error(jit, JMP, ERR_SEGDATA, pc);
+			break;
+		} else {
+			emit_data_abs(jit, 0x8b, RDX, operand);
+		}
+		emit_data_idx(jit, 0x89, RDX, RAX);
+		emit_alu_imm(jit, ALU_SUB, RAX, 1);
+		emit_check_sp(jit, RAX, pc);
+		emit_set_register(jit, RAX, SP);
+		break;
+
+	case OP_POP_ABS:
+	case OP_POP_IDX:
+		if (single._kind == OP_POP_IDX) {
+			emit_indexed_address(jit, RDX, op);		// avant de modifier SP
+			emit_check_data(jit, op, RDX, pmach->_datasize, pc);
+		} else if (operand >= pmach->_datasize) {
+			emit_error(jit, JMP, ERR_SEGDATA, pc);
+			break;
+		} else {
+			emit_mov_imm(jit, RDX, operand);
+		}
+		emit_get_register(jit, RAX, SP);
+		emit_alu_imm(jit, ALU_ADD, RAX, 1);
+		emit_check_sp(jit, RAX, pc);
+		emit_set_register(jit, RAX, SP);
+		emit_check_data(jit, op, RDX, pmach->_dataend, pc);
+		emit_data_idx(jit, 0x8b, RAX, RAX);
+		emit_data_idx(jit, 0x89, RAX, RDX);
+		break;
+
+	case OP_HALT:
+		emit_machine(jit, 0, 0xc7, 0, FIELD(_pc));		// mov dword [rbx + _pc], pc
+		emit32(jit, pc);
+		emit_mov_imm(jit, RAX, (uint32_t) JIT_HALT);
+		emit_exit(jit, JMP, EXIT_HALT);
+		break;
+
+	case OP_ILLOP:
+		emit_error(jit, JMP, ERR_NOERROR, pc);
+		break;
+	case OP_ERR_IMMEDIATE:
+		emit_error(jit, JMP, ERR_IMMEDIATE, pc);
+		break;
+	case OP_ERR_CONDITION:
+		emit_error(jit, JMP, ERR_CONDITION, pc);
+		break;
+	default:
+		emit_error(jit, JMP, ERR_UNKNOWN, pc);
+		break;
+	}
+}
+
+//! Compilation du segment de texte
+/*!
+ * Organisation du code produit : prologue, code de chaque instruction dans
+ * l'ordre du segment de texte, sortie du segment de texte en séquence (la
+ * sentinelle de decode_program()), sortie sur compteur ordinal invalide,
+ * amorces d'erreur, sortie sur erreur et épilogue.
+ *
+ * \param jit le tampon de compilation, dont \c _pmach est fixé
+ * \return faux si la mémoire manque
+ */
+static bool compile_program(Jit *jit)
+{
+	const Machine *pmach = jit->_pmach;
+	unsigned textsize = pmach->_textsize;
+	size_t size = (size_t) textsize * (MAX_INSTR_CODE + MAX_INSTR_STUBS * STUB_CODE) + 4096;
+
+	jit->_size = (size + 4095) & ~(size_t) 4095;
+	jit->_code = mmap(NULL, jit->_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	jit->_jumps = malloc((textsize + 1) * sizeof(Fixup));
+	jit->_exits = malloc((textsize + 1) * sizeof(Fixup));
+	jit->_stubs = malloc((MAX_INSTR_STUBS * (size_t) textsize + 1) * sizeof(Error_Stub));
+	jit->_native = malloc((textsize + 1) * sizeof(size_t));
+	jit->_len = jit->_njumps = jit->_nexits = jit->_nstubs = 0;
+	if (jit->_code == MAP_FAILED) {
+		jit->_code = NULL;
+		return false;
+	}
+	if (jit->_jumps == NULL || jit->_exits == NULL || jit->_stubs == NULL || jit->_native == NULL)
+		return false;
+
+	// Prologue : sauvegarde des registres, chargement de l'état, saut à _pc
+	static const uint8_t prologue[] = {
+		0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57,	// push rbx, rbp, r12-r15
+		0x48, 0x83, 0xec, 0x08,						// sub rsp, 8
+		0x48, 0x89, 0xfb,						// mov rbx, rdi
+		0x49, 0x89, 0xf5,						// mov r13, rsi
+	};
+	emit_bytes(jit, prologue, sizeof(prologue));
+	emit_machine(jit, REX_WR, 0x8b, R12, FIELD(_data));		// mov r12, [rbx + _data]
+	emit_machine(jit, REX_WR, 0x8b, R14, FIELD(_icount));		// mov r14, [rbx + _icount]
+	emit_machine(jit, REX_R, 0x8b, R15, FIELD(_cc));		// mov r15d, [rbx + _cc]
+	emit_machine(jit, 0, 0x8b, RAX, FIELD(_pc));			// mov eax, [rbx + _pc]
+	emit_jump_dynamic(jit, RAX, 0);
+
+	// Instructions
+	for (unsigned addr = 0; addr < textsize; ++addr) {
+		jit->_native[addr] = jit->_len;
+		compile_instruction(jit, &pmach->_decoded[addr], addr);
+	}
+
+	// Sortie du segment de texte en séquence : erreur à l'adresse textsize,
+	// sans compter d'instruction supplémentaire
+	jit->_native[textsize] = jit->_len;
+	emit_error(jit, JMP, ERR_SEGTEXT, textsize);
+
+	// Compteur ordinal (eax) hors du segment de texte : erreur à cette adresse
+	size_t out_of_text = jit->_len;
+	emit_bytes(jit, (const uint8_t[]) {0x89, 0xc6}, 2);		// mov esi, eax
+	emit_mov_imm(jit, 7, ERR_SEGTEXT);				// mov edi, ERR_SEGTEXT
+	size_t to_fault = emit_jump(jit, JMP);
+
+	// Amorces d'erreur : esi = compteur ordinal, edi = code d'erreur
+	size_t *stub_jumps = malloc((jit->_nstubs + 1) * sizeof(size_t));
+	if (stub_jumps == NULL)
+		return false;
+	for (unsigned i = 0; i < jit->_nstubs; ++i) {
+		patch(jit, jit->_stubs[i]._at, jit->_len);
+		emit_mov_imm(jit, RSI, jit->_stubs[i]._pc);
+		emit_mov_imm(jit, 7, jit->_stubs[i]._err);
+		stub_jumps[i] = emit_jump(jit, JMP);
+	}
+
+	// Sortie sur erreur : mise à jour de _pc, code d'erreur dans eax
+	size_t fault = jit->_len;
+	patch(jit, to_fault, fault);
+	for (unsigned i = 0; i < jit->_nstubs; ++i)
+		patch(jit, stub_jumps[i], fault);
+	free(stub_jumps);
+	emit_machine(jit, 0, 0x89, RSI, FIELD(_pc));			// mov [rbx + _pc], esi
+	emit_bytes(jit, (const uint8_t[]) {0x89, 0xf8}, 2);		// mov eax, edi
+
+	// Épilogue : recopie de l'état gardé dans les registres de l'hôte
+	size_t epilogue = jit->_len;
+	emit_machine(jit, REX_WR, 0x89, R14, FIELD(_icount));		// mov [rbx + _icount], r14
+	emit_machine(jit, REX_R, 0x89, R15, FIELD(_cc));		// mov [rbx + _cc], r15d
+	static const uint8_t epilogue_code[] = {
+		0x48, 0x83, 0xc4, 0x08,						// add rsp, 8
+		0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5d, 0x5b,	// pop r15-r12, rbp, rbx
+		0xc3,								// ret
+	};
+	emit_bytes(jit, epilogue_code, sizeof(epilogue_code));
+
+	for (unsigned i = 0; i < jit->_nexits; ++i)
+		patch(jit, jit->_exits[i]._at, jit->_exits[i]._target == EXIT_HALT ? epilogue : out_of_text);
+
+	// Chaînage direct des blocs de base
+	for (unsigned i = 0; i < jit->_njumps; ++i)
+		patch(jit, jit->_jumps[i]._at, jit->_native[jit->_jumps[i]._target]);
+
+	return mprotect(jit->_code, jit->_size, PROT_READ | PROT_EXEC) == 0;
+}
+
+//! Libération du tampon de compilation
+static void free_jit(Jit *jit)
+{
+	if (jit->_code != NULL)
+		munmap(jit->_code, jit->_size);
+	free(jit->_jumps);
+	free(jit->_exits);
+	free(jit->_stubs);
+	free(jit->_native);
+}
+
+#endif
+
+//! Compilation à la volée disponible sur cette plate-forme ?
+/*!
+ * \return vrai sur x86-64 (System V) ; faux sinon
+ */
+bool jit_available(void)
+{
+#ifdef JIT_X86_64
+	return true;
+#else
+	return false;
+#endif
+}
+
+//! Simulation par compilation à la volée
+/*!
+ * Le code compilé est appelé avec la machine et la table des adresses
+ * natives des instructions ; il retourne \c JIT_HALT ou un code d'erreur,
+ * que l'on signale comme le ferait simul(). Si le programme ne peut être
+ * compilé (mémoire ou projection exécutable refusée), rien n'est exécuté et
+ * l'erreur \c ERR_MEMORY est signalée par error().
+ *
+ * \param pmach la machine en cours d'exécution
+ */
+void simul_jit(Machine *pmach)
+{
+#ifdef JIT_X86_64
+	Jit jit = {._code = NULL, ._jumps = NULL, ._exits = NULL, ._stubs = NULL, ._native = NULL, ._pmach = pmach};
+	void **table = NULL;
+
+	if (compile_program(&jit))
+		table = malloc((pmach->_textsize + 1) * sizeof(void *));
+	if (table == NULL) {
+		free_jit(&jit);
+		error(ERR_MEMORY, pmach->_pc);
+	}
+	for (unsigned i = 0; i <= pmach->_textsize; ++i)
+		table[i] = jit._code + jit._native[i];
+
+	int (*run)(Machine *, void **) = (int (*)(Machine *, void **)) (void *) jit._code;
+	int status = run(pmach, table);
+
+	free(table);
+	free_jit(&jit);
+
+	if (status == JIT_HALT)
+		warning(WARN_HALT, pmach->_pc - 1);
+	else
+		error(status, pmach->_pc);
+#else
+	simul_threaded(pmach);
+#endif
+}
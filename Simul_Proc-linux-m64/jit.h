@@ -0,0 +1,44 @@
+#ifndef _JIT_H_
+#define _JIT_H_
+
+/*!
+ * \file jit.h
+ * \brief Compilation à la volée du segment de texte en code x86-64.
+ */
+
+#include <stdbool.h>
+
+#include "machine.h"
+
+//! Compilation à la volée disponible sur cette plate-forme ?
+/*!
+ * \return vrai sur x86-64 (System V) ; faux sinon
+ */
+bool jit_available(void);
+
+//! Simulation par compilation à la volée
+/*!
+ * Le segment de texte est traduit en code x86-64 natif dans une zone
+ * exécutable obtenue par \c mmap. Les blocs de base sont chaînés directement
+ * quand la cible d'un branchement est connue à la compilation, et par une
+ * table d'adresses natives sinon (mode indexé, \c RET).
+ *
+ * Le pointeur sur la machine reste dans un registre de l'hôte pendant toute
+ * l'exécution ; les registres généraux du processeur simulé restent en
+ * mémoire dans \c _registers. Le code condition et le compteur d'instructions
+ * sont gardés dans des registres de l'hôte et recopiés dans la machine à la
+ * sortie.
+ *
+ * Chaque erreur d'exécution passe par une amorce de sortie qui fixe le
+ * compteur ordinal puis revient au simulateur, qui appelle error() avec le
+ * même code et la même adresse que simul(). L'état de la machine visible par
+ * le programme est identique à celui obtenu par simul() à l'arrêt.
+ *
+ * Sans compilateur à la volée pour la plate-forme (voir jit_available()), on
+ * se replie sur simul_threaded().
+ *
+ * \param pmach la machine en cours d'exécution
+ */
+void simul_jit(Machine *pmach);
+
+#endif
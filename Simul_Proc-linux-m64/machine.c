@@ -4,13 +4,33 @@
  * \author Mathieu Boutelier
  */
 
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "machine.h"
 #include "debug.h"
 #include "exec.h"
 #include "error.h"
+#include "binfile.h"
+#include "metrics.h"
+#include "verify.h"
+#include "guard.h"
+#include "paging.h"
+#include "textcache.h"
+
+//! Segment pré-décodé trouvé dans le cache pour le chargement en cours (voir load_image())
+static __thread Cached_Text cached_text;
+
+//! \c cached_text attend-il d'être repris par load_program() ?
+static __thread bool cached_pending = false;
 
 //! Chargement d'un programme
 /*!
@@ -18,17 +38,23 @@
  * on affecte les valeurs suivantes aux autres segments :
  *	 	- Le compteur ordinal PC est réinitialisé à l'adresse 0 du programme.
  *		- Le code condition est initialisé au code inconnu CC_U.
- *		- Les registres sont réinitialisés à la valeur 0.
+ *		- Les registres et le compteur d'instructions sont réinitialisés à la valeur 0.
  *		- Le registre SP est initialisé à la valeur de la tête de pile datasize - 1.
  *
+ * Le segment de texte est ensuite pré-décodé avec decode_program() : la
+ * boucle de simulation n'a plus à extraire les champs de bits des
+ * instructions. Pendant un chargement par load_image(), le segment
+ * pré-décodé peut venir du cache (voir textcache.h).
+ *
  * \param pmach la machine en cours d'exécution
  * \param textsize taille utile du segment de texte
  * \param text le contenu du segment de texte
  * \param datasize taille utile du segment de données
  * \param data le contenu initial du segment de texte
+ * \return faux si la mémoire manque
  *
  */
-void load_program(Machine *pmach,
+bool load_program(Machine *pmach,
               unsigned textsize, Instruction text[textsize],
               unsigned datasize, Word data[datasize],  unsigned dataend)
 {
@@ -37,22 +63,51 @@ void load_program(Machine *pmach,
 	pmach->_datasize = datasize;
 	pmach->_text = text;
 	pmach->_data = data;
+	pmach->_image = NULL;
+	pmach->_imagesize = 0;
+	pmach->_dirty = NULL;
+	pmach->_guard = NULL;
+	pmach->_guardsize = 0;
+	pmach->_threaded = NULL;
 	pmach->_pc = 0;
 	pmach->_cc = CC_U;
+	pmach->_icount = 0;
+	pmach->_depth = 0;
 
 	for (int i = 0; i < NREGISTERS; ++i) {
 		pmach->_registers[i] = 0;
 	}
 	
 	pmach->_sp = datasize - 1;
+
+	if (cached_pending && cached_text._textsize == textsize
+	    && decoded_matches(cached_text._ops, textsize, text)) {
+		// Déjà pré-décodé par un chargement précédent du même fichier ; les preuves sont refaites
+		pmach->_decoded = cached_text._ops;
+		pmach->_decodedsize = cached_text._mapsize;
+		cached_pending = false;
+	} else {
+		pmach->_decodedsize = 0;
+		if (!decode_program(pmach))
+			return false;
+	}
+	verify_program(pmach);
+	if (!metrics_init(pmach)) {
+		if (pmach->_decodedsize != 0)
+			text_cache_release(pmach->_decoded, pmach->_decodedsize);
+		else
+			free(pmach->_decoded);
+		pmach->_decoded = NULL;
+		pmach->_decodedsize = 0;
+		return false;
+	}
+	return true;
 }
 
 //! Lecture d'un programme depuis un fichier binaire
 /*!
- * On initialise les segments aux valeurs lu dans le fichier
- * dans l'odre décrit dans machine.h.
- *
- * On initialise ensuite la machine à l'aide de la fonction load_program()
+ * On projette le fichier en mémoire avec try_read_program(), qui valide
+ * l'en-tête avant de charger la machine.
  *
  * \param pmach la machine à simuler
  * \param programfile le nom du fichier binaire
@@ -60,48 +115,286 @@ void load_program(Machine *pmach,
  */
 void read_program(Machine *mach, const char *programfile)
 {
-	// Pointeur sur le fichier binaire
-	FILE * fp;
-	int i;
-	unsigned textsize;
-	unsigned datasize;
-	unsigned dataend;
-	Instruction * text;
-	Word * data;
+	Load_Status status = try_read_program(mach, programfile);
 
-	// On ouvre le fichier en lecture
-	if ((fp = fopen(programfile, "r")) == NULL) {
-		fprintf(stderr, "Ouverture du fichier impossible.\n");
+	if (status != LOAD_OK) {
+		fprintf(stderr, "%s\n", load_message(status));
 		exit(1);
 	}
+}
 
-	// Initialisation de textsize
-	fread(&textsize, sizeof(unsigned), 1, fp);
+//! Taille de l'en-tête d'un fichier binaire historique (textsize, datasize, dataend)
+#define HEADER_SIZE (3 * sizeof(unsigned))
 
-	// Initialisation de datasize
-	fread(&datasize, sizeof(unsigned), 1, fp);
+//! Chargement d'un programme au format historique
+/*!
+ * L'en-tête est validé avant tout chargement : \c dataend ne dépasse pas
+ * \c datasize, et le fichier contient au moins les \c textsize
+ * instructions et les \c dataend mots de données annoncés. Le segment de
+ * texte pointe directement dans \p image.
+ *
+ * \param mach la machine à simuler
+ * \param image le contenu du fichier
+ * \param size sa taille
+ * \return \c LOAD_OK, ou la cause de l'échec
+ */
+static Load_Status load_legacy(Machine *mach, void *image, size_t size)
+{
+	unsigned header[3];
+
+	if (size < HEADER_SIZE)
+		return LOAD_FORMAT;
+
+	// Validation de l'en-tête : textsize, datasize, dataend
+	memcpy(header, image, HEADER_SIZE);
+	unsigned textsize = header[0];
+	unsigned datasize = header[1];
+	unsigned dataend = header[2];
+	if (dataend > datasize
+	    || HEADER_SIZE + ((uint64_t) textsize + dataend) * sizeof(Word) > size)
+		return LOAD_FORMAT;
+
+	// La pile (au-delà de dataend) n'est pas dans le fichier : elle part de 0
+	Word *data = data_alloc(datasize);
+	if (data == NULL)
+		return LOAD_MEMORY;
+	Instruction *text = (Instruction *) ((char *) image + HEADER_SIZE);
+	data_load(data, &text[textsize], dataend);
+
+	if (!load_program(mach, textsize, text, datasize, data, dataend)) {
+		data_free(data, datasize);
+		return LOAD_MEMORY;
+	}
+	return LOAD_OK;
+}
 
-	// Initialisation de dataend
-	fread(&dataend, sizeof(unsigned), 1, fp);
+//! Chargement d'un programme projeté en mémoire, selon son format
+/*!
+ * Version 2 si le programme commence par \c BIN_MAGIC (load_bin_v2()),
+ * historique sinon (load_legacy()). Le segment de texte pointe directement
+ * dans la projection quand il le peut ; la projection est sinon libérée dès
+ * le chargement. Si le cache est utilisé, le segment pré-décodé en est tiré,
+ * ou y est rangé après le chargement (voir textcache.h).
+ *
+ * \param mach la machine à simuler
+ * \param image la projection
+ * \param size la taille du programme
+ * \param mapsize la taille de la projection
+ * \return \c LOAD_OK, ou la cause de l'échec
+ */
+static Load_Status load_image(Machine *mach, void *image, size_t size, size_t mapsize)
+{
+	bool text_in_image = true;
+	bool cache = text_cache_enabled();
+	Load_Status status;
+	Text_Key key;
+
+	if (cache) {
+		text_cache_key(image, size, &key);
+		cached_pending = text_cache_lookup(&key, &cached_text);
+	}
 
-	text = malloc(textsize * sizeof(Instruction));
-	data = malloc(datasize * 4);
+	if (is_bin_v2(image, size))
+		status = load_bin_v2(mach, image, size, &text_in_image);
+	else
+		status = load_legacy(mach, image, size);
 
-	// Initialisation du segment de texte
-	for (i = 0; i < textsize; ++i) {
-		fread(&text[i]._raw, sizeof(uint32_t), 1, fp);
+	if (cached_pending) {
+		text_cache_release(cached_text._ops, cached_text._mapsize);
+		cached_pending = false;
 	}
+	if (status == LOAD_OK && cache && mach->_decodedsize == 0)
+		text_cache_store(&key, mach);
 
-	// Initialisation du segment de donnée
-	for (i = 0; i < dataend; ++i) {
-		fread(&data[i], sizeof(uint32_t), 1, fp);
+	if (status != LOAD_OK || !text_in_image) {
+		munmap(image, mapsize);
+		image = NULL;
 	}
-	
-	// Fermeture du fichier
-	fclose(fp);
+	if (status == LOAD_OK) {
+		mach->_image = image;
+		mach->_imagesize = image != NULL ? mapsize : 0;
+	}
+	return status;
+}
+
+//! Lecture de \p n octets d'un descripteur
+/*!
+ * \return le nombre d'octets lus (moins de \p n à la fin du flot), ou -1
+ */
+static ssize_t read_full(int fd, unsigned char *buf, size_t n)
+{
+	size_t done = 0;
+
+	while (done < n) {
+		ssize_t got = read(fd, buf + done, n - done);
+		if (got == 0)
+			break;
+		if (got < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		done += got;
+	}
+	return done;
+}
+
+//! Taille d'un programme au format historique dans un flot
+/*!
+ * Dans un flot, un programme historique est tel que l'écrit dump_memory() :
+ * l'en-tête, les \c textsize instructions et les \c datasize mots de
+ * données.
+ *
+ * \param image le début du programme
+ * \param size le nombre d'octets disponibles
+ * \return la taille du programme, ou celle de l'en-tête s'il n'est pas complet
+ */
+static size_t legacy_size(const void *image, size_t size)
+{
+	unsigned header[3];
+
+	if (size < HEADER_SIZE)
+		return HEADER_SIZE;
+	memcpy(header, image, HEADER_SIZE);
+	return HEADER_SIZE + ((size_t) header[0] + header[1]) * sizeof(Word);
+}
+
+//! Lecture d'un programme depuis un descripteur de fichier, en un seul passage
+Load_Status stream_program(Machine *mach, int fd)
+{
+	unsigned char *image = NULL;
+	size_t have = 0, mapsize = 0, need = sizeof(uint32_t);
+	bool v2 = false;
+
+	// Lecture par étapes : signature, en-tête, table des sections, puis le
+	// reste ; chaque étape donne la taille à atteindre pour la suivante
+	while (have < need) {
+		void *grown = mmap(NULL, need, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (grown == MAP_FAILED) {
+			if (image != NULL)
+				munmap(image, mapsize);
+			return LOAD_MEMORY;
+		}
+		if (image != NULL) {
+			memcpy(grown, image, have);
+			munmap(image, mapsize);
+		}
+		image = grown;
+		mapsize = need;
+
+		ssize_t got = read_full(fd, image + have, need - have);
+		if (got < 0) {
+			munmap(image, mapsize);
+			return LOAD_OPEN;
+		}
+		have += got;
+		if (have < need) {
+			// Fin du flot : avant le programme, ou dans un programme
+			// historique déjà complet (sans sa pile)
+			if (have >= HEADER_SIZE && !v2)
+				break;
+			munmap(image, mapsize);
+			return have == 0 ? LOAD_END : LOAD_FORMAT;
+		}
+		if (have == sizeof(uint32_t))
+			v2 = is_bin_v2(image, have);
+		need = v2 ? bin_v2_size(image, have) : legacy_size(image, have);
+	}
+
+	return load_image(mach, image, have, mapsize);
+}
+
+//! Lecture d'un programme depuis un fichier binaire, sans fin du simulateur
+/*!
+ * Un fichier ordinaire est projeté en lecture seule. Le nom \c - désigne
+ * l'entrée standard ; elle est lue, comme un tube ou tout fichier qui ne
+ * peut être projeté, par stream_program().
+ *
+ * \param mach la machine à simuler
+ * \param programfile le nom du fichier binaire, ou NULL (\c LOAD_OPEN)
+ * \return \c LOAD_OK, ou la cause de l'échec
+ */
+Load_Status try_read_program(Machine *mach, const char *programfile)
+{
+	int fd;
+	struct stat st;
+	void *image;
+	Load_Status status;
+
+	if (programfile == NULL)
+		return LOAD_OPEN;
+	if (strcmp(programfile, "-") == 0) {
+		status = stream_program(mach, STDIN_FILENO);
+		return status == LOAD_END ? LOAD_FORMAT : status;
+	}
+
+	// On ouvre le fichier en lecture
+	if ((fd = open(programfile, O_RDONLY)) < 0)
+		return LOAD_OPEN;
+	if (fstat(fd, &st) < 0 || S_ISDIR(st.st_mode)) {
+		close(fd);
+		return LOAD_OPEN;
+	}
+	if (!S_ISREG(st.st_mode)) {
+		status = stream_program(mach, fd);
+		close(fd);
+		return status == LOAD_END ? LOAD_FORMAT : status;
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		return LOAD_FORMAT;
+	}
+
+	image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED)
+		return LOAD_MEMORY;
+	return load_image(mach, image, st.st_size, st.st_size);
+}
+
+//! Message associé au résultat d'un chargement
+const char *load_message(Load_Status status)
+{
+	static const char *messages[] = {
+		[LOAD_OK] = "Programme chargé.",
+		[LOAD_OPEN] = "Ouverture du fichier impossible.",
+		[LOAD_FORMAT] = "Fichier binaire invalide.",
+		[LOAD_CHECKSUM] = "Somme de contrôle du fichier binaire incorrecte.",
+		[LOAD_END] = "Fin du flot de programmes.",
+		[LOAD_MEMORY] = "Mémoire insuffisante.",
+	};
+
+	return messages[status];
+}
 
-	// Initialisation des données dans la machine
-	load_program(mach, textsize, text, datasize, data, dataend);
+//! Libération d'un programme lu par read_program() ou try_read_program()
+/*!
+ * \param mach la machine dont on libère les segments
+ */
+void free_program(Machine *mach)
+{
+	if (mach->_image != NULL)
+		munmap(mach->_image, mach->_imagesize);
+	else
+		free(mach->_text);
+	if (mach->_guard != NULL)
+		guard_free(mach);
+	else
+		data_free(mach->_data, mach->_datasize);
+	if (mach->_decodedsize != 0)
+		text_cache_release(mach->_decoded, mach->_decodedsize);
+	else
+		free(mach->_decoded);
+	metrics_free(mach->_metrics);
+	free(mach->_threaded);
+	free(mach->_dirty);
+	mach->_image = NULL;
+	mach->_dirty = NULL;
+	mach->_text = NULL;
+	mach->_data = NULL;
+	mach->_decoded = NULL;
+	mach->_threaded = NULL;
+	mach->_metrics = NULL;
 }
 
 //! Affichage du programme et des données
@@ -110,12 +403,14 @@ void read_program(Machine *mach, const char *programfile)
  * Dump binaire dans le fichier dump.bin, on peut exécuter ce programme
  * à l'aide de l'option -b de text_simul.c.
  *
- * On écrit les données dans l'ordre de lecture de read_program().
+ * On écrit les données dans l'ordre de lecture de read_program(), au format
+ * historique ou au format version 2 (voir binfile.h).
  *
  * \param pmach la machine en cours d'exécution
+ * \param format le format du fichier dump.bin
  *
  */
-void dump_memory(Machine *pmach)
+void dump_memory(Machine *pmach, Bin_Format format)
 {
 	FILE * fp;
 	int i;
@@ -127,33 +422,26 @@ void dump_memory(Machine *pmach)
 		exit(1);
 	}
 
-	// Ecriture de la taille du segment texte
-	fwrite(&pmach->_textsize, sizeof(int), 1, fp);
+	// Ecriture du fichier binaire, dans le format demandé
+	if (!write_program(pmach, fp, format))
+		fprintf(stderr, "Ecriture du fichier dump.bin impossible.\n");
 
-	// Ecriture de la taille du segment de données
-	fwrite(&pmach->_datasize, sizeof(int), 1, fp);
-
-	// Ecriture de l'adresse de fin des données
-	fwrite(&pmach->_dataend, sizeof(int), 1, fp);
-
-	// Ecriture du segment texte
-	printf("Instruction text[] = {\n\t");
+	// Affichage du segment texte
+	fprintf(sim_output(), "Instruction text[] = {\n\t");
 	for (i = 0; i < pmach->_textsize; ++i) {
 		c = (i+1) % 4 ? ", " : ",\n\t";
-		fwrite(&pmach->_text[i]._raw, sizeof(uint32_t), 1, fp);
-		printf("0x%.8x%s",pmach->_text[i]._raw,c);
+		fprintf(sim_output(), "0x%.8x%s",pmach->_text[i]._raw,c);
 	}
-	printf("\n};\nunsigned textsize = %d;\n", pmach->_textsize);
+	fprintf(sim_output(), "\n};\nunsigned textsize = %d;\n", pmach->_textsize);
 
-	// Ecriture du segment de données
-	printf("\nWord data[] = {\n\t");
+	// Affichage du segment de données
+	fprintf(sim_output(), "\nWord data[] = {\n\t");
 	for (i = 0; i < pmach->_datasize; ++i) {
 		c = (i+1) % 4 ? ", " : ",\n\t";
-		fwrite(&pmach->_data[i], sizeof(uint32_t), 1, fp);
-		printf("0x%.8x%s",pmach->_data[i],c);
+		fprintf(sim_output(), "0x%.8x%s",pmach->_data[i],c);
 	}
-	printf("\n};\nunsigned datasize = %d;\n", pmach->_datasize);
-	printf("unsigned dataend = %d;\n", pmach->_dataend);
+	fprintf(sim_output(), "\n};\nunsigned datasize = %d;\n", pmach->_datasize);
+	fprintf(sim_output(), "unsigned dataend = %d;\n", pmach->_dataend);
 
 	// Fermeture du fichier
 	fclose(fp);
@@ -165,14 +453,14 @@ void dump_memory(Machine *pmach)
  */
 void print_program(Machine *pmach)
 {
-	printf("\n*** PROGRAM (size: %d) ***\n", pmach->_textsize);
+	fprintf(sim_output(), "\n*** PROGRAM (size: %d) ***\n", pmach->_textsize);
 
 	int i;
 
 	for(i = 0; i < pmach->_textsize; ++i) {
-		printf("0x%.4x: 0x%.8x\t", i, pmach->_text[i]._raw);
+		fprintf(sim_output(), "0x%.4x: 0x%.8x\t", i, pmach->_text[i]._raw);
 		print_instruction(pmach->_text[i], i);
-		printf("\n");
+		fprintf(sim_output(), "\n");
 	}
 }
 
@@ -186,15 +474,15 @@ void print_data(Machine *pmach)
 	Word word;
 	char c = '\t';
 
-	printf("\n*** DATA (size: %d, end = 0x%.8x (%d)) ***\n", pmach->_datasize, pmach->_dataend, pmach->_dataend);
+	fprintf(sim_output(), "\n*** DATA (size: %d, end = 0x%.8x (%d)) ***\n", pmach->_datasize, pmach->_dataend, pmach->_dataend);
 
 	for(i = 0; i < pmach->_datasize; ++i) {
 		c = (i+1) % 3 ? '\t': '\n';
 		word = *(pmach->_data + i);
-		printf("0x%.4x: 0x%.8x %d%c",i,word,word,c);
+		fprintf(sim_output(), "0x%.4x: 0x%.8x %d%c",i,word,word,c);
 	}
 
-	printf("\n");
+	fprintf(sim_output(), "\n");
 }
 
 //! Affichage des registres du CPU
@@ -207,7 +495,7 @@ void print_cpu(Machine *pmach)
 	int i;
 	Word word;
 	
-	printf("\n*** CPU ***\n");
+	fprintf(sim_output(), "\n*** CPU ***\n");
 
 	switch(pmach->_cc) {
 		case CC_Z:
@@ -223,45 +511,179 @@ void print_cpu(Machine *pmach)
 			c = 'U';
 	}
 
-	printf("PC: 0x%.8x\tCC: %c\n\n", pmach->_pc, c);
+	fprintf(sim_output(), "PC: 0x%.8x\tCC: %c\n\n", pmach->_pc, c);
 
 	for(i = 0; i < NREGISTERS; ++i) {
 		c = (i+1) % 3 ? '\t': '\n';
 		word = pmach->_registers[i];
-		printf("R%.2d: 0x%.8x %d%c",i,word,word,c);
+		fprintf(sim_output(), "R%.2d: 0x%.8x %d%c",i,word,word,c);
 	}
-	printf("\n");
+	fprintf(sim_output(), "\n");
 }
 
-//! Simulation
+//! Instruction tracée au niveau donné ?
+/*!
+ * \param level le niveau de trace
+ * \param op l'instruction pré-décodée
+ * \return vrai si l'instruction doit être affichée par trace()
+ */
+static inline bool traced(Trace_Level level, const Micro_Op *op)
+{
+	switch (level) {
+		case TRACE_OFF:
+			return false;
+		case TRACE_BRANCHES:
+			return op->_cop == BRANCH || op->_cop == CALL || op->_cop == RET;
+		case TRACE_CALLS:
+			return op->_cop == CALL || op->_cop == RET;
+		default:
+			return true;
+	}
+}
+
+//! Exécution d'une instruction
 /*!
  * Appel de la fonction error() si la valeur de pc est plus grande
  * que la valeur de textsize.
  *
- * Affichage de la ligne à exécuter avec la fonction trace().
- *
- * Décodage et exécution de l'instruction avec la fonction decode_execute().
- *
- * Lancement de la fonction de débugage avec debug_ask().
+ * Affichage de la ligne à exécuter avec la fonction trace() si le niveau
+ * de trace la retient.
  *
- * On incrémente la valeur de PC à chaque itération de la boucle. 
+ * Exécution de l'instruction pré-décodée par sa fonction d'exécution
+ * (voir decode_program()).
  *
+ * \param pmach la machine en cours d'exécution
+ * \param level le niveau de trace
+ * \return faux si l'exécution est terminée (HALT)
+ */
+static inline bool step(Machine *pmach, Trace_Level level)
+{
+	if (pmach->_pc >= pmach->_textsize) {
+		error(ERR_SEGTEXT, pmach->_pc);
+	}
+	pmach->_pc = pmach->_pc + 1;
+	Micro_Op *op = &pmach->_decoded[pmach->_pc - 1];
+	if (traced(level, op)) {
+		trace("Executing", pmach, pmach->_text[pmach->_pc - 1], pmach->_pc - 1);
+	}
+	pmach->_icount += 1;
+	return op_handler(op)(pmach, op);
+}
+
+//! Définition de la boucle de simulation d'un niveau de trace
+/*!
+ * Le niveau est une constante dans chaque boucle : le test de traced()
+ * disparaît après mise en ligne de step().
+ */
+#define DEFINE_SIMUL_LOOP(name, level)				\
+	static void simul_##name(Machine *pmach)		\
+	{							\
+		while (step(pmach, level))			\
+			;					\
+	}							\
+								\
+	static bool simul_##name##_until(Machine *pmach, uint64_t *limit) \
+	{							\
+		while (pmach->_icount < __atomic_load_n(limit, __ATOMIC_RELAXED)) \
+			if (!step(pmach, level))		\
+				return false;			\
+		return true;					\
+	}
+
+DEFINE_SIMUL_LOOP(off, TRACE_OFF)
+DEFINE_SIMUL_LOOP(branches, TRACE_BRANCHES)
+DEFINE_SIMUL_LOOP(calls, TRACE_CALLS)
+DEFINE_SIMUL_LOOP(full, TRACE_FULL)
+
+//! Simulation
+/*!
  * \param pmach la machine en cours d'exécution
  * \param debug mode de mise au point (pas à apas) ?
  */
 void simul(Machine *pmach, bool debug)
 {
-	bool execute = true;
+	simul_trace(pmach, debug, TRACE_FULL);
+}
+
+//! Simulation avec un niveau de trace donné
+/*!
+ * Lancement de la fonction de débugage avec debug_ask() après chaque
+ * instruction tant que l'utilisateur ne demande pas de continuer.
+ *
+ * \param pmach la machine en cours d'exécution
+ * \param debug mode de mise au point (pas à apas) ?
+ * \param level le niveau de trace
+ */
+void simul_trace(Machine *pmach, bool debug, Trace_Level level)
+{
+	while (debug) {
+		bool execute = step(pmach, level);
+		debug = debug_ask(pmach);
+		if (!execute) {
+			return;
+		}
+	}
 
-	while(execute) {
-		if (pmach->_pc >= pmach->_textsize) {
-			error(ERR_SEGTEXT, pmach->_pc);
-		} 
-		pmach->_pc = pmach->_pc + 1;
-		trace("Executing", pmach, pmach->_text[pmach->_pc - 1], pmach->_pc - 1);
-		execute = decode_execute(pmach, pmach->_text[pmach->_pc - 1]);
-		if (debug) {
-			debug = debug_ask(pmach);
-		}	
+	switch (level) {
+		case TRACE_OFF:
+			simul_off(pmach);
+			break;
+		case TRACE_BRANCHES:
+			simul_branches(pmach);
+			break;
+		case TRACE_CALLS:
+			simul_calls(pmach);
+			break;
+		default:
+			simul_full(pmach);
+			break;
+	}
+}
+
+//! Simulation bornée en nombre d'instructions
+bool simul_until(Machine *pmach, Trace_Level level, uint64_t *limit)
+{
+	switch (level) {
+		case TRACE_OFF:
+			return simul_off_until(pmach, limit);
+		case TRACE_BRANCHES:
+			return simul_branches_until(pmach, limit);
+		case TRACE_CALLS:
+			return simul_calls_until(pmach, limit);
+		default:
+			return simul_full_until(pmach, limit);
+	}
+}
+
+//! Paramètres de la simulation exécutée par catch_error()
+typedef struct
+{
+	Machine *_pmach;
+	Trace_Level _level;
+} Simul_Args;
+
+//! Simulation exécutée par catch_error()
+static void run_simul(void *arg)
+{
+	Simul_Args *args = arg;
+	simul_trace(args->_pmach, false, args->_level);
+}
+
+//! Simulation avec compte rendu d'erreur
+/*!
+ * \param pmach la machine en cours d'exécution
+ * \param level le niveau de trace
+ * \return le compte rendu de l'exécution
+ */
+Run_Status simul_run(Machine *pmach, Trace_Level level)
+{
+	Simul_Args args = {pmach, level};
+	Run_Status status = {RUN_HALT, ERR_NOERROR, 0};
+
+	if (catch_error(run_simul, &args, &status._err, &status._pc)) {
+		status._pc = pmach->_pc - 1;
+	} else {
+		status._state = RUN_ERROR;
 	}
+	return status;
 }
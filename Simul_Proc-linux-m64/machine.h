@@ -7,12 +7,18 @@
  */
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "instruction.h"
+#include "error.h"
 
 //! Nombre de resitres généraux
 #define NREGISTERS 16
 
+//! Nombre de mots d'une page du segment de données (suivi des pages modifiées)
+#define DATA_PAGE_WORDS 1024
+
 //! Code condition
 /*! 
  * Le code condition donne le signe du résultat de la dernière instruction
@@ -37,6 +43,40 @@ static const unsigned LAST_CC = CC_N;
 //! Taille minimale de la pile d'exécution
 static const unsigned MINSTACKSIZE = 10;
 
+//! Niveau de trace de la simulation
+/*!
+ * Seules les instructions retenues par le niveau sont affichées par trace().
+ */
+typedef enum
+{
+    TRACE_OFF = 0,	//!< Aucune trace
+    TRACE_BRANCHES,	//!< Ruptures de séquence : BRANCH, CALL et RET
+    TRACE_CALLS,	//!< Appels et retours de sous-programmes : CALL et RET
+    TRACE_FULL,		//!< Toutes les instructions
+} Trace_Level;
+
+//! Dernière valeur possible du niveau de trace
+static const unsigned LAST_TRACE_LEVEL = TRACE_FULL;
+
+//! Issue d'une exécution
+typedef enum
+{
+    RUN_CONTINUE = 0,	//!< Instruction exécutée, le programme continue
+    RUN_HALT,		//!< Arrêt normal sur HALT
+    RUN_ERROR,		//!< Erreur d'exécution (ILLOP : code ERR_NOERROR)
+} Run_State;
+
+//! Compte rendu d'une exécution (voir simul_run())
+typedef struct
+{
+    Run_State _state;	//!< Issue de l'exécution
+    Error _err;		//!< Code de l'erreur (\c RUN_ERROR)
+    unsigned _pc;	//!< Adresse signalée : erreur, ou HALT exécuté
+} Run_Status;
+
+struct Micro_Op;
+struct Metrics;
+
 //! Structure générale de la machine.
 /*!
  * Cette machine simple est composée de mémoire et d'un processeur. 
@@ -78,11 +118,27 @@ typedef struct
 
     unsigned int _dataend;      //!< Première adresse libre après les données statiques
 
+    void *_image;		//!< Projection du fichier binaire (voir try_read_program())
+    size_t _imagesize;		//!< Taille de la projection
+
+    uint8_t *_dirty;		//!< Pages de données modifiées, ou NULL sans suivi (voir checkpoint.h)
+
+    void *_guard;		//!< Réservation du segment de données gardé, ou NULL (voir guard.h)
+    size_t _guardsize;		//!< Taille de la réservation
+
+    struct Micro_Op *_decoded;	//!< Segment de texte pré-décodé (voir exec.h)
+    void **_threaded;		//!< Étiquettes de simul_threaded() par adresse, ou NULL avant la première exécution
+    size_t _decodedsize;	//!< Taille de sa projection depuis le cache, ou 0 s'il est alloué (voir textcache.h)
+    struct Metrics *_metrics;	//!< Compteurs d'exécution (voir metrics.h)
+
     // Registres de l'unité centrale
     unsigned _pc;		//!< Compteur ordinal
     Condition_Code _cc;		//!< Code condition : signe de la dernière opération
     Word _registers[NREGISTERS];//!< Registres généraux (accumulateurs)
 
+    uint64_t _icount;		//!< Nombre d'instructions exécutées
+    int _depth;			//!< Profondeur d'appel : CALL exécutés moins RET (non tenue par simul_jit())
+
 //! Définition de _sp comme synonyme du registre R15    
 #   define _sp _registers[NREGISTERS - 1] 
 } Machine;
@@ -97,14 +153,24 @@ typedef struct
  * \param text le contenu du segment de texte
  * \param datasize taille utile du segment de données
  * \param data le contenu initial du segment de texte
+ *
+ * Le segment de texte est pré-décodé une fois pour toutes (voir
+ * decode_program()), puis vérifié (voir verify_program()). Le segment de
+ * données d'une machine libérée par free_program() doit venir de
+ * data_alloc() (voir paging.h).
+ *
+ * \return faux si la mémoire manque pour le segment pré-décodé ou les
+ * compteurs d'exécution ; la machine est alors sans programme, et les
+ * segments fournis restent à la charge de l'appelant
  */
-void load_program(Machine *pmach,
+bool load_program(Machine *pmach,
                   unsigned textsize, Instruction text[textsize],
                   unsigned datasize, Word data[datasize],  unsigned dataend);
 
 //! Lecture d'un programme depuis un fichier binaire
 /*!
- * Le fichier binaire a le format suivant :
+ * Le fichier binaire est soit au format version 2 (voir binfile.h), soit
+ * au format historique suivant :
  * 
  *    - 3 entiers non signés, la taille du segment de texte (\c textsize),
  *    celle du segment de données (\c datasize) et la première adresse libre de
@@ -117,14 +183,87 @@ void load_program(Machine *pmach,
  *    segment de données.
  *
  * Tous les entiers font 32 bits et les adresses de chaque segment commencent à
- * 0. La fonction initialise complétement la machine.
+ * 0. La fonction initialise complétement la machine. Les segments lus
+ * restent alloués jusqu'à free_program() ; un hôte qui enchaîne les
+ * chargements utilise plutôt machine_load() (voir pool.h).
  *
  * \param pmach la machine à simuler
  * \param programfile le nom du fichier binaire
  *
  */
 void read_program(Machine *mach, const char *programfile);  
+
+//! Résultat du chargement d'un programme depuis un fichier binaire
+typedef enum
+{
+    LOAD_OK,		//!< Programme chargé
+    LOAD_OPEN,		//!< Le fichier ne peut être ouvert
+    LOAD_FORMAT,	//!< En-tête incohérent ou fichier tronqué
+    LOAD_CHECKSUM,	//!< Contenu altéré (format version 2)
+    LOAD_MEMORY,	//!< Projection ou allocation impossible
+    LOAD_END,		//!< Fin du flot, avant tout programme (stream_program())
+} Load_Status;
+
+//! Lecture d'un programme depuis un fichier binaire, sans fin du simulateur
+/*!
+ * Comme read_program(), mais un échec est rapporté à l'appelant. Le nom
+ * \c - désigne l'entrée standard ; l'entrée standard et les fichiers qui ne
+ * sont pas des fichiers ordinaires (tubes nommés...) sont lus par
+ * stream_program().
+ *
+ * Le fichier est projeté en mémoire : le segment de texte de la machine
+ * pointe dans la projection, qui doit rester en place jusqu'à
+ * free_program(). Un fichier dont l'en-tête est incohérent (\c dataend
+ * au-delà de \c datasize) ou qui est plus court que ce qu'annonce son
+ * en-tête est refusé avant tout chargement.
+ *
+ * \param mach la machine a initialiser
+ * \param programfile le nom du fichier binaire, ou NULL (\c LOAD_OPEN)
+ * \return \c LOAD_OK, ou la cause de l'échec
+ */
+Load_Status try_read_program(Machine *mach, const char *programfile);
+
+//! Lecture d'un programme depuis un descripteur de fichier, en un seul passage
+/*!
+ * Le programme est lu séquentiellement (tube, entrée standard...), sans
+ * retour en arrière ni lecture au-delà de sa fin : des programmes peuvent
+ * être concaténés dans un même flot et lus par des appels successifs. La fin
+ * d'un programme est donnée par son en-tête : bin_v2_size() au format
+ * version 2 ; au format historique, les \c textsize instructions et les
+ * \c datasize mots de données, tels que les écrit dump_memory() (le dernier
+ * programme du flot peut s'arrêter après ses \c dataend mots de données).
+ *
+ * \param mach la machine a initialiser
+ * \param fd le descripteur
+ * \return \c LOAD_OK ; \c LOAD_END si le flot est terminé avant le
+ * programme ; ou la cause de l'échec
+ */
+Load_Status stream_program(Machine *mach, int fd);
+
+//! Message associé au résultat d'un chargement
+/*!
+ * \param status le résultat de try_read_program()
+ * \return le message (chaîne constante)
+ */
+const char *load_message(Load_Status status);
+
+//! Libération d'un programme lu par read_program() ou try_read_program()
+/*!
+ * Le segment de données est libéré par data_free(), ou par guard_free() si
+ * la machine est gardée.
+ *
+ * \param mach la machine dont on libère les segments
+ */
+void free_program(Machine *mach);
  
+//! Format d'un fichier binaire écrit par dump_memory()
+typedef enum
+{
+    BIN_LEGACY,		//!< Format historique (entiers dans l'ordre de l'hôte)
+    BIN_V2,		//!< Format version 2 (voir binfile.h)
+    BIN_V2_LZ,		//!< Format version 2, sections compressées
+} Bin_Format;
+
 //! Affichage du programme et des données
 /*!
  * On affiche les instruction et les données en format hexadécimal, sous une
@@ -135,8 +274,9 @@ void read_program(Machine *mach, const char *programfile);
  * test_simul.
  *
  * \param pmach la machine en cours d'exécution
+ * \param format le format du dump binaire
  */
-void dump_memory(Machine *pmach);
+void dump_memory(Machine *pmach, Bin_Format format);
 
 //! Affichage des instructions du programme
 /*!
@@ -165,12 +305,59 @@ void print_cpu(Machine *pmach);
 //! Simulation
 /*!
  * La boucle de simualtion est très simple : recherche de l'instruction
- * suivante (pointée par le compteur ordinal \c _pc) puis décodage et exécution
- * de l'instruction.
+ * suivante (pointée par le compteur ordinal \c _pc) dans le segment
+ * pré-décodé puis exécution de l'instruction.
+ *
+ * Chaque instruction est tracée (niveau \c TRACE_FULL, voir simul_trace()).
  *
  * \param pmach la machine en cours d'exécution
  * \param debug mode de mise au point (pas à apas) ?
  */
 void simul(Machine *pmach, bool debug);
 
+//! Simulation avec un niveau de trace donné
+/*!
+ * Chaque niveau de trace a sa propre boucle de simulation, où le choix des
+ * instructions à tracer est résolu à la compilation : la boucle sans trace
+ * ne teste rien d'autre que le compteur ordinal.
+ *
+ * En mode de mise au point, les instructions sont exécutées une à une par
+ * une boucle générique jusqu'à ce que l'utilisateur demande de continuer ;
+ * la suite de l'exécution passe par la boucle du niveau de trace.
+ *
+ * \param pmach la machine en cours d'exécution
+ * \param debug mode de mise au point (pas à apas) ?
+ * \param level le niveau de trace
+ */
+void simul_trace(Machine *pmach, bool debug, Trace_Level level);
+
+//! Simulation bornée en nombre d'instructions
+/*!
+ * Comme simul_trace() sans mise au point, mais la simulation s'arrête
+ * aussi dès que le compteur d'instructions atteint \p *limit. La borne est
+ * relue avant chaque instruction : elle peut être abaissée pendant la
+ * simulation (par un gestionnaire de signal, par exemple) pour l'arrêter
+ * au plus tôt.
+ *
+ * \param pmach la machine en cours d'exécution
+ * \param level le niveau de trace
+ * \param limit la borne du compteur d'instructions
+ * \return faux si l'exécution est terminée (HALT), vrai si la borne est atteinte
+ */
+bool simul_until(Machine *pmach, Trace_Level level, uint64_t *limit);
+
+//! Simulation avec compte rendu d'erreur
+/*!
+ * Comme simul_trace() sans mise au point, mais une erreur d'exécution ne
+ * termine pas le programme : elle est rapportée à l'appelant avec l'adresse
+ * que error() aurait affichée, sans message. La machine reste dans l'état
+ * atteint au moment de l'erreur et peut être rechargée ou examinée.
+ *
+ * \param pmach la machine en cours d'exécution
+ * \param level le niveau de trace
+ * \return \c RUN_HALT avec l'adresse du HALT, ou \c RUN_ERROR avec le code et
+ * l'adresse de l'erreur
+ */
+Run_Status simul_run(Machine *pmach, Trace_Level level);
+
 #endif
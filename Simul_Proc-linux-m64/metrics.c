@@ -0,0 +1,219 @@
+/*!
+ * \file metrics.c
+ * \brief Compteurs d'exécution de la machine, exportés en JSON
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "metrics.h"
+
+//! Noms des variantes, pour l'export
+static const char *kind_names[NKINDS] = {
+#define KIND_NAME(kind, name) [OP_##kind] = #name,
+	OP_KINDS(KIND_NAME)
+#undef KIND_NAME
+};
+
+//! Première variante de chaque super-instruction
+static const uint8_t fused_firsts[NKINDS] = {
+#define PAIR_FIRST(kind, first, second) [OP_##kind] = OP_##first,
+	FUSED_PAIRS(PAIR_FIRST)
+#undef PAIR_FIRST
+#define TRIPLE_FIRST(kind, first, second, third) [OP_##kind] = OP_##first,
+	FUSED_TRIPLES(TRIPLE_FIRST)
+#undef TRIPLE_FIRST
+};
+
+//! Code opération de chaque variante simple, ou -1 pour une instruction invalide
+static const int8_t kind_cops[FIRST_FUSED_KIND] = {
+	[OP_ILLOP] = ILLOP,
+	[OP_NOP] = NOP,
+	[OP_LOAD_IMM] = LOAD, [OP_LOAD_ABS] = LOAD, [OP_LOAD_IDX] = LOAD,
+	[OP_STORE_ABS] = STORE, [OP_STORE_IDX] = STORE,
+	[OP_ADD_IMM] = ADD, [OP_ADD_ABS] = ADD, [OP_ADD_IDX] = ADD,
+	[OP_SUB_IMM] = SUB, [OP_SUB_ABS] = SUB, [OP_SUB_IDX] = SUB,
+	[OP_BRANCH_ABS] = BRANCH, [OP_BRANCH_IDX] = BRANCH,
+	[OP_CALL_ABS] = CALL, [OP_CALL_IDX] = CALL,
+	[OP_RET] = RET,
+	[OP_PUSH_IMM] = PUSH, [OP_PUSH_ABS] = PUSH, [OP_PUSH_IDX] = PUSH,
+	[OP_POP_ABS] = POP, [OP_POP_IDX] = POP,
+	[OP_HALT] = HALT,
+	[OP_ERR_IMMEDIATE] = -1,
+	[OP_ERR_CONDITION] = -1,
+	[OP_UNKNOWN] = -1,
+	[OP_END] = -1,
+};
+
+//! Création des compteurs d'une machine
+bool metrics_init(Machine *pmach)
+{
+	Metrics *m = calloc(1, sizeof(Metrics));
+
+	if (m == NULL)
+		return false;
+	m->_size = pmach->_textsize;
+	m->_from = calloc(pmach->_textsize + 1, sizeof(uint64_t));
+	m->_to = calloc(pmach->_textsize + 1, sizeof(uint64_t));
+	if (m->_from == NULL || m->_to == NULL) {
+		metrics_free(m);
+		return false;
+	}
+	pmach->_metrics = m;
+	metrics_reset(pmach);
+	return true;
+}
+
+//! Remise à zéro des compteurs d'une machine
+void metrics_reset(Machine *pmach)
+{
+	Metrics *m = pmach->_metrics;
+	uint64_t *from = m->_from;
+	uint64_t *to = m->_to;
+
+	memset(from, 0, (m->_size + 1) * sizeof(uint64_t));
+	memset(to, 0, (m->_size + 1) * sizeof(uint64_t));
+	*m = (Metrics) {
+		._size = m->_size,
+		._from = from,
+		._to = to,
+		._startpc = pmach->_pc,
+		._starticount = pmach->_icount,
+		._topsp = pmach->_sp,
+	};
+}
+
+//! Libération des compteurs d'une machine
+void metrics_free(Metrics *m)
+{
+	if (m == NULL)
+		return;
+	free(m->_from);
+	free(m->_to);
+	free(m);
+}
+
+//! Fin d'une exécution
+/*!
+ * On arrive à une adresse par la séquence (les exécutions de l'adresse
+ * précédente qui n'ont pas rompu la séquence), par une rupture de séquence,
+ * ou au départ. Toute arrivée est une exécution, sauf la dernière si
+ * l'exécution s'est arrêtée avant l'instruction désignée par le compteur
+ * ordinal (après HALT, une erreur ou une borne de simul_until()).
+ */
+void metrics_finish(Machine *pmach, double seconds)
+{
+	Metrics *m = pmach->_metrics;
+	uint64_t sequence = 0;
+
+	memset(m->_kinds, 0, sizeof(m->_kinds));
+	m->_counted = m->_taken = m->_calls = m->_returns = 0;
+	for (unsigned a = 0; a < m->_size; ++a) {
+		uint64_t arrivals = sequence + m->_to[a] + (a == m->_startpc);
+		uint64_t executed = arrivals - (a == pmach->_pc && arrivals > 0);
+		unsigned kind = pmach->_decoded[a]._kind;
+
+		// Les instructions suivantes d'une super-instruction gardent leur variante simple
+		kind = kind < FIRST_FUSED_KIND ? kind : fused_firsts[kind];
+		m->_kinds[kind] += executed;
+		m->_counted += executed;
+		if (kind_cops[kind] == BRANCH)
+			m->_taken += m->_from[a];
+		else if (kind_cops[kind] == CALL)
+			m->_calls += m->_from[a];
+		else if (kind_cops[kind] == RET)
+			m->_returns += m->_from[a];
+		// Compteurs incohérents (simul_jit()) : metrics_json() le verra au total
+		sequence = executed > m->_from[a] ? executed - m->_from[a] : 0;
+	}
+	m->_programs = 1;
+	m->_instructions = pmach->_icount - m->_starticount;
+	m->_seconds = seconds;
+}
+
+//! Cumul des compteurs d'une exécution dans ceux d'un lot
+void metrics_add(Metrics *total, const Metrics *m)
+{
+	for (unsigned k = 0; k < FIRST_FUSED_KIND; ++k)
+		total->_kinds[k] += m->_kinds[k];
+	total->_taken += m->_taken;
+	total->_calls += m->_calls;
+	total->_returns += m->_returns;
+	if (m->_maxstack > total->_maxstack)
+		total->_maxstack = m->_maxstack;
+	total->_programs += m->_programs;
+	total->_instructions += m->_instructions;
+	total->_counted += m->_counted;
+	total->_seconds += m->_seconds;
+}
+
+//! Écriture d'une chaîne JSON
+static void json_string(FILE *fp, const char *s)
+{
+	fputc('"', fp);
+	for (; *s != '\0'; ++s) {
+		unsigned char c = *s;
+		if (c == '"' || c == '\\')
+			fprintf(fp, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(fp, "\\u%.4x", c);
+		else
+			fputc(c, fp);
+	}
+	fputc('"', fp);
+}
+
+//! Export des compteurs en JSON
+void metrics_json(FILE *fp, const char *program, const Metrics *m)
+{
+	const uint64_t *kinds = m->_kinds;
+	uint64_t cops[HALT + 1] = {0};
+	uint64_t invalid = 0;
+
+	for (unsigned k = 0; k < FIRST_FUSED_KIND; ++k) {
+		if (kind_cops[k] >= 0)
+			cops[kind_cops[k]] += kinds[k];
+		else if (k != OP_END)
+			invalid += kinds[k];
+	}
+
+	fprintf(fp, "{\"program\": ");
+	if (program != NULL)
+		json_string(fp, program);
+	else
+		fprintf(fp, "null, \"programs\": %u", m->_programs);
+	fprintf(fp, ", \"instructions\": %llu, \"seconds\": %.6f, \"mips\": %.3f",
+		(unsigned long long) m->_instructions, m->_seconds,
+		m->_seconds > 0 ? m->_instructions / m->_seconds * 1e-6 : 0.0);
+
+	if (m->_counted != m->_instructions) {
+		fprintf(fp, ", \"opcodes\": null, \"invalid\": null, \"variants\": null"
+			", \"loads\": null, \"stores\": null, \"branches\": null"
+			", \"calls\": null, \"returns\": null, \"max_stack_depth\": null");
+	} else {
+		fprintf(fp, ", \"opcodes\": {");
+		for (unsigned c = 0; c <= HALT; ++c)
+			fprintf(fp, "%s\"%s\": %llu", c > 0 ? ", " : "", cop_names[c], (unsigned long long) cops[c]);
+		fprintf(fp, "}, \"invalid\": %llu", (unsigned long long) invalid);
+
+		fprintf(fp, ", \"variants\": {");
+		const char *sep = "";
+		for (unsigned k = 0; k < FIRST_FUSED_KIND; ++k)
+			if (kinds[k] > 0) {
+				fprintf(fp, "%s\"%s\": %llu", sep, kind_names[k], (unsigned long long) kinds[k]);
+				sep = ", ";
+			}
+		fprintf(fp, "}");
+
+		fprintf(fp, ", \"loads\": {\"immediate\": %llu, \"absolute\": %llu, \"indexed\": %llu}",
+			(unsigned long long) kinds[OP_LOAD_IMM], (unsigned long long) kinds[OP_LOAD_ABS],
+			(unsigned long long) kinds[OP_LOAD_IDX]);
+		fprintf(fp, ", \"stores\": {\"absolute\": %llu, \"indexed\": %llu}",
+			(unsigned long long) kinds[OP_STORE_ABS], (unsigned long long) kinds[OP_STORE_IDX]);
+		fprintf(fp, ", \"branches\": {\"executed\": %llu, \"taken\": %llu}",
+			(unsigned long long) cops[BRANCH], (unsigned long long) m->_taken);
+		fprintf(fp, ", \"calls\": %llu, \"returns\": %llu, \"max_stack_depth\": %u",
+			(unsigned long long) m->_calls, (unsigned long long) m->_returns, (unsigned) m->_maxstack);
+	}
+	fprintf(fp, "}\n");
+}
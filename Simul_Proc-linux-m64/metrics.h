@@ -0,0 +1,148 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+/*!
+ * \file metrics.h
+ * \brief Compteurs d'exécution de la machine, exportés en JSON
+ *
+ * Les compteurs sont toujours tenus, sans rien coûter aux instructions qui
+ * ne rompent pas la séquence : seules les ruptures de séquence (\c BRANCH
+ * et \c CALL pris, \c RET) sont comptées, par adresse de départ et
+ * d'arrivée, ainsi que les empilements pour la profondeur de pile. Le
+ * nombre d'exécutions de chaque adresse s'en déduit exactement à la fin de
+ * l'exécution (metrics_finish()) : une instruction est exécutée autant de
+ * fois qu'on y arrive, par la séquence ou par une rupture. Le mélange des
+ * codes opérations, les accès par mode d'adressage et les ruptures par
+ * code opération en découlent.
+ *
+ * simul_jit() ne passe pas par les fonctions d'exécution des ruptures de
+ * séquence : ses compteurs sont incohérents avec le nombre d'instructions,
+ * et ne sont pas exportés (voir metrics_json()).
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "machine.h"
+#include "exec.h"
+
+//! Compteurs d'exécution d'une machine, ou d'un lot de machines
+typedef struct Metrics
+{
+    // Pendant l'exécution
+    unsigned _size;		//!< Taille du segment de texte
+    uint64_t *_from;		//!< Ruptures de séquence par adresse de départ
+    uint64_t *_to;		//!< Ruptures de séquence par adresse d'arrivée (la dernière case : hors du segment)
+    unsigned _startpc;		//!< Compteur ordinal au début de l'exécution
+    uint64_t _starticount;	//!< Compteur d'instructions au début de l'exécution
+    Word _topsp;		//!< Valeur de SP au début de l'exécution
+    Word _maxstack;		//!< Profondeur maximale de la pile, en mots au-dessous de \c _topsp
+
+    // Relevés par metrics_finish()
+    unsigned _programs;		//!< Nombre d'exécutions comptées
+    uint64_t _instructions;	//!< Nombre d'instructions exécutées
+    uint64_t _counted;		//!< Nombre d'instructions déduit des ruptures de séquence
+    double _seconds;		//!< Durée de l'exécution
+    uint64_t _kinds[FIRST_FUSED_KIND];	//!< Exécutions par variante
+    uint64_t _taken;		//!< Branchements (BRANCH) pris
+    uint64_t _calls;		//!< Appels (CALL) pris
+    uint64_t _returns;		//!< Retours (RET)
+} Metrics;
+
+//! Comptage d'une rupture de séquence
+/*!
+ * Appelée par la fonction d'exécution, le compteur ordinal désignant
+ * encore l'instruction suivante.
+ *
+ * \param pmach la machine en cours d'exécution
+ * \param target l'adresse d'arrivée, ou la taille du segment de texte
+ * pour une adresse hors du segment
+ */
+static inline void count_jump(Machine *pmach, unsigned target)
+{
+    Metrics *m = pmach->_metrics;
+
+    m->_from[pmach->_pc - 1] += 1;
+    m->_to[target] += 1;
+}
+
+//! Mise à jour de la profondeur maximale de la pile, après un empilement
+/*!
+ * \param pmach la machine en cours d'exécution
+ */
+static inline void count_push(Machine *pmach)
+{
+    Metrics *m = pmach->_metrics;
+    Word depth = m->_topsp - pmach->_sp;
+
+    if (depth > m->_maxstack)
+        m->_maxstack = depth;
+}
+
+//! Création des compteurs d'une machine
+/*!
+ * Appelée par load_program() ; les compteurs partent de l'état courant
+ * (voir metrics_reset()).
+ *
+ * \param pmach la machine
+ * \return faux si la mémoire manque
+ */
+bool metrics_init(Machine *pmach);
+
+//! Remise à zéro des compteurs d'une machine
+/*!
+ * L'exécution comptée part du compteur ordinal, du compteur d'instructions
+ * et de la valeur de SP courants : à rappeler quand on les fixe après
+ * load_program() (point d'entrée, reprise).
+ *
+ * \param pmach la machine
+ */
+void metrics_reset(Machine *pmach);
+
+//! Libération des compteurs d'une machine
+/*!
+ * \param m les compteurs, ou NULL
+ */
+void metrics_free(Metrics *m);
+
+//! Fin d'une exécution
+/*!
+ * Déduit des ruptures de séquence le nombre d'exécutions de chaque
+ * variante et le nombre de branchements, d'appels et de retours, et relève le nombre d'instructions exécutées par la machine et
+ * la durée mesurée par l'appelant.
+ *
+ * \param pmach la machine
+ * \param seconds la durée de l'exécution
+ */
+void metrics_finish(Machine *pmach, double seconds);
+
+//! Cumul des compteurs d'une exécution dans ceux d'un lot
+/*!
+ * Seuls les relevés s'additionnent ; la profondeur de pile retenue est la
+ * plus grande.
+ *
+ * \param total les compteurs du lot, initialement nuls
+ * \param m les compteurs de l'exécution, après metrics_finish()
+ */
+void metrics_add(Metrics *total, const Metrics *m);
+
+//! Export des compteurs en JSON
+/*!
+ * Un objet sur une ligne : \c program (\c null pour un lot, qui a aussi
+ * \c programs), \c instructions, \c seconds, \c mips, \c opcodes (le nombre
+ * d'exécutions de chaque code opération, par nom), \c invalid (instructions
+ * invalides exécutées), \c variants (les variantes exécutées, par nom),
+ * \c loads (LOAD par mode d'adressage : \c immediate, \c absolute,
+ * \c indexed), \c stores (STORE : \c absolute, \c indexed), \c branches
+ * (\c executed, \c taken), \c calls, \c returns et \c max_stack_depth.
+ * Les champs tirés des compteurs valent \c null s'ils ne rendent pas compte
+ * de toutes les instructions (simul_jit()).
+ *
+ * \param fp le flot
+ * \param program le nom du programme, ou NULL pour un lot
+ * \param m les compteurs, après metrics_finish()
+ */
+void metrics_json(FILE *fp, const char *program, const Metrics *m);
+
+#endif
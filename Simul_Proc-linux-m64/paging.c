@@ -0,0 +1,203 @@
+/*!
+ * \file paging.c
+ * \brief Segment de données alloué par pages, à la première écriture
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "paging.h"
+#include "error.h"
+
+//! Entrée de \c /proc/self/pagemap : page présente
+#define PAGEMAP_PRESENT (1ULL << 63)
+
+//! Entrée de \c /proc/self/pagemap : page d'un fichier ou anonyme partagée
+#define PAGEMAP_FILE (1ULL << 61)
+
+//! Entrée de \c /proc/self/pagemap : page projetée une seule fois
+#define PAGEMAP_EXCLUSIVE (1ULL << 56)
+
+//! Nombre maximal de segments libérés gardés pour être réutilisés
+#define DATA_RESERVE 16
+
+//! Segments libérés, vidés de leurs pages, en attente d'un nouveau chargement
+static struct
+{
+	pthread_mutex_t _lock;		//!< Accès concurrents (simulation par lots)
+	unsigned _count;		//!< Nombre de segments gardés
+	void *_data[DATA_RESERVE];	//!< Segments gardés
+	size_t _size[DATA_RESERVE];	//!< Taille de leur projection
+} reserve = {PTHREAD_MUTEX_INITIALIZER, 0, {NULL}, {0}};
+
+//! Taille d'une page de l'hôte
+static size_t host_page(void)
+{
+	return sysconf(_SC_PAGESIZE);
+}
+
+//! Taille de la projection d'un segment, ou 0 s'il est alloué par calloc()
+/*!
+ * Le nombre de pages est arrondi à une puissance de 2 : des segments de
+ * tailles voisines ont la même projection, et se réutilisent. Les pages en
+ * trop ne coûtent que de la mémoire virtuelle.
+ */
+static size_t mapped_size(unsigned datasize)
+{
+	size_t page = host_page();
+	size_t bytes = (size_t) datasize * sizeof(Word);
+	size_t size = page;
+
+	if (bytes < page)
+		return 0;
+	while (size < bytes)
+		size *= 2;
+	return size;
+}
+
+//! Allocation d'un segment de données nul
+Word *data_alloc(unsigned datasize)
+{
+	size_t size = mapped_size(datasize);
+	void *data = NULL;
+
+	if (size == 0)
+		return calloc(datasize > 0 ? datasize : 1, sizeof(Word));
+
+	pthread_mutex_lock(&reserve._lock);
+	for (unsigned i = 0; i < reserve._count; ++i)
+		if (reserve._size[i] == size) {
+			data = reserve._data[i];
+			--reserve._count;
+			reserve._data[i] = reserve._data[reserve._count];
+			reserve._size[i] = reserve._size[reserve._count];
+			break;
+		}
+	pthread_mutex_unlock(&reserve._lock);
+	if (data != NULL)
+		return data;
+
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return data == MAP_FAILED ? NULL : data;
+}
+
+//! Libération d'un segment alloué par data_alloc()
+void data_free(Word *data, unsigned datasize)
+{
+	size_t size = mapped_size(datasize);
+
+	if (data == NULL)
+		return;
+	if (size == 0) {
+		free(data);
+		return;
+	}
+
+	// Le segment rend ses pages mais garde sa projection
+	if (madvise(data, size, MADV_DONTNEED) == 0) {
+		pthread_mutex_lock(&reserve._lock);
+		if (reserve._count < DATA_RESERVE) {
+			reserve._data[reserve._count] = data;
+			reserve._size[reserve._count] = size;
+			++reserve._count;
+			data = NULL;
+		}
+		pthread_mutex_unlock(&reserve._lock);
+	}
+	if (data != NULL)
+		munmap(data, size);
+}
+
+//! La zone ne contient-elle que des octets nuls ?
+static bool all_zero(const char *bytes, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		if (bytes[i] != 0)
+			return false;
+	return true;
+}
+
+//! Remise à zéro d'octets, sans écrire (ni allouer) une page déjà nulle
+static void clear_bytes(char *bytes, size_t n)
+{
+	if (!all_zero(bytes, n))
+		memset(bytes, 0, n);
+}
+
+//! Copie du contenu initial d'un segment alloué par data_alloc()
+void data_load(Word *data, const void *words, unsigned n)
+{
+	const unsigned char *src = words;
+	size_t page = host_page();
+	size_t bytes = (size_t) n * sizeof(Word);
+
+	for (size_t start = 0; start < bytes; start += page) {
+		size_t len = bytes - start < page ? bytes - start : page;
+
+		if (!all_zero((const char *) src + start, len))
+			memcpy((char *) data + start, src + start, len);
+	}
+}
+
+//! Remise à zéro d'une partie d'un segment de données
+void data_clear(Word *data, unsigned n)
+{
+	size_t page = host_page();
+	char *start = (char *) data;
+	char *end = (char *) (data + n);
+	char *first = (char *) (((uintptr_t) start + page - 1) / page * page);
+	char *last = (char *) ((uintptr_t) end / page * page);
+
+	// Les pages entières sont rendues au noyau : elles se relisent nulles
+	if (first < last && madvise(first, last - first, MADV_DONTNEED) == 0) {
+		clear_bytes(start, first - start);
+		clear_bytes(last, end - last);
+	} else {
+		clear_bytes(start, end - start);
+	}
+}
+
+//! Nombre de pages du segment de données allouées à la machine
+bool data_resident(const Machine *pmach, unsigned *pages, unsigned *total)
+{
+	size_t page = host_page();
+	uintptr_t first = (uintptr_t) pmach->_data / page;
+	uintptr_t last = ((uintptr_t) (pmach->_data + pmach->_datasize) + page - 1) / page;
+	int fd = open("/proc/self/pagemap", O_RDONLY);
+	uint64_t entry;
+
+	*pages = 0;
+	*total = last - first;
+	if (fd < 0)
+		return false;
+	for (uintptr_t p = first; p < last; ++p) {
+		if (pread(fd, &entry, sizeof(entry), p * sizeof(entry)) != sizeof(entry)) {
+			close(fd);
+			return false;
+		}
+		if ((entry & PAGEMAP_PRESENT) && (entry & PAGEMAP_EXCLUSIVE) && !(entry & PAGEMAP_FILE))
+			*pages += 1;
+	}
+	close(fd);
+	return true;
+}
+
+//! Rapport d'occupation du segment de données
+void print_data_pages(const Machine *pmach)
+{
+	unsigned pages, total;
+
+	fprintf(sim_output(), "\n*** DATA PAGES ***\n");
+	if (data_resident(pmach, &pages, &total))
+		fprintf(sim_output(), "%u of %u pages of %zu bytes resident\n", pages, total, host_page());
+	else
+		fprintf(sim_output(), "resident pages unknown (no /proc/self/pagemap)\n");
+}
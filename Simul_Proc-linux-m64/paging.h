@@ -0,0 +1,89 @@
+#ifndef _PAGING_H_
+#define _PAGING_H_
+
+/*!
+ * \file paging.h
+ * \brief Segment de données alloué par pages, à la première écriture
+ *
+ * Un programme n'utilise souvent que quelques mots de données statiques en
+ * bas du segment et une pile courte en haut, alors que le segment peut
+ * atteindre 2^20 mots. Le segment est donc une projection anonyme
+ * (mmap()) : le noyau n'alloue une page qu'à sa première écriture, et une
+ * page jamais écrite se lit comme des zéros, sans occuper de mémoire. Les
+ * accès restent des indexations directes de \c _data, sans aucun test dans
+ * les fonctions d'exécution.
+ *
+ * Un segment de moins d'une page est simplement alloué par calloc().
+ *
+ * Un segment libéré rend ses pages au noyau mais garde sa projection, qui
+ * sert au prochain segment de taille voisine : un hôte qui charge programme
+ * après programme (simulation par lots, machine.h) ne refait pas à chaque
+ * fois la projection.
+ */
+
+#include <stdbool.h>
+
+#include "machine.h"
+
+//! Allocation d'un segment de données nul
+/*!
+ * \param datasize la taille du segment, en mots
+ * \return le segment, jamais NULL même vide, ou NULL si la mémoire manque
+ */
+Word *data_alloc(unsigned datasize);
+
+//! Libération d'un segment alloué par data_alloc()
+/*!
+ * Le segment, vidé de ses pages, est gardé pour être réutilisé par
+ * data_alloc() (au plus quelques segments, partagés par tous les
+ * processus légers).
+ *
+ * \param data le segment, ou NULL
+ * \param datasize sa taille, en mots
+ */
+void data_free(Word *data, unsigned datasize);
+
+//! Copie du contenu initial d'un segment alloué par data_alloc()
+/*!
+ * Les pages entièrement nulles ne sont pas écrites : elles ne sont pas
+ * allouées.
+ *
+ * \param data le segment
+ * \param words les mots à copier au début du segment (sans contrainte
+ * d'alignement)
+ * \param n leur nombre
+ */
+void data_load(Word *data, const void *words, unsigned n);
+
+//! Remise à zéro d'une partie d'un segment de données
+/*!
+ * Les pages entièrement couvertes sont rendues au noyau plutôt qu'écrites :
+ * elles ne sont plus allouées. Le segment vient de data_alloc() ou de
+ * guard_data() ; celui d'un clone (clone.h) se relirait avec le contenu de
+ * son modèle.
+ *
+ * \param data le début de la partie
+ * \param n son nombre de mots
+ */
+void data_clear(Word *data, unsigned n);
+
+//! Nombre de pages du segment de données allouées à la machine
+/*!
+ * Les pages sont celles de l'hôte ; une page comptée est propre à la
+ * machine : écrite par elle (ou copiée à sa première écriture, pour un
+ * clone), et non la page de zéros partagée d'une page seulement lue.
+ *
+ * \param pmach la machine
+ * \param pages le nombre de pages allouées
+ * \param total le nombre de pages du segment
+ * \return faux si le noyau ne permet pas de le savoir (\c /proc/self/pagemap)
+ */
+bool data_resident(const Machine *pmach, unsigned *pages, unsigned *total);
+
+//! Rapport d'occupation du segment de données
+/*!
+ * \param pmach la machine
+ */
+void print_data_pages(const Machine *pmach);
+
+#endif
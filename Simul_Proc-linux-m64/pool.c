@@ -0,0 +1,136 @@
+/*!
+ * \file pool.c
+ * \brief Cycle de vie des machines d'un hôte de longue durée
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+#include "metrics.h"
+#include "paging.h"
+
+//! Machine d'un réservoir
+/*!
+ * La machine est le premier champ : machine_create() la rend à l'hôte, et
+ * les autres fonctions retrouvent la structure par conversion du pointeur.
+ */
+typedef struct Pool_Machine
+{
+	Machine _mach;			//!< La machine
+	Machine_Pool *_pool;		//!< Son réservoir
+	bool _loaded;			//!< Un programme est-il chargé ?
+	Word *_initial;			//!< Données statiques au chargement (data_alloc())
+	unsigned _capacity;		//!< Taille de \c _initial, en mots
+	unsigned _pc;			//!< Compteur ordinal au chargement
+	Condition_Code _cc;		//!< Code condition au chargement
+	Word _registers[NREGISTERS];	//!< Registres au chargement
+	struct Pool_Machine *_next;	//!< Machine libre suivante du réservoir
+} Pool_Machine;
+
+//! Réservoir de machines
+struct Machine_Pool
+{
+	Pool_Machine *_free;		//!< Machines rendues, prêtes à resservir
+};
+
+//! Création d'un réservoir vide
+Machine_Pool *pool_create(void)
+{
+	return calloc(1, sizeof(Machine_Pool));
+}
+
+//! Libération d'un réservoir
+void pool_free(Machine_Pool *pool)
+{
+	while (pool->_free != NULL) {
+		Pool_Machine *pm = pool->_free;
+		pool->_free = pm->_next;
+		data_free(pm->_initial, pm->_capacity);
+		free(pm);
+	}
+	free(pool);
+}
+
+//! Création d'une machine vide
+Machine *machine_create(Machine_Pool *pool)
+{
+	Pool_Machine *pm = pool->_free;
+
+	if (pm != NULL) {
+		pool->_free = pm->_next;
+	} else {
+		pm = calloc(1, sizeof(Pool_Machine));
+		if (pm == NULL)
+			return NULL;
+	}
+	memset(&pm->_mach, 0, sizeof(Machine));
+	pm->_pool = pool;
+	pm->_loaded = false;
+	pm->_next = NULL;
+	return &pm->_mach;
+}
+
+//! Chargement d'un programme dans une machine du réservoir
+Load_Status machine_load(Machine *pmach, const char *programfile)
+{
+	Pool_Machine *pm = (Pool_Machine *) pmach;
+
+	if (pm->_loaded) {
+		free_program(pmach);
+		pm->_loaded = false;
+	}
+
+	Load_Status status = try_read_program(pmach, programfile);
+	if (status != LOAD_OK)
+		return status;
+
+	// L'image initiale ne change de segment que pour un programme plus gros
+	if (pmach->_dataend > pm->_capacity || pm->_initial == NULL) {
+		data_free(pm->_initial, pm->_capacity);
+		pm->_capacity = pmach->_dataend;
+		pm->_initial = data_alloc(pm->_capacity);
+		if (pm->_initial == NULL) {
+			pm->_capacity = 0;
+			free_program(pmach);
+			return LOAD_MEMORY;
+		}
+	} else {
+		data_clear(pm->_initial, pmach->_dataend);
+	}
+	data_load(pm->_initial, pmach->_data, pmach->_dataend);
+	pm->_pc = pmach->_pc;
+	pm->_cc = pmach->_cc;
+	memcpy(pm->_registers, pmach->_registers, sizeof(pm->_registers));
+	pm->_loaded = true;
+	return LOAD_OK;
+}
+
+//! Retour d'une machine à l'état de son chargement
+void machine_reset(Machine *pmach)
+{
+	Pool_Machine *pm = (Pool_Machine *) pmach;
+
+	data_clear(pmach->_data, pmach->_datasize);
+	data_load(pmach->_data, pm->_initial, pmach->_dataend);
+	pmach->_pc = pm->_pc;
+	pmach->_cc = pm->_cc;
+	memcpy(pmach->_registers, pm->_registers, sizeof(pmach->_registers));
+	pmach->_icount = 0;
+	pmach->_depth = 0;
+	metrics_reset(pmach);
+}
+
+//! Retour d'une machine à son réservoir
+void machine_free(Machine *pmach)
+{
+	Pool_Machine *pm = (Pool_Machine *) pmach;
+
+	if (pmach == NULL)
+		return;
+	if (pm->_loaded)
+		free_program(pmach);
+	pm->_loaded = false;
+	pm->_next = pm->_pool->_free;
+	pm->_pool->_free = pm;
+}
@@ -0,0 +1,80 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+/*!
+ * \file pool.h
+ * \brief Cycle de vie des machines d'un hôte de longue durée
+ *
+ * read_program() suffit au simulateur, qui charge un programme et se
+ * termine. Un hôte qui enchaîne les exécutions crée plutôt ses machines
+ * dans un réservoir : machine_create(), machine_load() autant de fois que
+ * nécessaire, machine_reset() pour relancer le même programme, puis
+ * machine_free(). La machine rendue au réservoir garde le segment de son
+ * image de données initiales, réutilisé par la suivante ; ses segments sont
+ * libérés par free_program(), et le segment de données retrouve une
+ * projection de taille voisine au chargement suivant (voir paging.h).
+ *
+ * Un réservoir et ses machines servent un seul processus léger à la fois.
+ */
+
+#include "machine.h"
+
+//! Réservoir de machines
+typedef struct Machine_Pool Machine_Pool;
+
+//! Création d'un réservoir vide
+/*!
+ * \return le réservoir, ou NULL si la mémoire manque
+ */
+Machine_Pool *pool_create(void);
+
+//! Libération d'un réservoir
+/*!
+ * Toutes ses machines doivent avoir été rendues par machine_free().
+ *
+ * \param pool le réservoir
+ */
+void pool_free(Machine_Pool *pool);
+
+//! Création d'une machine vide
+/*!
+ * La machine est reprise du réservoir s'il en contient une, allouée sinon.
+ *
+ * \param pool le réservoir
+ * \return la machine, sans programme, ou NULL si la mémoire manque
+ */
+Machine *machine_create(Machine_Pool *pool);
+
+//! Chargement d'un programme dans une machine du réservoir
+/*!
+ * Le programme précédent est libéré. Le programme est lu par
+ * try_read_program() ; l'état de la machine après chargement (données
+ * statiques, registres, point d'entrée) est mémorisé pour machine_reset().
+ *
+ * \param pmach la machine, créée par machine_create()
+ * \param programfile le nom du fichier binaire (\c - pour l'entrée standard), ou NULL (\c LOAD_OPEN)
+ * \return \c LOAD_OK, ou la cause de l'échec ; la machine est alors vide
+ */
+Load_Status machine_load(Machine *pmach, const char *programfile);
+
+//! Retour d'une machine à l'état de son chargement
+/*!
+ * Le segment de données est remis à zéro par data_clear(), qui rend ses
+ * pages au noyau, puis l'image initiale des données statiques y est
+ * recopiée par data_load() : une seule copie, limitée aux pages non nulles
+ * de l'image. Les registres, le compteur ordinal, le code condition et
+ * les compteurs d'exécution reprennent leur valeur de chargement. Les
+ * fonctions d'exécution choisies par verify_program() restent valables :
+ * l'état est celui qu'il a vérifié.
+ *
+ * \param pmach la machine, chargée par machine_load()
+ */
+void machine_reset(Machine *pmach);
+
+//! Retour d'une machine à son réservoir
+/*!
+ * \param pmach la machine, créée par machine_create(), ou NULL
+ */
+void machine_free(Machine *pmach);
+
+#endif
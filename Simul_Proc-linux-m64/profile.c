@@ -0,0 +1,179 @@
+/*!
+ * \file profile.c
+ * \brief Profil d'exécution par adresse du segment de texte
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "profile.h"
+#include "exec.h"
+#include "error.h"
+
+//! Profil d'exécution d'un programme
+struct Profile
+{
+	unsigned _size;		//!< Taille du segment de texte profilé
+	uint64_t *_counts;	//!< Nombre d'exécutions de chaque instruction
+	uint64_t *_taken;	//!< Nombre de ruptures de séquence après chaque instruction
+};
+
+//! Création d'un profil vide pour le programme d'une machine
+Profile *profile_create(const Machine *pmach)
+{
+	Profile *prof = malloc(sizeof(Profile));
+
+	if (prof == NULL)
+		return NULL;
+	prof->_size = pmach->_textsize;
+	// Un élément de plus : calloc() peut rendre NULL pour une taille nulle
+	prof->_counts = calloc(pmach->_textsize + 1, sizeof(uint64_t));
+	prof->_taken = calloc(pmach->_textsize + 1, sizeof(uint64_t));
+	if (prof->_counts == NULL || prof->_taken == NULL) {
+		profile_free(prof);
+		return NULL;
+	}
+	return prof;
+}
+
+//! Libération d'un profil
+void profile_free(Profile *prof)
+{
+	free(prof->_counts);
+	free(prof->_taken);
+	free(prof);
+}
+
+//! Paramètres de la simulation exécutée par catch_error()
+typedef struct
+{
+	Machine *_pmach;
+	Profile *_prof;
+} Profile_Args;
+
+//! Boucle de simulation profilée, exécutée par catch_error()
+static void run_profile(void *arg)
+{
+	Profile_Args *args = arg;
+	Machine *pmach = args->_pmach;
+	uint64_t *counts = args->_prof->_counts;
+	uint64_t *taken = args->_prof->_taken;
+	bool execute = true;
+
+	while (execute) {
+		if (pmach->_pc >= pmach->_textsize) {
+			error(ERR_SEGTEXT, pmach->_pc);
+		}
+		unsigned addr = pmach->_pc;
+		Micro_Op *op = &pmach->_decoded[addr];
+
+		counts[addr] += 1;
+		pmach->_pc = addr + 1;
+		pmach->_icount += 1;
+		execute = op_handler(op)(pmach, op);
+		taken[addr] += pmach->_pc != addr + 1;
+	}
+}
+
+//! Simulation profilée
+Run_Status simul_profile(Machine *pmach, Profile *prof)
+{
+	Profile_Args args = {pmach, prof};
+	Run_Status status = {RUN_HALT, ERR_NOERROR, 0};
+
+	if (catch_error(run_profile, &args, &status._err, &status._pc)) {
+		status._pc = pmach->_pc - 1;
+	} else {
+		status._state = RUN_ERROR;
+	}
+	return status;
+}
+
+//! Comparaison de deux adresses par nombre décroissant, puis par adresse
+int compare_hot_spots(const void *a, const void *b)
+{
+	const Hot_Spot *x = a;
+	const Hot_Spot *y = b;
+
+	if (x->_count != y->_count)
+		return x->_count < y->_count ? 1 : -1;
+	return x->_addr < y->_addr ? -1 : x->_addr > y->_addr;
+}
+
+//! Part d'un nombre dans le total, en pourcentage
+double profile_percent(uint64_t count, uint64_t total)
+{
+	return total > 0 ? 100.0 * count / total : 0.0;
+}
+
+//! L'instruction est-elle l'arc arrière d'une boucle ?
+/*!
+ * \param pmach la machine profilée
+ * \param prof son profil
+ * \param addr l'adresse de l'instruction
+ * \return vrai pour un \c BRANCH absolu pris au moins une fois vers une
+ * adresse inférieure ou égale à la sienne
+ */
+static bool back_edge(const Machine *pmach, const Profile *prof, unsigned addr)
+{
+	const Micro_Op *op = &pmach->_decoded[addr];
+
+	// Aucune super-instruction ne commence par BRANCH : la variante reste la sienne
+	return op->_kind == OP_BRANCH_ABS && (unsigned) op->_operand <= addr && prof->_taken[addr] > 0;
+}
+
+//! Affichage d'une ligne du listing annoté
+static void print_line(Machine *pmach, const Profile *prof, unsigned addr, uint64_t total)
+{
+	Instruction instr = pmach->_text[addr];
+
+	fprintf(sim_output(), "0x%.4x: %12llu %6.2f%%\t", addr,
+		(unsigned long long) prof->_counts[addr], profile_percent(prof->_counts[addr], total));
+	print_instruction(instr, addr);
+	if (instr.instr_generic._cop == BRANCH || instr.instr_generic._cop == CALL)
+		fprintf(sim_output(), "\t[taken %llu, not taken %llu]",
+			(unsigned long long) prof->_taken[addr],
+			(unsigned long long) (prof->_counts[addr] - prof->_taken[addr]));
+	if (back_edge(pmach, prof, addr))
+		fprintf(sim_output(), "\t<- loop 0x%.4x", pmach->_decoded[addr]._operand);
+	fprintf(sim_output(), "\n");
+}
+
+//! Affichage du profil
+void print_profile(Machine *pmach, const Profile *prof, unsigned top)
+{
+	uint64_t total = 0;
+
+	for (unsigned i = 0; i < prof->_size; ++i)
+		total += prof->_counts[i];
+
+	fprintf(sim_output(), "\n*** PROFILE (%llu instructions) ***\n", (unsigned long long) total);
+	for (unsigned i = 0; i < prof->_size; ++i)
+		print_line(pmach, prof, i, total);
+
+	Hot_Spot *hot = malloc(prof->_size * sizeof(Hot_Spot));
+	if (hot != NULL && prof->_size > 0) {
+		for (unsigned i = 0; i < prof->_size; ++i)
+			hot[i] = (Hot_Spot) {prof->_counts[i], i};
+		qsort(hot, prof->_size, sizeof(Hot_Spot), compare_hot_spots);
+
+		fprintf(sim_output(), "\n*** HOT SPOTS (top %u) ***\n", top);
+		for (unsigned i = 0; i < top && i < prof->_size && hot[i]._count > 0; ++i)
+			print_line(pmach, prof, hot[i]._addr, total);
+	}
+	free(hot);
+
+	fprintf(sim_output(), "\n*** LOOPS ***\n");
+	for (unsigned i = 0; i < prof->_size; ++i) {
+		if (!back_edge(pmach, prof, i))
+			continue;
+
+		unsigned head = pmach->_decoded[i]._operand;
+		uint64_t body = 0;
+		for (unsigned j = head; j <= i; ++j)
+			body += prof->_counts[j];
+		fprintf(sim_output(), "0x%.4x-0x%.4x: %llu iterations, %llu instructions (%.2f%%)\n",
+			head, i, (unsigned long long) prof->_taken[i],
+			(unsigned long long) body, profile_percent(body, total));
+	}
+}
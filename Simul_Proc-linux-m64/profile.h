@@ -0,0 +1,94 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+/*!
+ * \file profile.h
+ * \brief Profil d'exécution par adresse du segment de texte
+ *
+ * Pendant la simulation profilée, on compte les exécutions de chaque
+ * instruction et, pour chaque \c BRANCH et \c CALL, le nombre de fois où
+ * la rupture de séquence a eu lieu (branchement pris). Le rapport donne le
+ * listing du programme annoté, les instructions les plus exécutées et les
+ * boucles, reconnues à leurs arcs arrière : un \c BRANCH absolu pris vers
+ * une adresse qui ne le suit pas.
+ */
+
+#include <stdint.h>
+
+#include "machine.h"
+
+//! Profil d'exécution d'un programme
+typedef struct Profile Profile;
+
+//! Adresse d'un histogramme, avec son nombre d'exécutions ou d'échantillons
+/*!
+ * Les instructions les plus exécutées de print_profile(), et les adresses
+ * et sous-programmes de print_samples().
+ */
+typedef struct
+{
+	uint64_t _count;	//!< Nombre d'exécutions ou d'échantillons
+	unsigned _addr;		//!< Adresse de l'instruction ou du sous-programme
+} Hot_Spot;
+
+//! Création d'un profil vide pour le programme d'une machine
+/*!
+ * \param pmach la machine, chargée
+ * \return le profil, ou NULL si la mémoire manque
+ */
+Profile *profile_create(const Machine *pmach);
+
+//! Libération d'un profil
+/*!
+ * \param prof le profil
+ */
+void profile_free(Profile *prof);
+
+//! Simulation profilée
+/*!
+ * Comme simul_run() sans trace : les compteurs du profil sont mis à jour à
+ * chaque instruction, sans test supplémentaire dans la boucle (le
+ * branchement pris est compté par comparaison du compteur ordinal avec
+ * l'adresse suivante). Le profil d'une exécution interrompue par une erreur
+ * reste valide, instruction fautive comprise.
+ *
+ * \param pmach la machine en cours d'exécution
+ * \param prof le profil, créé pour ce programme
+ * \return le compte rendu de l'exécution
+ */
+Run_Status simul_profile(Machine *pmach, Profile *prof);
+
+//! Affichage du profil
+/*!
+ * Trois parties : le listing du programme (comme print_program()), chaque
+ * instruction précédée de son nombre d'exécutions et de sa part du total,
+ * et suivie, pour \c BRANCH et \c CALL, des branchements pris et non pris ;
+ * les \p top instructions les plus exécutées, par ordre décroissant ; les
+ * boucles, avec leur nombre d'itérations et le nombre d'instructions
+ * exécutées dans leur corps.
+ *
+ * \param pmach la machine profilée
+ * \param prof son profil
+ * \param top le nombre d'instructions de la liste des plus exécutées
+ */
+void print_profile(Machine *pmach, const Profile *prof, unsigned top);
+
+//! Comparaison de deux adresses par nombre décroissant, puis par adresse
+/*!
+ * Pour qsort() sur un tableau de \c Hot_Spot.
+ *
+ * \param a la première adresse
+ * \param b la seconde
+ * \return un entier négatif si \p a passe avant \p b, positif après
+ */
+int compare_hot_spots(const void *a, const void *b);
+
+//! Part d'un nombre dans le total, en pourcentage
+/*!
+ * \param count le nombre
+ * \param total le total
+ * \return la part, ou 0 pour un total nul
+ */
+double profile_percent(uint64_t count, uint64_t total);
+
+#endif
@@ -0,0 +1,224 @@
+/*!
+ * \file sample.c
+ * \brief Profil statistique par échantillonnage du compteur ordinal
+ *
+ * La minuterie est une minuterie POSIX sur l'horloge de temps processeur du
+ * processus léger (\c CLOCK_THREAD_CPUTIME_ID), dont le signal est dirigé
+ * vers ce processus léger (\c SIGEV_THREAD_ID, propre à Linux).
+ * L'échantillonneur actif est une variable locale au processus léger : le
+ * gestionnaire n'accède qu'à des compteurs que personne d'autre n'écrit.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sample.h"
+#include "profile.h"
+#include "exec.h"
+#include "error.h"
+
+// Nom du champ dans la glibc récente ; les plus anciennes n'exposent que le champ interne
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+//! Échantillonneur d'une machine
+struct Sampler
+{
+	const Machine *_mach;	//!< Machine échantillonnée
+	unsigned _size;		//!< Taille de son segment de texte
+	unsigned _hz;		//!< Fréquence d'échantillonnage
+	uint64_t _nsamples;	//!< Nombre d'échantillons
+	uint64_t *_hits;	//!< Échantillons par adresse (le dernier : hors du segment)
+	uint64_t _depths[SAMPLE_DEPTHS];	//!< Échantillons par profondeur d'appel
+	timer_t _timer;		//!< Minuterie, pendant l'échantillonnage
+};
+
+//! Échantillonneur actif dans le processus léger
+static __thread Sampler *active;
+
+//! Installation unique du gestionnaire de SIGPROF
+static pthread_once_t handler_once = PTHREAD_ONCE_INIT;
+
+//! Résultat de l'installation du gestionnaire
+static bool handler_installed;
+
+//! Gestionnaire de SIGPROF : relevé d'un échantillon
+/*!
+ * Le compteur ordinal est avancé avant l'exécution d'une instruction : on
+ * attribue l'échantillon à l'instruction qui le précède, celle en cours
+ * d'exécution. Entre un branchement pris et l'instruction suivante,
+ * l'échantillon va à l'instruction qui précède la cible.
+ */
+static void on_sigprof(int signo)
+{
+	Sampler *s = active;
+	(void) signo;
+
+	if (s == NULL)
+		return;
+
+	unsigned pc = s->_mach->_pc;
+	unsigned addr = pc > 0 ? pc - 1 : 0;
+	int depth = s->_mach->_depth;
+
+	s->_hits[addr < s->_size ? addr : s->_size] += 1;
+	s->_depths[depth < 0 ? 0 : depth < SAMPLE_DEPTHS ? depth : SAMPLE_DEPTHS - 1] += 1;
+	s->_nsamples += 1;
+}
+
+//! Installation du gestionnaire de SIGPROF
+static void install_handler(void)
+{
+	struct sigaction action;
+
+	action.sa_handler = on_sigprof;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESTART;
+	handler_installed = sigaction(SIGPROF, &action, NULL) == 0;
+}
+
+//! Création d'un échantillonneur pour une machine
+Sampler *sampler_create(const Machine *pmach, unsigned hz)
+{
+	Sampler *s = calloc(1, sizeof(Sampler));
+
+	if (s == NULL)
+		return NULL;
+	s->_mach = pmach;
+	s->_size = pmach->_textsize;
+	s->_hz = hz > 0 ? hz : SAMPLE_DEFAULT_HZ;
+	s->_hits = calloc(pmach->_textsize + 1, sizeof(uint64_t));
+	if (s->_hits == NULL) {
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+//! Libération d'un échantillonneur (arrêté)
+void sampler_free(Sampler *s)
+{
+	free(s->_hits);
+	free(s);
+}
+
+//! Début de l'échantillonnage dans le processus léger appelant
+bool sampler_start(Sampler *s)
+{
+	struct sigevent event = {0};
+	long period = 1000000000L / s->_hz;
+	struct itimerspec spec = {
+		{period / 1000000000L, period % 1000000000L},
+		{period / 1000000000L, period % 1000000000L},
+	};
+
+	pthread_once(&handler_once, install_handler);
+	if (!handler_installed)
+		return false;
+
+	event.sigev_notify = SIGEV_THREAD_ID;
+	event.sigev_signo = SIGPROF;
+	event.sigev_notify_thread_id = gettid();
+	if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &s->_timer) != 0)
+		return false;
+
+	active = s;
+	if (timer_settime(s->_timer, 0, &spec, NULL) != 0) {
+		active = NULL;
+		timer_delete(s->_timer);
+		return false;
+	}
+	return true;
+}
+
+//! Fin de l'échantillonnage dans le processus léger appelant
+void sampler_stop(Sampler *s)
+{
+	// Un signal déjà émis peut encore arriver : il trouvera active à NULL
+	timer_delete(s->_timer);
+	active = NULL;
+}
+
+//! Histogramme par sous-programme
+/*!
+ * Une adresse appartient au sous-programme dont l'entrée est la plus
+ * proche avant elle ; les entrées sont l'adresse 0 et les cibles des
+ * \c CALL absolus.
+ *
+ * \param pmach la machine échantillonnée
+ * \param s son échantillonneur
+ * \param buckets les cases, une par adresse au plus, remplies au retour
+ * \return le nombre de sous-programmes
+ */
+static unsigned group_subroutines(const Machine *pmach, const Sampler *s, Hot_Spot *buckets)
+{
+	bool *entry = calloc(s->_size, sizeof(bool));
+	unsigned n = 0;
+
+	if (entry == NULL)
+		return 0;
+	entry[0] = true;
+	for (unsigned i = 0; i < s->_size; ++i) {
+		const Micro_Op *op = &pmach->_decoded[i];
+		// Aucune super-instruction ne commence par CALL : la variante reste la sienne
+		if (op->_kind == OP_CALL_ABS && (unsigned) op->_operand < s->_size)
+			entry[op->_operand] = true;
+	}
+	for (unsigned i = 0; i < s->_size; ++i) {
+		if (entry[i])
+			buckets[n++] = (Hot_Spot) {0, i};
+		buckets[n - 1]._count += s->_hits[i];
+	}
+	free(entry);
+	return n;
+}
+
+//! Affichage des échantillons
+void print_samples(Machine *pmach, const Sampler *s, unsigned top)
+{
+	uint64_t total = s->_nsamples;
+
+	fprintf(sim_output(), "\n*** SAMPLES (%llu at %u Hz) ***\n", (unsigned long long) total, s->_hz);
+	if (s->_size == 0)
+		return;
+
+	Hot_Spot *buckets = malloc(s->_size * sizeof(Hot_Spot));
+	if (buckets == NULL)
+		return;
+
+	for (unsigned i = 0; i < s->_size; ++i)
+		buckets[i] = (Hot_Spot) {s->_hits[i], i};
+	qsort(buckets, s->_size, sizeof(Hot_Spot), compare_hot_spots);
+	fprintf(sim_output(), "\n*** SAMPLED ADDRESSES (top %u) ***\n", top);
+	for (unsigned i = 0; i < top && i < s->_size && buckets[i]._count > 0; ++i) {
+		unsigned addr = buckets[i]._addr;
+		fprintf(sim_output(), "0x%.4x: %10llu %6.2f%%\t", addr,
+			(unsigned long long) buckets[i]._count, profile_percent(buckets[i]._count, total));
+		print_instruction(pmach->_text[addr], addr);
+		fprintf(sim_output(), "\n");
+	}
+	if (s->_hits[s->_size] > 0)
+		fprintf(sim_output(), "outside text: %10llu %6.2f%%\n",
+			(unsigned long long) s->_hits[s->_size], profile_percent(s->_hits[s->_size], total));
+
+	unsigned n = group_subroutines(pmach, s, buckets);
+	qsort(buckets, n, sizeof(Hot_Spot), compare_hot_spots);
+	fprintf(sim_output(), "\n*** SUBROUTINES ***\n");
+	for (unsigned i = 0; i < n && buckets[i]._count > 0; ++i)
+		fprintf(sim_output(), "0x%.4x: %10llu %6.2f%%\n", buckets[i]._addr,
+			(unsigned long long) buckets[i]._count, profile_percent(buckets[i]._count, total));
+	free(buckets);
+
+	fprintf(sim_output(), "\n*** CALL DEPTHS ***\n");
+	for (unsigned d = 0; d < SAMPLE_DEPTHS; ++d)
+		if (s->_depths[d] > 0)
+			fprintf(sim_output(), "%2u%s: %10llu %6.2f%%\n", d, d == SAMPLE_DEPTHS - 1 ? "+" : " ",
+				(unsigned long long) s->_depths[d], profile_percent(s->_depths[d], total));
+}
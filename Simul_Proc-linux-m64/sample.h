@@ -0,0 +1,84 @@
+#ifndef _SAMPLE_H_
+#define _SAMPLE_H_
+
+/*!
+ * \file sample.h
+ * \brief Profil statistique par échantillonnage du compteur ordinal
+ *
+ * Contrairement à simul_profile(), la boucle de simulation n'est pas
+ * modifiée : une minuterie de temps processeur propre au processus léger
+ * qui simule lui envoie \c SIGPROF à la fréquence demandée, et le
+ * gestionnaire du signal relève le compteur ordinal et la profondeur
+ * d'appel (\c _depth) de la machine. Le coût ne dépend que de la fréquence
+ * d'échantillonnage, pas du nombre d'instructions.
+ *
+ * Les échantillons sont regroupés par adresse du segment de texte, par
+ * sous-programme (les cibles des \c CALL absolus, plus l'adresse 0 pour le
+ * programme principal) et par profondeur d'appel. Le compteur ordinal n'est
+ * tenu en mémoire que par les boucles d'interprétation : sous simul_jit(),
+ * les échantillons ne seraient pas significatifs, et test_simul refuse
+ * \c -S avec \c -j.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "machine.h"
+
+//! Fréquence d'échantillonnage par défaut, en Hz
+/*!
+ * Un nombre premier, pour ne pas se caler sur la période d'une boucle.
+ */
+#define SAMPLE_DEFAULT_HZ 997
+
+//! Nombre de profondeurs d'appel distinguées (la dernière regroupe les suivantes)
+#define SAMPLE_DEPTHS 16
+
+//! Échantillonneur d'une machine
+typedef struct Sampler Sampler;
+
+//! Création d'un échantillonneur pour une machine
+/*!
+ * \param pmach la machine, chargée
+ * \param hz la fréquence d'échantillonnage, en Hz de temps processeur
+ * \return l'échantillonneur, ou NULL si la mémoire manque
+ */
+Sampler *sampler_create(const Machine *pmach, unsigned hz);
+
+//! Libération d'un échantillonneur (arrêté)
+/*!
+ * \param s l'échantillonneur
+ */
+void sampler_free(Sampler *s);
+
+//! Début de l'échantillonnage dans le processus léger appelant
+/*!
+ * Le gestionnaire de \c SIGPROF est installé au premier appel et le reste :
+ * un signal reçu sans échantillonneur actif est ignoré. Chaque processus
+ * léger peut échantillonner sa propre machine en même temps que les autres
+ * (run_batch()).
+ *
+ * \param s l'échantillonneur, qui ne doit pas être déjà actif
+ * \return faux si la minuterie ne peut être créée
+ */
+bool sampler_start(Sampler *s);
+
+//! Fin de l'échantillonnage dans le processus léger appelant
+/*!
+ * \param s l'échantillonneur actif
+ */
+void sampler_stop(Sampler *s);
+
+//! Affichage des échantillons
+/*!
+ * Le nombre d'échantillons, puis les histogrammes : les \p top adresses les
+ * plus échantillonnées (avec l'instruction, comme print_program()), les
+ * sous-programmes et les profondeurs d'appel, avec leur part du total.
+ *
+ * \param pmach la machine échantillonnée
+ * \param s son échantillonneur
+ * \param top le nombre d'adresses affichées
+ */
+void print_samples(Machine *pmach, const Sampler *s, unsigned top);
+
+#endif
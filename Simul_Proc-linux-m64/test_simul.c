@@ -3,11 +3,27 @@
  * \brief Test du simulateur
  */
 
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "machine.h"
 #include "debug.h"
+#include "exec.h"
+#include "jit.h"
+#include "tracefile.h"
+#include "async.h"
+#include "batch.h"
+#include "checkpoint.h"
+#include "profile.h"
+#include "sample.h"
+#include "metrics.h"
+#include "verify.h"
+#include "guard.h"
+#include "paging.h"
+#include "textcache.h"
 
 //! Segment de texte
 extern Instruction text[];
@@ -24,6 +40,21 @@ extern const unsigned dataend;
 //! Taille utile du segment de données
 extern const unsigned datasize;  
 
+//! Noms des niveaux de trace (option \c -T)
+static const char *trace_levels[] = {
+    [TRACE_OFF] = "off",
+    [TRACE_BRANCHES] = "branches",
+    [TRACE_CALLS] = "calls",
+    [TRACE_FULL] = "full",
+};
+
+//! Noms des formats du fichier dump.bin (option \c -F)
+static const char *bin_formats[] = {
+    [BIN_LEGACY] = "legacy",
+    [BIN_V2] = "v2",
+    [BIN_V2_LZ] = "v2lz",
+};
+
 //! Help message.
 /*!
  * Printed with option \c -h.
@@ -35,13 +66,79 @@ static void usage()
            "\t-d\tDebug mode (interactive execution)\n"
            "\t-b\tA binary file is provided\n"
            "\t-l\tDo not execute; just display the listing\n"
+           "\t-Tlevel\tTrace level: off, branches, calls or full (default)\n"
+           "\t-r\tOn a guest error, print it and the machine state, then exit\n"
+           "\t\twith status 2 (default: print the error and exit at once)\n"
+           "\t-a[drop]\tWrite the trace from a background thread; when its\n"
+           "\t\tbuffer is full, wait (default) or drop and count records\n"
+           "\t-Fformat\tFormat of dump.bin: legacy (default), v2 or v2lz\n"
+           "\t\t(v2 with compressed sections)\n"
+           "\t-Msource\tRun every program of a directory (*.bin), of a\n"
+           "\t\tmanifest (one file per line) or of a stream of concatenated\n"
+           "\t\tprograms (- for stdin, or a pipe) on all cores, then print\n"
+           "\t\ta report of each program and a summary; other options\n"
+           "\t\tthan -S, -J and -K are ignored\n"
+           "\t-Pfile\tParameter sweep: run the program once per line of file,\n"
+           "\t\teach time on a copy-on-write clone whose data words are set\n"
+           "\t\tas listed (address=value ...), on all cores\n"
+           "\t-Cfile\tWrite checkpoints into file: a full one at start, then\n"
+           "\t\tthe modified data pages on SIGUSR1 and every -N instructions;\n"
+           "\t\tguest errors are handled as with -r\n"
+           "\t-Ncount\tCheckpoint interval in instructions (default: signal only)\n"
+           "\t-Xfile\tResume from the last checkpoint saved in file\n"
+           "\t-p[count]\tProfile the execution (no trace, no debug), then print\n"
+           "\t\tthe annotated listing, the count hottest instructions\n"
+           "\t\t(default: 10) and the loops; guest errors are handled as with -r\n"
+           "\t-S[rate]\tSample the PC and call depth rate times per second of\n"
+           "\t\tCPU time (default: 997), then print the histograms by\n"
+           "\t\taddress, subroutine and depth (also with -M and -P); not\n"
+           "\t\tavailable with -j, whose code does not keep the PC in memory\n"
+           "\t-Jfile\tAppend the execution counters of the run as a JSON object\n"
+           "\t\tto file (- for stdout); with -M and -P, one object per\n"
+           "\t\tprogram, then the totals\n"
+           "\t-Rfile\tRecord a binary trace into file (see trace_decode)\n"
+           "\t-t\tUse the threaded-code engine (no trace, no debug)\n"
+           "\t-j\tUse the x86-64 JIT engine (no trace, no debug)\n"
+           "\t-G\tGuard the data segment with inaccessible pages: reads out\n"
+           "\t\tof it fault and are reported as data segment errors, without\n"
+           "\t\ta compare in each instruction (ignored with -M and -P)\n"
+           "\t-Kdir\tCache the pre-decoded text of binary programs in dir,\n"
+           "\t\tkeyed by their contents: loading the same program again\n"
+           "\t\tmaps it from there, shared with other simulator processes\n"
+           "\t-s\tPrint the instruction count and rate, the fusion report, the\n"
+           "\t\tnumber of address checks removed by the load-time verifier and\n"
+           "\t\tthe number of data pages actually allocated\n"
            "\t-h\tprint this help message\n"
            "If -b is given, the next argument must be a file name containing\n"
-           "a valid program in binary format. Otherwise an internally defined\n"
+           "a valid program in binary format (- reads it from stdin). Otherwise an internally defined\n"
            "example program is used; the program is also dumped in binary into\n"
            "the file dump.bin\n");
 }
 
+//! Exécution par simul_jit(), simul_threaded() ou simul_trace()
+typedef struct
+{
+    Machine *_mach;         //!< La machine à exécuter
+    bool _debug;            //!< Mode pas à pas
+    Trace_Level _level;     //!< Niveau de trace de simul_trace()
+    bool _jit;              //!< Option -j
+    bool _threaded;         //!< Option -t
+    uint64_t _dispatches;   //!< Aiguillages de simul_threaded()
+} Engine_Run;
+
+//! Exécution de la machine par le moteur choisi (paramètre de catch_error())
+static void run_engine(void *arg)
+{
+    Engine_Run *er = arg;
+
+    if (er->_jit && !er->_debug)
+        simul_jit(er->_mach);
+    else if (er->_threaded && !er->_debug)
+        er->_dispatches = simul_threaded(er->_mach);
+    else
+        simul_trace(er->_mach, er->_debug, er->_level);
+}
+
 //! Programme de test
 /*!
  * Options de la ligne de commande :
@@ -51,7 +148,86 @@ static void usage()
  *
  *   <dt>-f</dt><dd>le programme est dans un fichier binaire ; le nom de ce
  *   fichier doit être fourni également en paramètre de la ligne de
- *   commande ; sans cette option, on exécute un programme de test prédéfini.</dd>
+ *   commande (\c - pour l'entrée standard) ; sans cette option, on exécute
+ *   un programme de test prédéfini.</dd>
+ *
+ *   <dt>-T<i>niveau</i></dt><dd>niveau de trace de simul_trace() :
+ *   \c off, \c branches, \c calls ou \c full (par défaut).</dd>
+ *
+ *   <dt>-r</dt><dd>reprise sur erreur (simul_run()) : une erreur du
+ *   programme simulé est affichée avec l'état final de la machine, et le code
+ *   de sortie vaut 2 ; sans cette option, error() termine le simulateur.</dd>
+ *
+ *   <dt>-a[drop]</dt><dd>écriture asynchrone de la trace et des messages
+ *   (voir async.h) ; avec \c drop, les lignes de trace qui ne tiennent pas
+ *   dans le tampon sont perdues (et comptées) au lieu de bloquer la
+ *   simulation.</dd>
+ *
+ *   <dt>-F<i>format</i></dt><dd>format du fichier dump.bin :
+ *   \c legacy (par défaut), \c v2 ou \c v2lz (version 2 compressée, voir
+ *   binfile.h).</dd>
+ *
+ *   <dt>-M<i>lot</i></dt><dd>exécution en parallèle d'un lot de
+ *   programmes binaires (run_batch()) : tous les fichiers \c .bin d'un
+ *   répertoire, les fichiers d'un manifeste (un par ligne), ou les
+ *   programmes concaténés d'un flot (\c - pour l'entrée standard) ; les
+ *   autres options, sauf \c -S, \c -J et \c -K, sont ignorées.</dd>
+ *
+ *   <dt>-P<i>fichier</i></dt><dd>balayage de paramètres (run_sweep()) :
+ *   le programme est exécuté une fois par ligne du fichier, sur un clone
+ *   dont les mots de données sont modifiés comme l'indique la ligne
+ *   (\e adresse=\e valeur ...).</dd>
+ *
+ *   <dt>-C<i>fichier</i></dt><dd>points de reprise dans le fichier
+ *   (simul_checkpoint()) : complet au départ, puis incrémental à chaque
+ *   signal \c SIGUSR1 et toutes les \c -N instructions ; les erreurs sont
+ *   rapportées comme avec \c -r.</dd>
+ *
+ *   <dt>-N<i>nombre</i></dt><dd>nombre d'instructions entre deux points de
+ *   reprise (par défaut, sur signal seulement).</dd>
+ *
+ *   <dt>-X<i>fichier</i></dt><dd>reprise de l'exécution au dernier point de
+ *   reprise du fichier (checkpoint_restore()).</dd>
+ *
+ *   <dt>-p[<i>nombre</i>]</dt><dd>simulation profilée (simul_profile()),
+ *   suivie du listing annoté, des \e nombre instructions les plus
+ *   exécutées (10 par défaut) et des boucles (print_profile()) ; les erreurs
+ *   sont rapportées comme avec \c -r.</dd>
+ *
+ *   <dt>-S[<i>fréquence</i>]</dt><dd>échantillonnage du compteur ordinal
+ *   et de la profondeur d'appel, \e fréquence fois par seconde de temps
+ *   processeur (997 par défaut), puis affichage des histogrammes par
+ *   adresse, sous-programme et profondeur (print_samples()) ; s'applique
+ *   aussi à chaque programme de \c -M et \c -P. Refusé avec \c -j : le
+ *   code compilé ne tient pas le compteur ordinal ni la profondeur d'appel
+ *   à jour dans la machine, et tous les échantillons iraient à l'adresse
+ *   de chargement.</dd>
+ *
+ *   <dt>-J<i>fichier</i></dt><dd>ajout des compteurs d'exécution en JSON
+ *   au fichier (metrics_json(), \c - pour la sortie standard) ; avec \c -M
+ *   et \c -P, un objet par programme, puis le cumul.</dd>
+ *
+ *   <dt>-R<i>fichier</i></dt><dd>enregistrement de la trace binaire dans le
+ *   fichier (simul_record()), à relire avec trace_decode.</dd>
+ *
+ *   <dt>-t</dt><dd>simulation par code threadé (simul_threaded())</dd>
+ *
+ *   <dt>-j</dt><dd>simulation par compilation à la volée (simul_jit())</dd>
+ *
+ *   <dt>-G</dt><dd>segment de données gardé par des pages inaccessibles
+ *   (guard_data()) : les lectures hors du segment font une faute, rapportée
+ *   comme une erreur de segment de données ; sans effet avec \c -M et
+ *   \c -P.</dd>
+ *
+ *   <dt>-K<i>répertoire</i></dt><dd>cache du segment de texte pré-décodé
+ *   des programmes binaires dans le répertoire (voir textcache.h) ; vaut
+ *   aussi pour \c -M.</dd>
+ *
+ *   <dt>-s</dt><dd>affichage du nombre d'instructions exécutées, du
+ *   débit de simulation, du rapport de fusion, du nombre de vérifications
+ *   d'adresse supprimées au chargement (print_verification()) et du nombre
+ *   de pages du segment de données allouées (print_data_pages()), et
+ *   l'origine du segment pré-décodé avec \c -K (print_text_cache())</dd>
  *
  * </dl>
  */
@@ -60,13 +236,32 @@ int main(int argc, char *argv[])
     bool debug = false;
     bool binfile = false;
     bool no_exec = false;
+    bool threaded = false;
+    bool jit = false;
+    bool stats = false;
+    bool guard = false;
+    Trace_Level level = TRACE_FULL;
+    char *recordfile = NULL;
+    bool async = false;
+    bool recover = false;
+    Async_Policy policy = ASYNC_BLOCK;
+    Bin_Format format = BIN_LEGACY;
+    char *checkpointfile = NULL;
+    unsigned long long interval = 0;
+    char *resumefile = NULL;
+    char *sweepfile = NULL;
+    unsigned hot = 0;
+    unsigned sample_hz = 0;
+    char *batchsource = NULL;
+    char *metricsfile = NULL;
     char *programfile = NULL;
+    char *cachedir = NULL;
 
     if (argc > 1) 
     {
         for (int iarg = 1; iarg < argc; ++iarg)
         {
-            if (argv[iarg][0] == '-')
+            if (argv[iarg][0] == '-' && argv[iarg][1] != '\0')
                 switch (argv[iarg][1])
                 {
                 case 'd':
@@ -78,6 +273,84 @@ int main(int argc, char *argv[])
                  case 'l': 
                     no_exec = true;
                     break;
+                case 'T':
+                    for (level = TRACE_OFF; level <= LAST_TRACE_LEVEL; ++level)
+                        if (strcmp(argv[iarg] + 2, trace_levels[level]) == 0)
+                            break;
+                    if (level > LAST_TRACE_LEVEL)
+                    {
+                        fprintf(stderr, "Unknown trace level: %s\n", argv[iarg] + 2);
+                        usage();
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
+                case 'r':
+                    recover = true;
+                    break;
+                case 'a':
+                    async = true;
+                    if (strcmp(argv[iarg] + 2, "drop") == 0)
+                        policy = ASYNC_DROP;
+                    else if (argv[iarg][2] != '\0' && strcmp(argv[iarg] + 2, "block") != 0)
+                    {
+                        fprintf(stderr, "Unknown option: %s\n", argv[iarg]);
+                        usage();
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
+                case 'F':
+                    for (format = BIN_LEGACY; format <= BIN_V2_LZ; ++format)
+                        if (strcmp(argv[iarg] + 2, bin_formats[format]) == 0)
+                            break;
+                    if (format > BIN_V2_LZ)
+                    {
+                        fprintf(stderr, "Unknown binary format: %s\n", argv[iarg] + 2);
+                        usage();
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
+                case 'C':
+                    checkpointfile = argv[iarg] + 2;
+                    break;
+                case 'N':
+                    interval = strtoull(argv[iarg] + 2, NULL, 0);
+                    break;
+                case 'X':
+                    resumefile = argv[iarg] + 2;
+                    break;
+                case 'P':
+                    sweepfile = argv[iarg] + 2;
+                    break;
+                case 'M':
+                    batchsource = argv[iarg] + 2;
+                    break;
+                case 'S':
+                    sample_hz = argv[iarg][2] != '\0' ? strtoul(argv[iarg] + 2, NULL, 0) : SAMPLE_DEFAULT_HZ;
+                    break;
+                case 'p':
+                    hot = argv[iarg][2] != '\0' ? strtoul(argv[iarg] + 2, NULL, 0) : 10;
+                    break;
+                case 'J':
+                    metricsfile = argv[iarg] + 2;
+                    break;
+                case 'R':
+                    recordfile = argv[iarg] + 2;
+                    break;
+                case 't':
+                    threaded = true;
+                    break;
+                case 'j':
+                    jit = true;
+                    break;
+                case 'G':
+                    guard = true;
+                    break;
+                case 'K':
+                    cachedir = argv[iarg] + 2;
+                    break;
+                case 's':
+                    stats = true;
+                    break;
                   case 'h':
                     usage();
                     exit(EXIT_SUCCESS);
@@ -93,15 +366,81 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (binfile && programfile == NULL)
+    {
+        fprintf(stderr, "Option -b requires a binary file\n");
+        usage();
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *metrics = NULL;
+    if (metricsfile != NULL)
+    {
+        metrics = strcmp(metricsfile, "-") == 0 ? stdout : fopen(metricsfile, "a");
+        if (metrics == NULL)
+        {
+            fprintf(stderr, "Ouverture du fichier impossible : %s\n", metricsfile);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (cachedir != NULL && !text_cache_init(cachedir))
+    {
+        fprintf(stderr, "Répertoire du cache impossible à créer : %s\n", cachedir);
+        exit(EXIT_FAILURE);
+    }
+
+    // -M et -P n'utilisent pas simul_jit()
+    if (sample_hz > 0 && jit && batchsource == NULL && sweepfile == NULL)
+    {
+        fprintf(stderr, "Option -S is not available with -j\n");
+        usage();
+        exit(EXIT_FAILURE);
+    }
+
+    if (batchsource != NULL)
+        return run_batch(batchsource, 0, sample_hz, metrics, stdout);
+
     Machine mach;
 
-    if (!binfile) 
-        load_program(&mach, textsize, text, datasize, data, dataend);
+    if (resumefile != NULL)
+    {
+        if (!checkpoint_restore(resumefile, &mach))
+        {
+            fprintf(stderr, "Reprise impossible : %s\n", resumefile);
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (!binfile) 
+    {
+        // Comme pour un fichier binaire : guard_data() libère le segment
+        Word *segment = data_alloc(datasize);
+        if (segment == NULL)
+        {
+            fprintf(stderr, "Mémoire insuffisante.\n");
+            exit(EXIT_FAILURE);
+        }
+        data_load(segment, data, datasize);
+        if (!load_program(&mach, textsize, text, datasize, segment, dataend))
+        {
+            fprintf(stderr, "Mémoire insuffisante.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
     else 
         read_program(&mach, programfile);   
 
+    if (sweepfile != NULL)
+        return run_sweep(&mach, sweepfile, 0, sample_hz, metrics, stdout);
+
+    if (guard && !guard_data(&mach))
+    {
+        fprintf(stderr, "Segment de données gardé impossible.\n");
+        exit(EXIT_FAILURE);
+    }
+
     printf("\n*** Sauvegarde des programmes et données initiales en format binaire ***\n\n");
-    dump_memory(&mach);
+    dump_memory(&mach, format);
 
     printf("\n*** Machine state before execution ***\n");
     print_program(&mach);
@@ -112,11 +451,111 @@ int main(int argc, char *argv[])
         return 0;
 
     printf("\n*** Execution trace ***\n\n");
-    simul(&mach, debug);
+
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    uint64_t dispatches = 0;
+    Run_Status run = {RUN_HALT, ERR_NOERROR, 0};
+
+    if (async && !debug)
+        async_start(policy, ASYNC_CAPACITY);
+
+    Sampler *sampler = NULL;
+    if (sample_hz > 0 && !debug)
+    {
+        sampler = sampler_create(&mach, sample_hz);
+        if (sampler == NULL || !sampler_start(sampler))
+        {
+            fprintf(stderr, "Échantillonnage impossible.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (recordfile != NULL && !debug)
+    {
+        Trace_Writer *tw = trace_create(recordfile, &mach);
+        simul_record(&mach, tw);
+        trace_close(tw);
+    }
+    else if (checkpointfile != NULL && !debug)
+    {
+        Checkpoint *ck = checkpoint_create(checkpointfile);
+        run = simul_checkpoint(&mach, level, ck, interval, SIGUSR1);
+        checkpoint_close(ck, &mach);
+    }
+    else if (hot > 0 && !debug)
+    {
+        Profile *prof = profile_create(&mach);
+        if (prof == NULL)
+        {
+            fprintf(stderr, "Mémoire insuffisante.\n");
+            exit(EXIT_FAILURE);
+        }
+        run = simul_profile(&mach, prof);
+        print_profile(&mach, prof, hot);
+        profile_free(prof);
+    }
+    else if (recover && !debug)
+        run = simul_run(&mach, level);
+    else
+    {
+        Engine_Run er = {&mach, debug, level, jit, threaded, 0};
+        Error err;
+        unsigned addr;
+
+        // Avec -G, la faute revient de guard_fault() par catch_error() : error() s'exécute hors du gestionnaire
+        if (!guard)
+            run_engine(&er);
+        else if (!catch_error(run_engine, &er, &err, &addr))
+            error(err, addr);
+        dispatches = er._dispatches;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    if (sampler != NULL)
+        sampler_stop(sampler);
+
+    uint64_t dropped = async_stop();
+    if (dropped > 0)
+        fprintf(stderr, "%llu trace records dropped\n", (unsigned long long) dropped);
+
+    int status = 0;
+    if (run._state == RUN_ERROR)
+    {
+        print_error(run._err, run._pc);
+        status = run._err == ERR_NOERROR ? 0 : 2;
+    }
+
+    double seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) * 1e-9;
+    if (stats)
+    {
+        printf("\n*** %llu instructions in %.6f s (%.0f instructions/s) ***\n",
+               (unsigned long long) mach._icount, seconds,
+               seconds > 0 ? mach._icount / seconds : 0.0);
+        print_fusions(&mach, dispatches);
+        print_verification(&mach);
+        print_data_pages(&mach);
+        print_text_cache(&mach);
+    }
+
+    if (metrics != NULL)
+    {
+        metrics_finish(&mach, seconds);
+        metrics_json(metrics, resumefile != NULL ? resumefile : binfile ? programfile : "(built-in)", mach._metrics);
+        fflush(metrics);
+    }
+
+    if (sampler != NULL)
+    {
+        print_samples(&mach, sampler, 10);
+        sampler_free(sampler);
+    }
 
     printf("\n*** Machine state after execution ***\n");
     print_cpu(&mach);
     print_data(&mach);
 
-    return 0; 
+    return status; 
 }
@@ -0,0 +1,189 @@
+/*!
+ * \file textcache.c
+ * \brief Cache sur disque du segment de texte pré-décodé
+ *
+ * Un fichier du cache contient un en-tête de 64 octets (une ligne de cache,
+ * voir decode_program()) suivi du segment pré-décodé, sentinelle comprise,
+ * dans la représentation de la machine hôte.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "textcache.h"
+#include "binfile.h"
+#include "exec.h"
+
+//! Signature d'un fichier du cache ("SIMC")
+#define CACHE_MAGIC 0x434d4953
+
+//! Version du format des fichiers du cache
+#define CACHE_VERSION 1
+
+//! Longueur maximale d'un nom de fichier du cache
+#define CACHE_PATH_MAX 4096
+
+//! En-tête d'un fichier du cache
+typedef struct
+{
+	uint32_t _magic;		//!< \c CACHE_MAGIC
+	uint32_t _version;		//!< \c CACHE_VERSION
+	uint32_t _fingerprint;		//!< Empreinte de l'exécutable
+	uint32_t _textsize;		//!< Taille du segment de texte
+	Text_Key _key;			//!< Clé du programme
+	uint8_t _pad[64 - 16 - sizeof(Text_Key)];
+} Cache_Header;
+
+//! Répertoire du cache, ou NULL s'il n'est pas utilisé
+static char *cache_dir = NULL;
+
+//! Empreinte de l'exécutable : pré-décodage, taille et date de l'exécutable
+static uint32_t fingerprint;
+
+//! Choix du répertoire du cache
+bool text_cache_init(const char *dir)
+{
+	struct stat st;
+
+	if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+		return false;
+	if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode))
+		return false;
+
+	fingerprint = decode_fingerprint();
+	if (stat("/proc/self/exe", &st) == 0) {
+		uint64_t exe[2] = {st.st_size, st.st_mtime};
+		fingerprint ^= bin_crc32(exe, sizeof(exe));
+	}
+
+	free(cache_dir);
+	cache_dir = strdup(dir);
+	return cache_dir != NULL;
+}
+
+//! Le cache est-il utilisé ?
+bool text_cache_enabled(void)
+{
+	return cache_dir != NULL;
+}
+
+//! Calcul de la clé d'un programme
+void text_cache_key(const void *image, size_t size, Text_Key *key)
+{
+	const unsigned char *p = image;
+	uint64_t hash = 14695981039346656037ULL;
+	size_t i;
+
+	memset(key, 0, sizeof(Text_Key));
+	for (i = 0; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, p + i, sizeof(word));
+		hash = (hash ^ word) * 1099511628211ULL;
+	}
+	for (; i < size; ++i)
+		hash = (hash ^ p[i]) * 1099511628211ULL;
+
+	key->_hash = hash;
+	key->_crc = bin_crc32(image, size);
+	key->_size = size;
+}
+
+//! Nom du fichier d'un programme dans le cache
+static bool cache_path(const Text_Key *key, char *path)
+{
+	int n = snprintf(path, CACHE_PATH_MAX, "%s/%016llx%08x-%08x.ops", cache_dir,
+			 (unsigned long long) key->_hash, key->_crc, fingerprint);
+
+	return n > 0 && n < CACHE_PATH_MAX;
+}
+
+//! Recherche d'un programme dans le cache
+bool text_cache_lookup(const Text_Key *key, Cached_Text *cached)
+{
+	char path[CACHE_PATH_MAX];
+	Cache_Header header;
+	struct stat st;
+	int fd;
+
+	if (cache_dir == NULL || !cache_path(key, path))
+		return false;
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return false;
+	if (fstat(fd, &st) != 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header)
+	    || header._magic != CACHE_MAGIC || header._version != CACHE_VERSION
+	    || header._fingerprint != fingerprint
+	    || memcmp(&header._key, key, sizeof(Text_Key)) != 0
+	    || (uint64_t) st.st_size != sizeof(header) + ((uint64_t) header._textsize + 1) * sizeof(Micro_Op)) {
+		close(fd);
+		return false;
+	}
+
+	// Projection privée : les pages restent partagées tant qu'elles ne sont pas écrites
+	void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+
+	Micro_Op *ops = (Micro_Op *) ((char *) map + sizeof(header));
+	if (!decoded_valid(ops, header._textsize)) {
+		munmap(map, st.st_size);
+		return false;
+	}
+	cached->_ops = ops;
+	cached->_textsize = header._textsize;
+	cached->_mapsize = st.st_size;
+	return true;
+}
+
+//! Ajout d'un programme au cache
+void text_cache_store(const Text_Key *key, const Machine *pmach)
+{
+	char path[CACHE_PATH_MAX], tmp[CACHE_PATH_MAX];
+	Cache_Header header;
+	size_t length = ((size_t) pmach->_textsize + 1) * sizeof(Micro_Op);
+
+	if (cache_dir == NULL || !cache_path(key, path)
+	    || snprintf(tmp, sizeof(tmp), "%s/.tmp-XXXXXX", cache_dir) >= (int) sizeof(tmp))
+		return;
+
+	int fd = mkstemp(tmp);
+	if (fd < 0)
+		return;
+
+	memset(&header, 0, sizeof(header));
+	header._magic = CACHE_MAGIC;
+	header._version = CACHE_VERSION;
+	header._fingerprint = fingerprint;
+	header._textsize = pmach->_textsize;
+	memcpy(&header._key, key, sizeof(Text_Key));
+
+	bool ok = write(fd, &header, sizeof(header)) == sizeof(header)
+		&& write(fd, pmach->_decoded, length) == (ssize_t) length;
+	ok = close(fd) == 0 && ok;
+	if (!ok || rename(tmp, path) != 0)
+		unlink(tmp);
+}
+
+//! Libération d'un segment projeté depuis le cache
+void text_cache_release(Micro_Op *ops, size_t mapsize)
+{
+	munmap((char *) ops - sizeof(Cache_Header), mapsize);
+}
+
+//! Rapport d'utilisation du cache
+void print_text_cache(const Machine *pmach)
+{
+	if (cache_dir == NULL)
+		return;
+	fprintf(sim_output(), "\n*** TEXT CACHE ***\n%s\n", pmach->_decodedsize != 0
+		? "pre-decoded text mapped from the cache"
+		: "text decoded at load time");
+}
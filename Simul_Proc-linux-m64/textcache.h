@@ -0,0 +1,113 @@
+#ifndef _TEXTCACHE_H_
+#define _TEXTCACHE_H_
+
+/*!
+ * \file textcache.h
+ * \brief Cache sur disque du segment de texte pré-décodé
+ *
+ * Le pré-décodage, la fusion et la vérification (decode_program(),
+ * verify_program()) ne dépendent que du contenu du fichier binaire. Leur
+ * résultat, le segment pré-décodé, est donc rangé dans un répertoire de
+ * cache sous une clé tirée de ce contenu (taille et deux empreintes), et de
+ * l'empreinte de l'exécutable (decode_fingerprint()). Au chargement suivant
+ * du même programme, try_read_program() et stream_program() projettent le
+ * fichier du cache à la place du segment pré-décodé : rien n'est alloué ni
+ * écrit.
+ *
+ * Le segment pré-décodé ne contient aucune adresse (voir op_handler()) :
+ * il est projeté tel quel, en privé, et les processus qui exécutent le
+ * même programme en partagent les pages, celles du cache du noyau. Une page
+ * n'est copiée que si le processus l'écrit, ce que seule une nouvelle
+ * vérification peut faire (guard_data()).
+ *
+ * Un fichier est écrit sous un nom temporaire puis renommé : des processus
+ * concurrents ne voient que des fichiers complets. Un fichier du cache est
+ * validé (decoded_valid()) avant d'être utilisé, puis load_program() le
+ * compare instruction par instruction au segment de texte
+ * (decoded_matches()) et refait les preuves de verify_program() : un
+ * fichier qui ne correspond pas au programme est ignoré, et l'on ne gagne
+ * que le pré-décodage et la fusion. Les fichiers d'un exécutable ou d'un
+ * programme qui n'existe plus ne sont jamais effacés.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "machine.h"
+
+struct Micro_Op;
+
+//! Clé d'un programme dans le cache
+typedef struct
+{
+    uint64_t _hash;	//!< Empreinte FNV-1a (par mots de 64 bits) du contenu
+    uint32_t _crc;	//!< CRC-32 du contenu (bin_crc32())
+    uint64_t _size;	//!< Taille du contenu, en octets
+} Text_Key;
+
+//! Segment pré-décodé projeté depuis le cache
+typedef struct
+{
+    struct Micro_Op *_ops;	//!< Segment pré-décodé, sentinelle comprise
+    unsigned _textsize;		//!< Taille du segment de texte
+    size_t _mapsize;		//!< Taille de la projection
+} Cached_Text;
+
+//! Choix du répertoire du cache
+/*!
+ * Sans appel, le cache n'est pas utilisé. Le répertoire est créé s'il
+ * n'existe pas.
+ *
+ * \param dir le répertoire
+ * \return faux s'il ne peut être créé
+ */
+bool text_cache_init(const char *dir);
+
+//! Le cache est-il utilisé ?
+bool text_cache_enabled(void);
+
+//! Calcul de la clé d'un programme
+/*!
+ * \param image le contenu du fichier binaire
+ * \param size sa taille
+ * \param key la clé
+ */
+void text_cache_key(const void *image, size_t size, Text_Key *key);
+
+//! Recherche d'un programme dans le cache
+/*!
+ * \param key la clé du programme
+ * \param cached le segment projeté, s'il est trouvé
+ * \return vrai si le programme est dans le cache, et son fichier valide
+ */
+bool text_cache_lookup(const Text_Key *key, Cached_Text *cached);
+
+//! Ajout d'un programme au cache
+/*!
+ * Une erreur d'écriture est silencieuse : le programme sera pré-décodé au
+ * prochain chargement.
+ *
+ * \param key la clé du programme
+ * \param pmach la machine, chargée et vérifiée
+ */
+void text_cache_store(const Text_Key *key, const Machine *pmach);
+
+//! Libération d'un segment projeté depuis le cache
+/*!
+ * Appelée par free_program().
+ *
+ * \param ops le segment pré-décodé
+ * \param mapsize la taille de sa projection
+ */
+void text_cache_release(struct Micro_Op *ops, size_t mapsize);
+
+//! Rapport d'utilisation du cache
+/*!
+ * Rien n'est affiché si le cache n'est pas utilisé.
+ *
+ * \param pmach la machine, chargée
+ */
+void print_text_cache(const Machine *pmach);
+
+#endif
@@ -0,0 +1,83 @@
+/*!
+ * \file trace_decode.c
+ * \brief Décodage d'une trace d'exécution binaire
+ *
+ * Sans option, la trace est réécrite dans le format de trace() ; avec
+ * l'option \c -s, elle est rejouée jusqu'à l'instruction demandée et l'on
+ * affiche l'état reconstitué de la machine.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "machine.h"
+#include "exec.h"
+#include "tracefile.h"
+
+//! Message d'aide
+static void usage(void)
+{
+	printf("Usage: trace_decode [-s step] tracefile\n"
+	       "Without -s, print the trace recorded by test_simul -R in the\n"
+	       "format of the simulator's text trace. With -s, replay the first\n"
+	       "<step> instructions and print the machine state.\n");
+}
+
+//! Décodeur de trace
+/*!
+ * Options de la ligne de commande :
+ *
+ * <dl>
+ *   <dt>-s</dt><dd>nombre d'instructions à rejouer ; on affiche ensuite
+ *   l'état de la machine (registres et données).</dd>
+ *
+ *   <dt>-h</dt><dd>affichage de l'aide</dd>
+ * </dl>
+ */
+int main(int argc, char *argv[])
+{
+	const char *tracefile = NULL;
+	bool replay = false;
+	unsigned long long steps = 0;
+
+	for (int iarg = 1; iarg < argc; ++iarg) {
+		if (strcmp(argv[iarg], "-s") == 0 && iarg + 1 < argc) {
+			replay = true;
+			steps = strtoull(argv[++iarg], NULL, 0);
+		} else if (strcmp(argv[iarg], "-h") == 0) {
+			usage();
+			exit(EXIT_SUCCESS);
+		} else if (argv[iarg][0] == '-') {
+			fprintf(stderr, "Unknown option: %s\n", argv[iarg]);
+			usage();
+			exit(EXIT_FAILURE);
+		} else {
+			tracefile = argv[iarg];
+		}
+	}
+
+	if (tracefile == NULL) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	Machine mach;
+	Trace_Reader *tr = trace_open(tracefile, &mach);
+	Trace_Step step;
+
+	if (replay) {
+		while (mach._icount < steps && trace_next(tr, &mach, &step))
+			;
+		printf("\n*** Machine state after %llu instructions ***\n",
+		       (unsigned long long) mach._icount);
+		print_cpu(&mach);
+		print_data(&mach);
+	} else {
+		while (trace_next(tr, &mach, &step))
+			trace("Executing", &mach, mach._text[step._addr], step._addr);
+	}
+
+	trace_release(tr);
+	return 0;
+}
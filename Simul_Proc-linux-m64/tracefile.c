@@ -0,0 +1,360 @@
+/*!
+ * \file tracefile.c
+ * \brief Trace d'exécution binaire compacte : écriture, relecture et rejeu
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracefile.h"
+#include "exec.h"
+#include "error.h"
+#include "metrics.h"
+#include "verify.h"
+
+//! Taille du tampon d'écriture
+#define TRACE_BUFFER (64 * 1024)
+
+//! Taille maximale d'un enregistrement (indicateurs, 5 varint, registre)
+#define MAX_RECORD 32
+
+struct Trace_Writer
+{
+	FILE *_file;			//!< Fichier de trace
+	size_t _len;			//!< Nombre d'octets dans le tampon
+	unsigned _last_mem;		//!< Adresse de la dernière écriture en mémoire
+	bool _pending;			//!< Instruction en cours d'exécution ?
+	uint8_t _buffer[TRACE_BUFFER];	//!< Tampon d'écriture
+};
+
+struct Trace_Reader
+{
+	FILE *_file;			//!< Fichier de trace
+	unsigned _last_mem;		//!< Adresse de la dernière écriture en mémoire
+	Instruction *_text;		//!< Segment de texte de la machine
+	Word *_data;			//!< Segment de données de la machine
+};
+
+//! Écrivain dont la simulation est en cours (vidé à la sortie du programme)
+static Trace_Writer *recording = NULL;
+
+//! Vidage du tampon d'écriture
+static void flush(Trace_Writer *tw)
+{
+	fwrite(tw->_buffer, 1, tw->_len, tw->_file);
+	tw->_len = 0;
+}
+
+//! Écriture d'un entier non signé en varint
+static void put_varint(Trace_Writer *tw, uint32_t value)
+{
+	while (value >= 0x80) {
+		tw->_buffer[tw->_len++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	tw->_buffer[tw->_len++] = value;
+}
+
+//! Écriture d'une différence en varint zigzag
+static void put_delta(Trace_Writer *tw, uint32_t delta)
+{
+	int32_t n = (int32_t) delta;
+	put_varint(tw, ((uint32_t) n << 1) ^ (uint32_t) (n >> 31));
+}
+
+//! Vidage du tampon à la sortie du programme
+/*!
+ * error() termine le programme au milieu d'une instruction : on enregistre
+ * l'instruction interrompue avant de vider le tampon.
+ */
+static void flush_at_exit(void)
+{
+	Trace_Writer *tw = recording;
+
+	if (tw == NULL)
+		return;
+	if (tw->_pending) {
+		tw->_buffer[tw->_len++] = TRACE_FAULT;
+		tw->_pending = false;
+	}
+	flush(tw);
+	fflush(tw->_file);
+}
+
+//! Création d'un fichier de trace
+Trace_Writer *trace_create(const char *path, const Machine *pmach)
+{
+	static bool registered = false;
+	Trace_Writer *tw = malloc(sizeof(Trace_Writer));
+	uint32_t header[] = {
+		TRACE_MAGIC, TRACE_VERSION,
+		pmach->_textsize, pmach->_datasize, pmach->_dataend,
+	};
+
+	if (tw == NULL || (tw->_file = fopen(path, "wb")) == NULL) {
+		fprintf(stderr, "Ouverture du fichier impossible.\n");
+		exit(1);
+	}
+	tw->_len = 0;
+	tw->_last_mem = 0;
+	tw->_pending = false;
+
+	fwrite(header, sizeof(uint32_t), sizeof(header) / sizeof(uint32_t), tw->_file);
+	for (unsigned i = 0; i < pmach->_textsize; ++i)
+		fwrite(&pmach->_text[i]._raw, sizeof(uint32_t), 1, tw->_file);
+	fwrite(pmach->_data, sizeof(Word), pmach->_datasize, tw->_file);
+	uint32_t cpu[] = {pmach->_pc, pmach->_cc};
+	fwrite(cpu, sizeof(uint32_t), 2, tw->_file);
+	fwrite(pmach->_registers, sizeof(Word), NREGISTERS, tw->_file);
+
+	if (!registered) {
+		atexit(flush_at_exit);
+		registered = true;
+	}
+	return tw;
+}
+
+//! Fermeture d'un fichier de trace
+void trace_close(Trace_Writer *tw)
+{
+	flush(tw);
+	fclose(tw->_file);
+	free(tw);
+}
+
+//! Adresse de l'écriture en mémoire d'une instruction, avant son exécution
+/*!
+ * \param pmach la machine en cours d'exécution
+ * \param op l'instruction pré-décodée
+ * \param addr l'adresse de l'écriture
+ * \return faux si l'instruction n'écrit pas en mémoire
+ */
+static bool written_address(Machine *pmach, const Micro_Op *op, unsigned *addr)
+{
+	Instruction instr = pmach->_text[pmach->_pc];
+
+	switch (op->_cop) {
+		case STORE:
+		case POP:
+			if (instr.instr_generic._immediate)
+				return false;
+			*addr = op->_operand;
+			if (instr.instr_generic._indexed)
+				*addr += pmach->_registers[op->_rindex];
+			return true;
+		case PUSH:
+		case CALL:
+			*addr = pmach->_sp;
+			return true;
+		default:
+			return false;
+	}
+}
+
+//! Enregistrement d'une instruction exécutée
+/*!
+ * \param tw l'écrivain
+ * \param pmach la machine après l'exécution
+ * \param addr l'adresse de l'instruction
+ * \param registers les registres avant l'exécution
+ * \param cc le code condition avant l'exécution
+ * \param mem vrai si l'instruction a écrit en mémoire à \c mem_addr
+ * \param mem_addr l'adresse de l'écriture
+ * \param old la valeur du mot à cette adresse avant l'exécution
+ */
+static void record(Trace_Writer *tw, Machine *pmach, unsigned addr,
+		   const Word registers[NREGISTERS], Condition_Code cc,
+		   bool mem, unsigned mem_addr, Word old)
+{
+	uint8_t flags = 0;
+	unsigned reg = NREGISTERS;
+
+	if (tw->_len > TRACE_BUFFER - MAX_RECORD)
+		flush(tw);
+
+	if (pmach->_pc != addr + 1)
+		flags |= TRACE_JUMP;
+	for (unsigned i = 0; i < NREGISTERS; ++i)
+		if (pmach->_registers[i] != registers[i]) {
+			reg = i;
+			flags |= TRACE_REG;
+			break;
+		}
+	if (mem)
+		flags |= TRACE_MEM;
+	if (pmach->_cc != cc)
+		flags |= TRACE_CC | pmach->_cc << 4;
+
+	tw->_buffer[tw->_len++] = flags;
+	if (flags & TRACE_JUMP)
+		put_delta(tw, pmach->_pc - (addr + 1));
+	if (flags & TRACE_REG) {
+		tw->_buffer[tw->_len++] = reg;
+		put_delta(tw, pmach->_registers[reg] - registers[reg]);
+	}
+	if (flags & TRACE_MEM) {
+		put_delta(tw, mem_addr - tw->_last_mem);
+		put_delta(tw, pmach->_data[mem_addr] - old);
+		tw->_last_mem = mem_addr;
+	}
+}
+
+//! Simulation avec enregistrement de la trace binaire
+/*!
+ * On conserve les registres, le code condition et l'adresse écrite avant
+ * chaque instruction ; l'enregistrement est la différence avec l'état qui
+ * suit l'instruction.
+ *
+ * \param pmach la machine en cours d'exécution
+ * \param tw l'écrivain créé pour cette machine
+ */
+void simul_record(Machine *pmach, Trace_Writer *tw)
+{
+	bool execute = true;
+	Word registers[NREGISTERS];
+
+	recording = tw;
+	while (execute) {
+		if (pmach->_pc >= pmach->_textsize) {
+			error(ERR_SEGTEXT, pmach->_pc);
+		}
+		unsigned addr = pmach->_pc;
+		Micro_Op *op = &pmach->_decoded[addr];
+		Condition_Code cc = pmach->_cc;
+		unsigned mem_addr = 0;
+		bool mem = written_address(pmach, op, &mem_addr);
+		Word old = mem && mem_addr < pmach->_datasize ? pmach->_data[mem_addr] : 0;
+
+		memcpy(registers, pmach->_registers, sizeof(registers));
+		tw->_pending = true;
+		pmach->_pc = addr + 1;
+		pmach->_icount += 1;
+		execute = op_handler(op)(pmach, op);
+		tw->_pending = false;
+		// CALL non exécuté (condition fausse) : la pile ne bouge pas
+		if (op->_cop == CALL && pmach->_sp == registers[NREGISTERS - 1])
+			mem = false;
+		record(tw, pmach, addr, registers, cc, mem, mem_addr, old);
+	}
+	recording = NULL;
+}
+
+//! Erreur de lecture d'une trace
+static void invalid_trace(void)
+{
+	fprintf(stderr, "Fichier de trace invalide.\n");
+	exit(1);
+}
+
+//! Lecture d'un entier non signé en varint
+static uint32_t get_varint(Trace_Reader *tr)
+{
+	uint32_t value = 0;
+	int c;
+
+	for (unsigned shift = 0; shift < 35; shift += 7) {
+		if ((c = getc(tr->_file)) == EOF)
+			invalid_trace();
+		value |= (uint32_t) (c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return value;
+	}
+	invalid_trace();
+	return 0;
+}
+
+//! Lecture d'une différence en varint zigzag
+static uint32_t get_delta(Trace_Reader *tr)
+{
+	uint32_t n = get_varint(tr);
+	return (n >> 1) ^ -(n & 1);
+}
+
+//! Lecture de mots de 32 bits de l'en-tête
+static void get_words(Trace_Reader *tr, void *words, size_t n)
+{
+	if (fread(words, sizeof(uint32_t), n, tr->_file) != n)
+		invalid_trace();
+}
+
+//! Ouverture d'un fichier de trace
+Trace_Reader *trace_open(const char *path, Machine *pmach)
+{
+	Trace_Reader *tr = malloc(sizeof(Trace_Reader));
+	uint32_t header[5];
+	uint32_t cpu[2];
+
+	if (tr == NULL || (tr->_file = fopen(path, "rb")) == NULL) {
+		fprintf(stderr, "Ouverture du fichier impossible.\n");
+		exit(1);
+	}
+	get_words(tr, header, 5);
+	if (header[0] != TRACE_MAGIC || header[1] != TRACE_VERSION)
+		invalid_trace();
+
+	unsigned textsize = header[2];
+	unsigned datasize = header[3];
+	unsigned dataend = header[4];
+
+	tr->_last_mem = 0;
+	tr->_text = malloc(textsize * sizeof(Instruction) + 1);
+	tr->_data = malloc(datasize * sizeof(Word) + 1);
+	if (tr->_text == NULL || tr->_data == NULL)
+		invalid_trace();
+	get_words(tr, tr->_text, textsize);
+	get_words(tr, tr->_data, datasize);
+
+	if (!load_program(pmach, textsize, tr->_text, datasize, tr->_data, dataend))
+		invalid_trace();
+
+	get_words(tr, cpu, 2);
+	get_words(tr, pmach->_registers, NREGISTERS);
+	pmach->_pc = cpu[0];
+	pmach->_cc = cpu[1];
+	verify_program(pmach);
+	metrics_reset(pmach);
+	return tr;
+}
+
+//! Lecture et rejeu d'un enregistrement
+bool trace_next(Trace_Reader *tr, Machine *pmach, Trace_Step *step)
+{
+	int flags = getc(tr->_file);
+
+	if (flags == EOF)
+		return false;
+
+	step->_addr = pmach->_pc;
+	step->_fault = flags & TRACE_FAULT;
+	pmach->_pc += 1;
+	pmach->_icount += 1;
+
+	if (flags & TRACE_JUMP)
+		pmach->_pc += get_delta(tr);
+	if (flags & TRACE_REG) {
+		int reg = getc(tr->_file);
+		if (reg == EOF || reg >= NREGISTERS)
+			invalid_trace();
+		pmach->_registers[reg] += get_delta(tr);
+	}
+	if (flags & TRACE_MEM) {
+		unsigned addr = tr->_last_mem + get_delta(tr);
+		if (addr >= pmach->_datasize)
+			invalid_trace();
+		pmach->_data[addr] += get_delta(tr);
+		tr->_last_mem = addr;
+	}
+	if (flags & TRACE_CC)
+		pmach->_cc = (flags >> 4) & 3;
+	return true;
+}
+
+//! Fermeture d'un fichier de trace en lecture
+void trace_release(Trace_Reader *tr)
+{
+	fclose(tr->_file);
+	free(tr->_text);
+	free(tr->_data);
+	free(tr);
+}
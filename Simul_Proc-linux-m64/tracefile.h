@@ -0,0 +1,116 @@
+#ifndef _TRACEFILE_H_
+#define _TRACEFILE_H_
+
+/*!
+ * \file tracefile.h
+ * \brief Trace d'exécution binaire compacte
+ *
+ * Format d'un fichier de trace (mots de 32 bits dans l'ordre de l'hôte) :
+ *
+ *   - en-tête : \c TRACE_MAGIC, \c TRACE_VERSION, puis \c textsize,
+ *     \c datasize, \c dataend, le segment de texte, le segment de données
+ *     complet, \c pc, \c cc et les registres au début de l'enregistrement ;
+ *   - un enregistrement par instruction exécutée : un octet d'indicateurs
+ *     (\link Trace_Flag \endlink) suivi des champs qu'ils annoncent, entiers
+ *     codés en \e varint (LEB128, les valeurs signées en \e zigzag).
+ *
+ * Le compteur ordinal n'est enregistré que lorsqu'il ne passe pas à
+ * l'instruction suivante (branchement pris, appel, retour), sous forme d'un
+ * écart. Les écritures en registre et en mémoire sont des différences avec
+ * la valeur précédente ; l'adresse d'une écriture en mémoire est un écart
+ * avec celle de l'écriture précédente.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "machine.h"
+
+//! Signature d'un fichier de trace ("SPTR")
+#define TRACE_MAGIC 0x52545053
+
+//! Version du format de trace
+#define TRACE_VERSION 1
+
+//! Indicateurs d'un enregistrement
+typedef enum
+{
+    TRACE_JUMP = 0x01,	//!< Écart du compteur ordinal après l'instruction
+    TRACE_REG = 0x02,	//!< Écriture en registre : numéro, différence
+    TRACE_MEM = 0x04,	//!< Écriture en mémoire : écart d'adresse, différence
+    TRACE_CC = 0x08,	//!< Nouveau code condition (bits 4 et 5 de l'octet)
+    TRACE_FAULT = 0x40,	//!< Instruction interrompue par une erreur, sans effet
+} Trace_Flag;
+
+//! Écrivain de trace binaire
+typedef struct Trace_Writer Trace_Writer;
+
+//! Lecteur de trace binaire
+typedef struct Trace_Reader Trace_Reader;
+
+//! Une instruction relue dans la trace
+typedef struct
+{
+    unsigned _addr;		//!< Adresse de l'instruction exécutée
+    bool _fault;		//!< Interrompue par une erreur ?
+} Trace_Step;
+
+//! Création d'un fichier de trace
+/*!
+ * L'en-tête décrit l'état de la machine au moment de l'appel. Le tampon est
+ * vidé à la fermeture, et aussi à la sortie du programme si une erreur
+ * interrompt la simulation (l'instruction fautive est alors enregistrée avec
+ * \c TRACE_FAULT).
+ *
+ * \param path le nom du fichier
+ * \param pmach la machine dont on va enregistrer l'exécution
+ * \return l'écrivain ; le programme s'arrête si le fichier ne peut être créé
+ */
+Trace_Writer *trace_create(const char *path, const Machine *pmach);
+
+//! Fermeture d'un fichier de trace
+/*!
+ * \param tw l'écrivain (libéré)
+ */
+void trace_close(Trace_Writer *tw);
+
+//! Simulation avec enregistrement de la trace binaire
+/*!
+ * Même boucle que simul_trace() sans trace texte ni mise au point ; chaque
+ * instruction exécutée produit un enregistrement.
+ *
+ * \param pmach la machine en cours d'exécution
+ * \param tw l'écrivain créé pour cette machine
+ */
+void simul_record(Machine *pmach, Trace_Writer *tw);
+
+//! Ouverture d'un fichier de trace
+/*!
+ * La machine est chargée avec le programme et l'état de l'en-tête ; ses
+ * segments appartiennent au lecteur.
+ *
+ * \param path le nom du fichier
+ * \param pmach la machine à initialiser
+ * \return le lecteur ; le programme s'arrête si le fichier est invalide
+ */
+Trace_Reader *trace_open(const char *path, Machine *pmach);
+
+//! Lecture et rejeu d'un enregistrement
+/*!
+ * Les écritures enregistrées sont appliquées à la machine, sans exécuter
+ * l'instruction : la machine est dans l'état qui suit l'instruction.
+ *
+ * \param tr le lecteur
+ * \param pmach la machine initialisée par trace_open()
+ * \param step l'instruction relue
+ * \return faux à la fin de la trace
+ */
+bool trace_next(Trace_Reader *tr, Machine *pmach, Trace_Step *step);
+
+//! Fermeture d'un fichier de trace en lecture
+/*!
+ * \param tr le lecteur (libéré avec les segments de la machine)
+ */
+void trace_release(Trace_Reader *tr);
+
+#endif
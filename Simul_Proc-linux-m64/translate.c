@@ -0,0 +1,411 @@
+/*!
+ * \file translate.c
+ * \brief Traduction statique d'un programme binaire en C
+ *
+ * Le programme (au format lu par read_program()) est traduit en un source C
+ * autonome : chaque adresse du segment de texte devient une étiquette, les
+ * branchements deviennent des \c goto, et \c RET passe par un \c switch sur
+ * les adresses de retour des \c CALL du programme.
+ *
+ * Le source produit s'utilise avec les fichiers du simulateur, pour
+ * load_program(), print_cpu(), print_data() et error() :
+ *
+ *	translate -o prog.c prog.bin
+ *	gcc -std=gnu99 -O2 -I. prog.c machine.c binfile.c exec.c error.c instruction.c debug.c \
+ *	    async.c metrics.c verify.c guard.c paging.c textcache.c -lpthread
+ *
+ * L'exécutable obtenu affiche les mêmes erreurs et avertissements que le
+ * simulateur, et le même état final de la machine après \c HALT.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "machine.h"
+#include "exec.h"
+
+//! Expression C de chaque condition sur la variable \c cc du programme traduit
+static const char *conditions[LE + 1] = {
+	[NC] = NULL,
+	[EQ] = "cc == CC_Z",
+	[NE] = "cc == CC_P || cc == CC_N",
+	[GT] = "cc == CC_P",
+	[GE] = "cc == CC_Z || cc == CC_P",
+	[LT] = "cc == CC_N",
+	[LE] = "cc == CC_N || cc == CC_Z",
+};
+
+//! Début du source traduit : macros d'exécution
+static const char prologue[] =
+	"#include <stdio.h>\n"
+	"#include <string.h>\n"
+	"\n"
+	"#include \"machine.h\"\n"
+	"#include \"error.h\"\n"
+	"\n"
+	"#define SP (NREGISTERS - 1)\n"
+	"#define SET_CC(v) (cc = (v) > 0 ? CC_P : CC_Z)\n"
+	"#define SYNC() (memcpy(mach._registers, R, sizeof(R)), mach._cc = cc)\n"
+	"#define FAULT(err, addr) do { SYNC(); mach._pc = (addr); error(err, addr); } while (0)\n"
+	"#define CHECK_SP(sp, pc) do { if ((sp) < DATAEND || (sp) > DATASIZE - 1) FAULT(ERR_SEGSTACK, pc); } while (0)\n"
+	"#define CHECK_DATA(addr, limit, pc) do { if ((addr) >= (limit)) FAULT(ERR_SEGDATA, pc); } while (0)\n"
+	"\n";
+
+//! Écriture des segments initiaux, dans le format de dump_memory()
+/*!
+ * \param out le source traduit
+ * \param pmach le programme lu
+ */
+static void write_segments(FILE *out, Machine *pmach)
+{
+	const char *sep;
+
+	fprintf(out, "#define TEXTSIZE %uu\n", pmach->_textsize);
+	fprintf(out, "#define DATASIZE %uu\n", pmach->_datasize);
+	fprintf(out, "#define DATAEND %uu\n\n", pmach->_dataend);
+
+	fprintf(out, "static Instruction text[TEXTSIZE + 1] = {\n\t");
+	for (unsigned i = 0; i < pmach->_textsize; ++i) {
+		sep = (i+1) % 4 ? ", " : ",\n\t";
+		fprintf(out, "{0x%.8x}%s", pmach->_text[i]._raw, sep);
+	}
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "static Word data[DATASIZE + 1] = {\n\t");
+	for (unsigned i = 0; i < pmach->_datasize; ++i) {
+		sep = (i+1) % 4 ? ", " : ",\n\t";
+		fprintf(out, "0x%.8x%s", pmach->_data[i], sep);
+	}
+	fprintf(out, "\n};\n\n");
+}
+
+//! Opérande de données : adresse absolue ou calculée dans la variable \c a
+/*!
+ * \param out le source traduit
+ * \param op l'instruction pré-décodée
+ * \param indexed vrai en mode indexé
+ * \return l'expression de l'adresse
+ */
+static const char *address(FILE *out, const Micro_Op *op, bool indexed)
+{
+	static char abs[16];
+
+	if (indexed) {
+		fprintf(out, "\t\tWord a = R[%u] + (Word) %d;\n", op->_rindex, op->_operand);
+		return "a";
+	}
+	snprintf(abs, sizeof(abs), "%u", (unsigned) op->_operand);
+	return abs;
+}
+
+//! Traduction d'une instruction
+/*!
+ * L'ordre des vérifications et des effets de bord est celui des fonctions
+ * d'exécution de exec.c.
+ *
+ * \param out le source traduit
+ * \param pmach le programme lu
+ * \param addr l'adresse de l'instruction
+ * \return vrai si l'instruction est un \c CALL (son successeur est une
+ * adresse de retour)
+ */
+static bool translate_instruction(FILE *out, Machine *pmach, unsigned addr)
+{
+	Micro_Op op;
+	unsigned pc = addr + 1;
+	unsigned operand;
+	const char *a;
+	bool indexed = false;
+	bool call = false;
+
+	decode_instruction(&op, pmach->_text[addr]);
+	operand = op._operand;
+
+	fprintf(out, "L_%u:\t// 0x%.4x: 0x%.8x\n\t{\n", addr, addr, pmach->_text[addr]._raw);
+
+	switch (op._kind) {
+	case OP_NOP:
+		break;
+
+	case OP_LOAD_IMM:
+		fprintf(out, "\t\tR[%u] = (Word) %d;\n", op._regcond, op._operand);
+		fprintf(out, "\t\tSET_CC(R[%u]);\n", op._regcond);
+		break;
+	case OP_ADD_IMM:
+	case OP_SUB_IMM:
+		fprintf(out, "\t\tR[%u] %c= (Word) %d;\n", op._regcond, op._kind == OP_ADD_IMM ? '+' : '-', op._operand);
+		fprintf(out, "\t\tSET_CC(R[%u]);\n", op._regcond);
+		break;
+
+	case OP_LOAD_IDX:
+	case OP_ADD_IDX:
+	case OP_SUB_IDX:
+		indexed = true;
+		// fall through
+	case OP_LOAD_ABS:
+	case OP_ADD_ABS:
+	case OP_SUB_ABS:
+		if (!indexed && operand >= pmach->_datasize) {
+			fprintf(out, "\t\tFAULT(ERR_SEGDATA, %u);\n", pc);
+			break;
+		}
+		a = address(out, &op, indexed);
+		if (indexed)
+			fprintf(out, "\t\tCHECK_DATA(a, DATASIZE, %u);\n", pc);
+		fprintf(out, "\t\tR[%u] %s D[%s];\n", op._regcond,
+			op._cop == LOAD ? "=" : op._cop == ADD ? "+=" : "-=", a);
+		fprintf(out, "\t\tSET_CC(R[%u]);\n", op._regcond);
+		break;
+
+	case OP_STORE_IDX:
+		indexed = true;
+		// fall through
+	case OP_STORE_ABS:
+		if (!indexed && (operand >= pmach->_datasize || operand >= pmach->_dataend)) {
+			fprintf(out, "\t\tFAULT(ERR_SEGDATA, %u);\n", pc);
+			break;
+		}
+		a = address(out, &op, indexed);
+		if (indexed) {
+			fprintf(out, "\t\tCHECK_DATA(a, DATASIZE, %u);\n", pc);
+			fprintf(out, "\t\tCHECK_DATA(a, DATAEND, %u);\n", pc);
+		}
+		fprintf(out, "\t\tD[%s] = R[%u];\n", a, op._regcond);
+		break;
+
+	case OP_BRANCH_IDX:
+	case OP_CALL_IDX:
+		indexed = true;
+		// fall through
+	case OP_BRANCH_ABS:
+	case OP_CALL_ABS:
+		call = op._cop == CALL;
+		if (conditions[op._regcond] != NULL)
+			fprintf(out, "\t\tif (%s) {\n", conditions[op._regcond]);
+		else
+			fprintf(out, "\t\t{\n");
+		if (indexed)
+			fprintf(out, "\t\t\ttarget = R[%u] + (Word) %d;\n", op._rindex, op._operand);
+		if (call) {
+			fprintf(out, "\t\t\tCHECK_SP(R[SP], %u);\n", pc);
+			fprintf(out, "\t\t\tD[R[SP]] = %u;\n", pc);
+			fprintf(out, "\t\t\tR[SP] -= 1;\n");
+		}
+		if (indexed) {
+			fprintf(out, "\t\t\tif (target >= TEXTSIZE)\n\t\t\t\tFAULT(ERR_SEGTEXT, %u);\n", pc);
+			fprintf(out, "\t\t\tgoto dispatch;\n");
+		} else if (operand >= pmach->_textsize) {
+			fprintf(out, "\t\t\tFAULT(ERR_SEGTEXT, %u);\n", pc);
+		} else {
+			fprintf(out, "\t\t\tgoto L_%u;\n", operand);
+		}
+		fprintf(out, "\t\t}\n");
+		break;
+
+	case OP_RET:
+		fprintf(out, "\t\tCHECK_SP(R[SP] + 1, %u);\n", pc);
+		fprintf(out, "\t\tR[SP] += 1;\n");
+		fprintf(out, "\t\ttarget = D[R[SP]];\n");
+		fprintf(out, "\t\tgoto ret;\n");
+		break;
+
+	case OP_PUSH_IMM:
+		fprintf(out, "\t\tCHECK_SP(R[SP], %u);\n", pc);
+		fprintf(out, "\t\tD[R[SP]] = (Word) %d;\n", op._operand);
+		fprintf(out, "\t\tCHECK_SP(R[SP] - 1, %u);\n", pc);
+		fprintf(out, "\t\tR[SP] -= 1;\n");
+		break;
+	case OP_PUSH_IDX:
+		indexed = true;
+		// fall through
+	case OP_PUSH_ABS:
+		a = address(out, &op, indexed);
+		fprintf(out, "\t\tCHECK_SP(R[SP], %u);\n", pc);
+		if (indexed) {
+			fprintf(out, "\t\tCHECK_DATA(a, DATASIZE, %u);\n", pc);
+		} else if (operand >= pmach->_datasize) {
+			fprintf(out, "\t\tFAULT(ERR_SEGDATA, %u);\n", pc);
+			break;
+		}
+		fprintf(out, "\t\tD[R[SP]] = D[%s];\n", a);
+		fprintf(out, "\t\tCHECK_SP(R[SP] - 1, %u);\n", pc);
+		fprintf(out, "\t\tR[SP] -= 1;\n");
+		break;
+
+	case OP_POP_IDX:
+		indexed = true;
+		// fall through
+	case OP_POP_ABS:
+		if (!indexed && operand >= pmach->_datasize) {
+			fprintf(out, "\t\tFAULT(ERR_SEGDATA, %u);\n", pc);
+			break;
+		}
+		a = address(out, &op, indexed);
+		if (indexed)
+			fprintf(out, "\t\tCHECK_DATA(a, DATASIZE, %u);\n", pc);
+		fprintf(out, "\t\tCHECK_SP(R[SP] + 1, %u);\n", pc);
+		fprintf(out, "\t\tR[SP] += 1;\n");
+		fprintf(out, "\t\tCHECK_DATA(%s, DATAEND, %u);\n", a, pc);
+		fprintf(out, "\t\tD[%s] = D[R[SP]];\n", a);
+		break;
+
+	case OP_HALT:
+		fprintf(out, "\t\tSYNC();\n");
+		fprintf(out, "\t\tmach._pc = %u;\n", pc);
+		fprintf(out, "\t\twarning(WARN_HALT, %u);\n", addr);
+		fprintf(out, "\t\tgoto halt;\n");
+		break;
+
+	case OP_ILLOP:
+		fprintf(out, "\t\tFAULT(ERR_NOERROR, %u);\n", pc);
+		break;
+	case OP_ERR_IMMEDIATE:
+		fprintf(out, "\t\tFAULT(ERR_IMMEDIATE, %u);\n", pc);
+		break;
+	case OP_ERR_CONDITION:
+		fprintf(out, "\t\tFAULT(ERR_CONDITION, %u);\n", pc);
+		break;
+	default:
+		fprintf(out, "\t\tFAULT(ERR_UNKNOWN, %u);\n", pc);
+		break;
+	}
+
+	fprintf(out, "\t}\n");
+	return call;
+}
+
+//! Traduction du programme
+/*!
+ * Le programme traduit commence par un passage dans l'aiguillage général
+ * (\c dispatch) depuis le compteur ordinal initial, comme après un \c RET
+ * vers une adresse qui n'est pas un retour de \c CALL ou après un
+ * branchement indexé.
+ *
+ * \param out le source traduit
+ * \param pmach le programme lu
+ * \param programfile le nom du fichier binaire (pour le commentaire d'en-tête)
+ */
+static void translate_program(FILE *out, Machine *pmach, const char *programfile)
+{
+	bool *returns = calloc(pmach->_textsize + 1, sizeof(bool));
+	bool has_ret = false;
+
+	if (returns == NULL) {
+		fprintf(stderr, "Mémoire insuffisante.\n");
+		exit(1);
+	}
+
+	fprintf(out, "// Traduction de %s par translate (ne pas modifier)\n\n", programfile);
+	fputs(prologue, out);
+	write_segments(out, pmach);
+
+	fprintf(out, "int main(void)\n{\n");
+	fprintf(out, "\tMachine mach;\n");
+	fprintf(out, "\tWord R[NREGISTERS];\n");
+	fprintf(out, "\tWord *const D = data;\n");
+	fprintf(out, "\tCondition_Code cc;\n");
+	fprintf(out, "\tWord target;\n\n");
+	fprintf(out, "\tif (!load_program(&mach, TEXTSIZE, text, DATASIZE, data, DATAEND)) {\n");
+	fprintf(out, "\t\tfprintf(stderr, \"Mémoire insuffisante.\\n\");\n");
+	fprintf(out, "\t\treturn 1;\n\t}\n");
+	fprintf(out, "\tmemcpy(R, mach._registers, sizeof(R));\n");
+	fprintf(out, "\tcc = mach._cc;\n");
+	fprintf(out, "\ttarget = mach._pc;\n");
+	fprintf(out, "\tgoto dispatch;\n\n");
+
+	for (unsigned addr = 0; addr < pmach->_textsize; ++addr) {
+		Micro_Op op;
+
+		decode_instruction(&op, pmach->_text[addr]);
+		has_ret |= op._kind == OP_RET;
+		if (translate_instruction(out, pmach, addr))
+			returns[addr + 1] = true;
+	}
+
+	// Sortie du segment de texte en séquence
+	fprintf(out, "\tFAULT(ERR_SEGTEXT, TEXTSIZE);\n\n");
+
+	if (has_ret) {
+		fprintf(out, "ret:\n\tswitch (target) {\n");
+		for (unsigned addr = 0; addr < pmach->_textsize; ++addr)
+			if (returns[addr])
+				fprintf(out, "\tcase %u: goto L_%u;\n", addr, addr);
+		fprintf(out, "\tdefault: goto dispatch;\n\t}\n\n");
+	}
+
+	fprintf(out, "dispatch:\n\tswitch (target) {\n");
+	for (unsigned addr = 0; addr < pmach->_textsize; ++addr)
+		fprintf(out, "\tcase %u: goto L_%u;\n", addr, addr);
+	fprintf(out, "\tdefault: FAULT(ERR_SEGTEXT, target);\n\t}\n\n");
+
+	fprintf(out, "halt:\n");
+	fprintf(out, "\tprintf(\"\\n*** Machine state after execution ***\\n\");\n");
+	fprintf(out, "\tprint_cpu(&mach);\n");
+	fprintf(out, "\tprint_data(&mach);\n");
+	fprintf(out, "\treturn 0;\n}\n");
+
+	free(returns);
+}
+
+//! Message d'aide
+static void usage(void)
+{
+	printf("Usage: translate [-o output.c] binfile\n"
+	       "Translate a binary program (as read by test_simul -b) into a C\n"
+	       "source to compile with the simulator sources. The source is\n"
+	       "written on the standard output unless -o is given.\n");
+}
+
+//! Traducteur statique
+/*!
+ * Options de la ligne de commande :
+ *
+ * <dl>
+ *   <dt>-o</dt><dd>le source traduit est écrit dans le fichier dont le nom
+ *   suit ; sans cette option, il est écrit sur la sortie standard.</dd>
+ *
+ *   <dt>-h</dt><dd>affichage de l'aide</dd>
+ * </dl>
+ */
+int main(int argc, char *argv[])
+{
+	const char *programfile = NULL;
+	const char *outfile = NULL;
+	FILE *out = stdout;
+
+	for (int iarg = 1; iarg < argc; ++iarg) {
+		if (strcmp(argv[iarg], "-o") == 0 && iarg + 1 < argc) {
+			outfile = argv[++iarg];
+		} else if (strcmp(argv[iarg], "-h") == 0) {
+			usage();
+			exit(EXIT_SUCCESS);
+		} else if (argv[iarg][0] == '-') {
+			fprintf(stderr, "Unknown option: %s\n", argv[iarg]);
+			usage();
+			exit(EXIT_FAILURE);
+		} else {
+			programfile = argv[iarg];
+		}
+	}
+
+	if (programfile == NULL) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	Machine mach;
+	read_program(&mach, programfile);
+
+	if (outfile != NULL && (out = fopen(outfile, "w")) == NULL) {
+		fprintf(stderr, "Ouverture du fichier impossible.\n");
+		exit(1);
+	}
+
+	translate_program(out, &mach, programfile);
+
+	if (out != stdout)
+		fclose(out);
+	return 0;
+}
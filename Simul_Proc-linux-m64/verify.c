@@ -0,0 +1,416 @@
+/*!
+ * \file verify.c
+ * \brief Vérification statique du programme au chargement
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "verify.h"
+#include "exec.h"
+#include "error.h"
+
+//! Taille maximale du segment de texte pour l'analyse des registres
+#define VERIFY_MAX_TEXT (1u << 16)
+
+//! Nombre de jonctions en une adresse avant d'élargir ses intervalles
+#define WIDEN_AFTER 3
+
+//! Numéro du registre SP
+#define SP_REGISTER (NREGISTERS - 1)
+
+//! Intervalle des valeurs d'un registre
+typedef struct
+{
+	Word _lo;
+	Word _hi;
+} Range;
+
+//! Intervalle de toutes les valeurs
+static const Range top = {0, UINT32_MAX};
+
+//! État abstrait de la machine avant une instruction
+typedef struct
+{
+	bool _reached;		//!< Instruction atteinte par l'analyse
+	int8_t _ccreg;		//!< Registre dont le signe a fixé le code condition, ou -1
+	uint8_t _joins;		//!< Nombre de jonctions qui ont modifié l'état
+	Range _regs[NREGISTERS];
+} State;
+
+//! Analyse des registres d'un programme
+typedef struct
+{
+	const Machine *_pmach;
+	State *_states;		//!< État avant chaque instruction
+	unsigned *_work;	//!< Instructions à (ré)examiner
+	bool *_queued;
+	unsigned _nwork;
+	unsigned *_returns;	//!< Adresses de retour des CALL
+	unsigned _nreturns;
+	bool _stack;		//!< La pile ne contient que des adresses de retour
+	bool _failed;		//!< Flot de contrôle perdu : pas de preuve indexée
+} Analysis;
+
+//! Le branchement est-il pris quand le code condition vaut Z ?
+static bool taken_if_zero(unsigned cond)
+{
+	return cond == NC || cond == EQ || cond == GE || cond == LE;
+}
+
+//! Le branchement est-il pris quand le code condition vaut P ?
+static bool taken_if_positive(unsigned cond)
+{
+	return cond == NC || cond == NE || cond == GT || cond == GE;
+}
+
+//! Jonction d'un état dans celui d'une instruction
+/*!
+ * Au-delà de \c WIDEN_AFTER jonctions, une borne inférieure qui baisse
+ * passe à 1 puis à 0 (on garde « non nul »), une borne supérieure qui monte
+ * passe au maximum.
+ */
+static void flow(Analysis *an, unsigned to, const State *s)
+{
+	if (to >= an->_pmach->_textsize)
+		return;		// erreur à l'exécution : pas de successeur
+
+	State *dst = &an->_states[to];
+	bool changed = false;
+
+	if (!dst->_reached) {
+		*dst = *s;
+		dst->_reached = true;
+		dst->_joins = 0;
+		changed = true;
+	} else {
+		bool widen = dst->_joins >= WIDEN_AFTER;
+
+		for (unsigned r = 0; r < NREGISTERS; ++r) {
+			Range *d = &dst->_regs[r];
+			const Range *n = &s->_regs[r];
+
+			if (n->_lo < d->_lo) {
+				d->_lo = !widen ? n->_lo : n->_lo >= 1 ? 1 : 0;
+				changed = true;
+			}
+			if (n->_hi > d->_hi) {
+				d->_hi = !widen ? n->_hi : UINT32_MAX;
+				changed = true;
+			}
+		}
+		if (dst->_ccreg != s->_ccreg && dst->_ccreg >= 0) {
+			dst->_ccreg = -1;
+			changed = true;
+		}
+		if (changed && dst->_joins < UINT8_MAX)
+			dst->_joins += 1;
+	}
+
+	if (changed && !an->_queued[to]) {
+		an->_queued[to] = true;
+		an->_work[an->_nwork++] = to;
+	}
+}
+
+//! Restriction d'un état au signe du registre qui a fixé le code condition
+/*!
+ * Le code condition vaut Z si ce registre est nul, P sinon (les mots sont
+ * non signés : jamais N).
+ *
+ * \param s l'état à restreindre
+ * \param zero l'état est-il possible si le registre est nul ?
+ * \param positive l'état est-il possible s'il ne l'est pas ?
+ * \return faux si l'état est impossible
+ */
+static bool refine(State *s, bool zero, bool positive)
+{
+	if (s->_ccreg < 0)
+		return true;
+
+	Range *r = &s->_regs[s->_ccreg];
+
+	if (zero && positive)
+		return true;
+	if (zero) {
+		if (r->_lo > 0)
+			return false;
+		r->_hi = 0;
+		return true;
+	}
+	if (positive) {
+		if (r->_hi == 0)
+			return false;
+		if (r->_lo == 0)
+			r->_lo = 1;
+		return true;
+	}
+	return false;
+}
+
+//! Décalage d'un intervalle, modulo 2^32
+static Range shift(Range r, int64_t delta)
+{
+	int64_t lo = (int64_t) r._lo + delta;
+	int64_t hi = (int64_t) r._hi + delta;
+
+	if (lo >= 0 && hi <= UINT32_MAX)
+		return (Range) {lo, hi};
+	if (hi < 0 || lo > UINT32_MAX)		// tout l'intervalle déborde du même côté
+		return (Range) {(Word) lo, (Word) hi};
+	return top;
+}
+
+//! Intervalle de l'adresse d'une instruction en mode indexé
+static Range indexed_range(const State *s, const Micro_Op *op)
+{
+	if (op->_rindex == SP_REGISTER)
+		return top;
+	return shift(s->_regs[op->_rindex], op->_operand);
+}
+
+//! Écriture d'un registre général, qui fixe le code condition
+static void set_register(State *s, unsigned reg, Range value)
+{
+	s->_regs[reg] = value;
+	s->_ccreg = reg == SP_REGISTER ? -1 : reg;
+}
+
+//! Branchement ou appel vers l'adresse de l'opérande
+static void flow_jump(Analysis *an, const State *s, const Micro_Op *op, bool indexed)
+{
+	if (!indexed) {
+		flow(an, op->_operand, s);
+		return;
+	}
+
+	Range target = indexed_range(s, op);
+
+	if (target._lo >= an->_pmach->_textsize)
+		return;		// toujours hors du segment de texte : erreur
+	if (target._lo != target._hi)
+		an->_failed = true;
+	else
+		flow(an, target._lo, s);
+}
+
+//! Successeurs d'une instruction
+static void transfer(Analysis *an, unsigned addr)
+{
+	State s = an->_states[addr];
+	Micro_Op op;
+
+	decode_instruction(&op, an->_pmach->_text[addr]);
+	switch (op._kind) {
+	case OP_LOAD_IMM:
+		set_register(&s, op._regcond, (Range) {(Word) op._operand, (Word) op._operand});
+		break;
+	case OP_ADD_IMM:
+		set_register(&s, op._regcond, shift(s._regs[op._regcond], op._operand));
+		break;
+	case OP_SUB_IMM:
+		set_register(&s, op._regcond, shift(s._regs[op._regcond], -(int64_t) op._operand));
+		break;
+	case OP_LOAD_ABS: case OP_LOAD_IDX:
+	case OP_ADD_ABS: case OP_ADD_IDX:
+	case OP_SUB_ABS: case OP_SUB_IDX:
+		set_register(&s, op._regcond, top);
+		break;
+
+	case OP_NOP:
+	case OP_STORE_ABS: case OP_STORE_IDX:
+	case OP_PUSH_IMM: case OP_PUSH_ABS: case OP_PUSH_IDX:
+	case OP_POP_ABS: case OP_POP_IDX:
+		break;
+
+	case OP_BRANCH_ABS: case OP_BRANCH_IDX:
+	case OP_CALL_ABS: case OP_CALL_IDX: {
+		bool zero = taken_if_zero(op._regcond);
+		bool positive = taken_if_positive(op._regcond);
+		State taken = s;
+
+		if (op._regcond != NC && !refine(&s, !zero, !positive))
+			s._reached = false;
+		if (refine(&taken, zero, positive))
+			flow_jump(an, &taken, &op, op._kind == OP_BRANCH_IDX || op._kind == OP_CALL_IDX);
+		if (op._regcond == NC || !s._reached)
+			return;
+		break;
+	}
+
+	case OP_RET:
+		if (!an->_stack) {
+			an->_failed = true;
+			return;
+		}
+		for (unsigned i = 0; i < an->_nreturns; ++i)
+			flow(an, an->_returns[i], &s);
+		return;
+
+	default:	// HALT, ILLOP, instructions invalides : pas de successeur
+		return;
+	}
+	flow(an, addr + 1, &s);
+}
+
+//! Analyse des registres depuis l'état courant de la machine
+/*!
+ * \return faux si l'analyse est impossible (mémoire, taille du programme)
+ * ou a perdu le flot de contrôle
+ */
+static bool analyse(Analysis *an)
+{
+	const Machine *pmach = an->_pmach;
+	unsigned textsize = pmach->_textsize;
+
+	if (textsize > VERIFY_MAX_TEXT || pmach->_pc >= textsize)
+		return false;
+
+	an->_states = calloc(textsize, sizeof(State));
+	an->_work = malloc(textsize * sizeof(unsigned));
+	an->_queued = calloc(textsize, sizeof(bool));
+	an->_returns = malloc(textsize * sizeof(unsigned));
+	if (an->_states == NULL || an->_work == NULL || an->_queued == NULL || an->_returns == NULL)
+		return false;
+
+	// Sans PUSH ni écriture de SP, depuis une pile vide, RET ne trouve que des adresses écrites par CALL
+	an->_stack = pmach->_sp == pmach->_datasize - 1;
+	for (unsigned a = 0; a < textsize; ++a) {
+		Micro_Op op;
+
+		decode_instruction(&op, pmach->_text[a]);
+		if (op._kind == OP_CALL_ABS || op._kind == OP_CALL_IDX)
+			an->_returns[an->_nreturns++] = a + 1;
+		else if (op._kind == OP_PUSH_IMM || op._kind == OP_PUSH_ABS || op._kind == OP_PUSH_IDX)
+			an->_stack = false;
+		else if (op._regcond == SP_REGISTER && (op._kind == OP_LOAD_IMM || op._kind == OP_LOAD_ABS
+		    || op._kind == OP_LOAD_IDX || op._kind == OP_ADD_IMM || op._kind == OP_ADD_ABS
+		    || op._kind == OP_ADD_IDX || op._kind == OP_SUB_IMM || op._kind == OP_SUB_ABS
+		    || op._kind == OP_SUB_IDX))
+			an->_stack = false;
+	}
+
+	State entry = {._reached = true, ._ccreg = -1};
+	for (unsigned r = 0; r < NREGISTERS; ++r)
+		entry._regs[r] = (Range) {pmach->_registers[r], pmach->_registers[r]};
+	entry._regs[SP_REGISTER] = top;
+	flow(an, pmach->_pc, &entry);
+
+	while (an->_nwork > 0 && !an->_failed) {
+		unsigned addr = an->_work[--an->_nwork];
+
+		an->_queued[addr] = false;
+		transfer(an, addr);
+	}
+	return !an->_failed;
+}
+
+//! Borne des adresses valides pour l'opérande d'une instruction
+/*!
+ * \param pmach la machine
+ * \param op l'instruction, pré-décodée seule
+ * \param limit la borne (exclue)
+ * \return faux si l'instruction ne vérifie pas d'adresse
+ */
+static bool address_limit(const Machine *pmach, const Micro_Op *op, unsigned *limit)
+{
+	switch (op->_kind) {
+	case OP_LOAD_ABS: case OP_LOAD_IDX:
+	case OP_ADD_ABS: case OP_ADD_IDX:
+	case OP_SUB_ABS: case OP_SUB_IDX:
+	case OP_PUSH_ABS: case OP_PUSH_IDX:
+		*limit = pmach->_datasize;
+		return true;
+	case OP_STORE_ABS: case OP_STORE_IDX:
+	case OP_POP_ABS: case OP_POP_IDX:
+		*limit = pmach->_datasize < pmach->_dataend ? pmach->_datasize : pmach->_dataend;
+		return true;
+	case OP_BRANCH_ABS: case OP_BRANCH_IDX:
+	case OP_CALL_ABS: case OP_CALL_IDX:
+		*limit = pmach->_textsize;
+		return true;
+	default:
+		return false;
+	}
+}
+
+//! L'adresse de l'opérande est-elle prouvée valide ?
+/*!
+ * \param an l'analyse des registres, ou NULL si elle a échoué
+ * \param pmach la machine
+ * \param addr l'adresse de l'instruction
+ * \param op l'instruction, pré-décodée seule
+ */
+static bool proven(const Analysis *an, const Machine *pmach, unsigned addr, const Micro_Op *op)
+{
+	unsigned limit;
+
+	if (!address_limit(pmach, op, &limit))
+		return false;
+
+	switch (op->_kind) {
+	case OP_LOAD_ABS: case OP_LOAD_IDX: case OP_ADD_ABS: case OP_ADD_IDX:
+	case OP_SUB_ABS: case OP_SUB_IDX: case OP_PUSH_ABS: case OP_PUSH_IDX:
+		// Lecture dans un segment gardé : une adresse invalide fait une faute (voir guard.h)
+		if (pmach->_guard != NULL)
+			return true;
+		break;
+	default:
+		break;
+	}
+
+	switch (op->_kind) {
+	case OP_LOAD_IDX: case OP_ADD_IDX: case OP_SUB_IDX: case OP_PUSH_IDX:
+	case OP_STORE_IDX: case OP_POP_IDX:
+	case OP_BRANCH_IDX: case OP_CALL_IDX:
+		if (an == NULL || !an->_states[addr]._reached)
+			return false;
+		return indexed_range(&an->_states[addr], op)._hi < limit;
+	default:
+		return (unsigned) op->_operand < limit;
+	}
+}
+
+//! Vérification du programme chargé
+unsigned verify_program(Machine *pmach)
+{
+	Analysis an = {._pmach = pmach};
+	bool analysed = analyse(&an);
+	unsigned verified = 0;
+
+	for (unsigned a = 0; a < pmach->_textsize; ++a) {
+		Micro_Op op;
+		bool safe;
+
+		decode_instruction(&op, pmach->_text[a]);
+		safe = proven(analysed ? &an : NULL, pmach, a, &op);
+		set_checked(&pmach->_decoded[a], !safe);
+		verified += safe;
+	}
+
+	free(an._states);
+	free(an._work);
+	free(an._queued);
+	free(an._returns);
+	return verified;
+}
+
+//! Rapport de vérification
+void print_verification(const Machine *pmach)
+{
+	unsigned checked = 0, verified = 0;
+
+	for (unsigned a = 0; a < pmach->_textsize; ++a) {
+		Micro_Op op;
+		unsigned limit;
+
+		decode_instruction(&op, pmach->_text[a]);
+		if (address_limit(pmach, &op, &limit)) {
+			checked += 1;
+			verified += op_verified(&pmach->_decoded[a]);
+		}
+	}
+	fprintf(sim_output(), "\n*** VERIFICATION ***\n%u of %u address checks removed at load time%s\n",
+		verified, checked, pmach->_guard != NULL ? " (guarded data segment)" : "");
+}
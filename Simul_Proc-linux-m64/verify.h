@@ -0,0 +1,55 @@
+#ifndef _VERIFY_H_
+#define _VERIFY_H_
+
+/*!
+ * \file verify.h
+ * \brief Vérification statique du programme au chargement
+ *
+ * Le code opération, la condition et l'usage du mode immédiat sont réglés
+ * une fois pour toutes par le pré-décodage (variantes \c ERR_* et
+ * \c UNKNOWN). Restent les adresses : à chaque exécution, LOAD, STORE, ADD,
+ * SUB, PUSH et POP vérifient l'adresse de leur opérande dans le segment de
+ * données, BRANCH et CALL leur adresse de destination dans le segment de
+ * texte. Le vérificateur parcourt une fois le programme chargé et prouve ces
+ * adresses valides quand il le peut : les instructions prouvées s'exécutent
+ * sans vérification (voir set_checked()), les autres la gardent.
+ *
+ * Une adresse absolue se prouve directement. Une adresse indexée se prouve
+ * par une analyse d'intervalles des registres, de proche en proche depuis
+ * l'état courant de la machine : LOAD et ADD/SUB en mode immédiat donnent
+ * ou décalent un intervalle, un branchement conditionnel le restreint selon
+ * le signe du registre qui a fixé le code condition, et les boucles sont
+ * élargies pour que l'analyse termine. SP n'est jamais borné. L'analyse
+ * renonce à toute preuve indexée si elle ne peut pas suivre le flot de
+ * contrôle : destination indexée qu'elle ne sait pas réduire à une adresse,
+ * ou \c RET alors que la pile peut contenir autre chose que des adresses de
+ * retour (\c PUSH, écriture de SP, pile non vide au départ).
+ *
+ * Sur une machine gardée (voir guard.h), les lectures de LOAD, ADD, SUB et
+ * PUSH sont toutes tenues pour sûres : une adresse invalide y fait une faute.
+ */
+
+#include "machine.h"
+
+//! Vérification du programme chargé
+/*!
+ * Appelée par load_program() ; à rappeler quand on fixe l'état de la
+ * machine après le chargement (point d'entrée, reprise), comme
+ * metrics_reset(). Chaque instruction du segment de texte reçoit sa
+ * fonction d'exécution avec ou sans vérification d'adresse.
+ *
+ * \param pmach la machine, chargée
+ * \return le nombre d'instructions prouvées sûres
+ */
+unsigned verify_program(Machine *pmach);
+
+//! Rapport de vérification
+/*!
+ * Affiche le nombre d'instructions dont l'adresse est vérifiée à
+ * l'exécution, et combien d'entre elles ont été prouvées sûres.
+ *
+ * \param pmach la machine, chargée
+ */
+void print_verification(const Machine *pmach);
+
+#endif